@@ -11,6 +11,7 @@
 #include "scanner.h"
 #include "util.h"
 
+static Machine *   machine        = NULL;
 static u8 *        memory         = NULL;
 static u16         pointer        = 0;
 static char        prefix[30]     = {0}; //  [c050] -->
@@ -38,6 +39,8 @@ static const char *descriptions[] = {
     "Add register pair to H and L registers",                   // DAD
     "Decrement content of register or memory by 1",             // DCR
     "Decrement content of register pair by 1",                  // DCX
+    "Disable interrupts",                                       // DI
+    "Enable interrupts after the next instruction",             // EI
     "Halt and enter wait state",                                // HLT
     "Input data to accumulator from the specified port",        // IN
     "Increment content of register or memory by 1",             // INR
@@ -68,6 +71,7 @@ static const char *descriptions[] = {
     "Rotate accumulator right through carry",                   // RAR
     "Return on carry (C = 1)",                                  // RC
     "Return unconditionally",                                   // RET
+    "Read interrupt masks and serial input to accumulator",     // RIM
     "Rotate accumulator left",                                  // RLC
     "Return on minus (S = 1)",                                  // RM
     "Return on no carry (C = 0)",                               // RNC
@@ -80,6 +84,7 @@ static const char *descriptions[] = {
     "Subtract register or memory from accumulator with borrow", // SBB
     "Subtract immediate from accumulator with borrow",          // SBI
     "Store H and L registers direct",                           // SHLD
+    "Set interrupt masks and serial output from accumulator",   // SIM
     "Copy H and L registers to the stack pointer",              // SPHL
     "Store accumulator direct",                                 // STA
     "Store accumulator indirect",                               // STAX
@@ -111,6 +116,9 @@ static void parse_action(CellStringParts csp, Cell *cell) {
 	str[size]              = 0;
 	u16               pbak = pointer;
 	CompilationStatus res  = compile(str, memory, 0xffff, &pointer);
+	// A label declared by the line patches the lines before it which use
+	// it, which may be anywhere
+	machine_mark_written(machine, 0, 0x10000);
 	switch(res) {
 		case PARSE_ERROR:
 		case LABEL_FULL:
@@ -238,10 +246,11 @@ static void asm_action(CellStringParts csp, Cell *t) {
 	}
 }
 
-void asm_init(Cell *cell, u8 *mem) {
+void asm_init(Cell *cell, Machine *m, u8 *mem) {
 	CellKeyword casm =
 	    cell_create_keyword("asm", "Invoke the assembler", asm_action);
 	casm.longhelp = asm_help;
 	cell_insert_keyword(cell, casm);
-	memory = mem;
+	machine = m;
+	memory  = mem;
 }
@@ -2,5 +2,8 @@
 
 #include "Cell/cell.h"
 #include "common.h"
+#include "vm.h"
 
-void asm_init(Cell *c, u8 *mem);
+// Adds the assembler to the shell, which writes the lines it compiles
+// to 'mem', the memory of 'm'
+void asm_init(Cell *c, Machine *m, u8 *mem);
@@ -0,0 +1,873 @@
+#include "batch.h"
+#include "interrupt.h"
+#include <string.h>
+
+// The memory of each machine, which the addresses wrap around as in run()
+#define LANE_MEMORY 0x10000
+
+// The memory is restored and compared with the image in pages of 256
+// bytes, only the pages each machine may have written to
+#define PAGES 256
+typedef u64 Pages[PAGES / 64];
+
+#define MARK_PAGE(pages, addr) \
+	((pages)[(addr) >> 14] |= (u64)1 << (((addr) >> 8) & 63))
+#define ALL_PAGES(pages) memset((pages), 0xff, sizeof(Pages))
+#define EACH_PAGE(pages, page)              \
+	for(u32 page = 0; page < PAGES; page++) \
+		if(((pages)[page >> 6] >> (page & 63)) & 1)
+
+// Brings the pages of the memory which were written to back to the
+// image, which fills the whole memory, and writes the patches of the
+// input over it
+static void load_memory(u8 *memory, Pages written, const u8 *image,
+                        const BatchInput *input) {
+	EACH_PAGE(written, page) {
+		memcpy(memory + page * 256, image + page * 256, 256);
+	}
+	memset(written, 0, sizeof(Pages));
+	for(u32 i = 0; i < input->patch_count; i++) {
+		memory[input->patches[i].addr] = input->patches[i].value;
+		MARK_PAGE(written, input->patches[i].addr);
+	}
+}
+
+// Counts the bytes of the page which differ from the image, storing them
+// to 'diffs' unless it is NULL
+static u32 page_diffs(const u8 *memory, const u8 *image, u32 page,
+                      BatchByte *diffs) {
+	u32 from = page * 256, count = 0;
+	if(memcmp(memory + from, image + from, 256) == 0)
+		return 0;
+	for(u32 addr = from; addr < from + 256; addr++) {
+		if(memory[addr] == image[addr])
+			continue;
+		if(diffs)
+			diffs[count] = (BatchByte){addr, memory[addr]};
+		count++;
+	}
+	return count;
+}
+
+static void record_diffs(BatchResult *result, const u8 *memory,
+                         const Pages written, const u8 *image) {
+	u32 count = 0;
+	EACH_PAGE(written, page) count += page_diffs(memory, image, page, NULL);
+	result->diff_count = count;
+	result->diffs      = NULL;
+	if(count == 0)
+		return;
+	result->diffs = (BatchByte *)malloc(sizeof(BatchByte) * count);
+	count         = 0;
+	EACH_PAGE(written, page) {
+		count += page_diffs(memory, image, page, result->diffs + count);
+	}
+}
+
+// The ports of a machine, its 'in's reading the streams of its input and
+// its 'out's kept for its result
+typedef struct {
+	IoStream  in[256];
+	IoCapture out;
+} BatchIo;
+
+static u8 batch_in(void *device, Machine *m, u8 port) {
+	BatchIo *io = *(BatchIo **)device;
+	return io_stream_read(&io->in[port], m, port);
+}
+
+static void batch_out(void *device, Machine *m, u8 port, u8 value) {
+	BatchIo *io = *(BatchIo **)device;
+	io_capture_write(&io->out, m, port, value);
+}
+
+// Attaches the ports of the machine to the BatchIo '*current' points to,
+// which is switched as it runs one machine or the other
+static void attach_io(Machine *m, BatchIo **current) {
+	for(u32 port = 0; port < 256; port++) {
+		io_attach_in(m, port, batch_in, current);
+		io_attach_out(m, port, batch_out, NULL, current);
+	}
+}
+
+static void load_io(BatchIo *io, const BatchInput *input) {
+	for(u32 port = 0; port < 256; port++)
+		io_stream_bytes(&io->in[port], NULL, 0);
+	for(u32 i = 0; i < input->stream_count; i++) {
+		const BatchStream *s = &input->streams[i];
+		io_stream_bytes(&io->in[s->port], s->bytes, s->count);
+	}
+}
+
+// Hands the bytes written out over to the result
+static void record_outputs(BatchResult *result, BatchIo *io) {
+	result->output_count = io->out.count;
+	result->outputs      = io->out.bytes;
+	memset(&io->out, 0, sizeof(IoCapture));
+}
+
+static void record_machine(BatchResult *result, Machine *m,
+                           RunStatus status) {
+	memcpy(result->registers, m->registers, 8);
+	result->pc           = m->pc;
+	result->sp           = m->sp;
+	result->cycles       = m->cycles;
+	result->instructions = m->instructions;
+	result->status       = status;
+}
+
+// Runs the machine until it halts or uses up the budget of the batch
+static void finish(Machine *m, u8 *memory, const BatchOptions *options,
+                   BatchResult *result) {
+	m->cycle_limit = options->budget ? options->budget : u64_MAX;
+	machine_flush_cache(m);
+	record_machine(result, m, run(m, memory, 0));
+}
+
+#ifdef NEOVM_BATCH
+
+// The vector kernels are compiled for AVX2 as well, which the host picks
+// at load time if it has it
+#if defined(__x86_64__) && defined(__gnu_linux__)
+#define BATCH_TARGET __attribute__((target_clones("avx2", "default")))
+#else
+#define BATCH_TARGET
+#endif
+
+// The helpers are inlined into each version of the kernels, so the
+// vectors they take and return are never passed as arguments
+#define LANE_OP static inline __attribute__((always_inline))
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+
+// A register of every machine, or a byte for each of them
+typedef u8 Lanes __attribute__((vector_size(BATCH_LANES)));
+
+// The machines executed together. Every machine in 'active' is at 'pc',
+// has executed as many cycles and instructions as the rest, and has
+// its registers in the lane of the same index of the vectors. The flags
+// are always kept up to date in the vectors.
+typedef struct {
+	Lanes r[8];
+	Lanes sph, spl; // the stack pointer
+	Lanes live;     // 0xff in the lanes which are active
+	u16   pc;
+	u64   cycles;
+	u64   instructions;
+	u32   active;
+	u8 *  memory[BATCH_LANES];
+	Pages written[BATCH_LANES]; // the pages each machine may have written
+	// Addresses which hold the same byte in the memory of every active
+	// machine, for the instructions fetched from them to be executed
+	// together
+	u8 verified[0x10000 / 8];
+
+	Machine *           machine; // runs the machines by themselves
+	BatchIo *           io;      // of each lane
+	BatchIo *           current; // the one the machine is attached to
+	// Nothing raises an interrupt in a batch, but each machine masks and
+	// enables them by itself
+	struct Interrupts interrupts[BATCH_LANES];
+	const BatchOptions *options;
+	BatchResult *       results;
+} Pack;
+
+#define A (p->r[REG_A])
+#define F (p->r[REG_FL])
+#define M 8
+
+// Visits the active lanes. The top bit keeps __builtin_ctz() defined
+// once all of them have been visited.
+#define EACH_LANE(p, i)                                     \
+	for(u32 lanes_ = (p)->active,                           \
+	        i      = __builtin_ctz(lanes_ | 1u << 31);      \
+	    lanes_; lanes_ &= lanes_ - 1,                       \
+	        i      = __builtin_ctz(lanes_ | 1u << 31))
+
+#define SP_OF(p, i) ((u16)((p)->sph[i] << 8 | (p)->spl[i]))
+
+// Register of the machine encoded in the bits of an opcode, in the
+// order B C D E H L M A
+static const u8 encoded[8] = {REG_B, REG_C, REG_D, REG_E,
+                              REG_H, REG_L, M,     REG_A};
+
+// Flag tested by a condition encoded in an opcode, in the order nz z, nc
+// c, po pe, p m
+static const u8 condition_flag[4] = {FLG_Z, FLG_C, FLG_P, FLG_S};
+
+// The lanes whose byte is not 0
+LANE_OP u32 lanes_set(const Lanes *v) {
+	u32 lanes = 0;
+	for(u32 i = 0; i < BATCH_LANES; i++)
+		lanes |= (u32)((*v)[i] != 0) << i;
+	return lanes;
+}
+
+// The active lanes in which 'v' differs from the lane of the leader
+LANE_OP u32 lanes_differing(Pack *p, const Lanes *v, u32 leader) {
+	Lanes differ = (Lanes)(*v != (*v)[leader]) & p->live;
+	u64   words[BATCH_LANES / 8];
+	memcpy(words, &differ, sizeof(differ));
+	u64 any = 0;
+	for(u32 i = 0; i < BATCH_LANES / 8; i++)
+		any |= words[i];
+	return any ? lanes_set(&differ) : 0;
+}
+
+static void lane_to_machine(Pack *p, u32 i) {
+	Machine *m = p->machine;
+	for(u8 reg = 0; reg < 8; reg++)
+		m->registers[reg] = p->r[reg][i];
+	m->pc           = p->pc;
+	m->sp           = SP_OF(p, i);
+	m->cycles       = p->cycles;
+	m->instructions = p->instructions;
+	m->lazy.pending = 0;
+	m->isbroken     = 0;
+	m->interrupts   = p->interrupts[i];
+	p->current      = &p->io[i];
+}
+
+static void lane_from_machine(Pack *p, u32 i) {
+	Machine *m = p->machine;
+	for(u8 reg = 0; reg < 8; reg++)
+		p->r[reg][i] = m->registers[reg];
+	p->sph[i]        = m->sp >> 8;
+	p->spl[i]        = m->sp & 0xff;
+	p->interrupts[i] = m->interrupts;
+}
+
+static void pack_deactivate(Pack *p, u32 lanes) {
+	p->active &= ~lanes;
+	for(u32 i = 0; i < BATCH_LANES; i++)
+		p->live[i] = ((p->active >> i) & 1) ? 0xff : 0;
+}
+
+// Leaves the lanes to go on by themselves from the present instruction
+static void pack_diverge(Pack *p, u32 lanes) {
+	lanes &= p->active;
+	if(lanes == 0)
+		return;
+	EACH_LANE(p, i) {
+		if(!((lanes >> i) & 1))
+			continue;
+		lane_to_machine(p, i);
+		finish(p->machine, p->memory[i], p->options, &p->results[i]);
+		p->results[i].diverged = true;
+		ALL_PAGES(p->written[i]);
+	}
+	pack_deactivate(p, lanes);
+}
+
+// Ends all the active lanes where they are
+static void pack_stop(Pack *p, RunStatus status) {
+	EACH_LANE(p, i) {
+		lane_to_machine(p, i);
+		record_machine(&p->results[i], p->machine, status);
+	}
+	pack_deactivate(p, p->active);
+}
+
+// Makes sure every active lane has the same bytes as the leader at the
+// 'length' bytes from 'pc', leaving the ones which do not to themselves
+LANE_OP void pack_verify(Pack *p, u16 pc, u8 length, u32 leader) {
+	for(u8 k = 0; k < length; k++) {
+		u16 addr = pc + k;
+		if(p->verified[addr >> 3] & (1 << (addr & 7)))
+			continue;
+		u32 differ = 0;
+		EACH_LANE(p, i) {
+			if(p->memory[i][addr] != p->memory[leader][addr])
+				differ |= 1u << i;
+		}
+		pack_diverge(p, differ);
+		p->verified[addr >> 3] |= 1 << (addr & 7);
+	}
+}
+
+// Executes the instruction at the pc in each lane by itself, for the
+// instructions which talk to the rest of the machine
+static void pack_step(Pack *p, u32 leader) {
+	Machine *m      = p->machine;
+	u8       engine = m->engine;
+	u32      differ = 0;
+	u16      pc     = 0;
+	u64      cycles = 0;
+	m->engine       = ENGINE_SWITCH;
+	EACH_LANE(p, i) {
+		ALL_PAGES(p->written[i]);
+		lane_to_machine(p, i);
+		machine_set_budget(m, 1);
+		RunStatus status = run(m, p->memory[i], 0);
+		if(i == leader) {
+			pc     = m->pc;
+			cycles = m->cycles;
+		}
+		if(status == RUN_HALTED) {
+			record_machine(&p->results[i], m, status);
+			p->results[i].diverged = true;
+			differ |= 1u << i;
+		} else if(m->pc != pc || m->cycles != cycles) {
+			m->engine = engine;
+			finish(m, p->memory[i], p->options, &p->results[i]);
+			p->results[i].diverged = true;
+			m->engine              = ENGINE_SWITCH;
+			differ |= 1u << i;
+		} else
+			lane_from_machine(p, i);
+	}
+	m->engine = engine;
+	pack_deactivate(p, differ);
+	p->pc     = pc;
+	p->cycles = cycles;
+	p->instructions++;
+	// The instruction may have written anywhere
+	memset(p->verified, 0, sizeof(p->verified));
+}
+
+LANE_OP void store(Pack *p, u32 i, u16 addr, u8 value) {
+	p->memory[i][addr] = value;
+	p->verified[addr >> 3] &= ~(1 << (addr & 7));
+	MARK_PAGE(p->written[i], addr);
+}
+
+LANE_OP Lanes gather(Pack *p, const Lanes *hi, const Lanes *lo) {
+	Lanes v = {0};
+	EACH_LANE(p, i) v[i] = p->memory[i][(u16)((*hi)[i] << 8 | (*lo)[i])];
+	return v;
+}
+
+LANE_OP void scatter(Pack *p, const Lanes *hi, const Lanes *lo,
+                     const Lanes *v) {
+	EACH_LANE(p, i) store(p, i, (*hi)[i] << 8 | (*lo)[i], (*v)[i]);
+}
+
+LANE_OP void push(Pack *p, const Lanes *hi, const Lanes *lo) {
+	EACH_LANE(p, i) {
+		u16 sp = SP_OF(p, i);
+		store(p, i, sp - 1, (*hi)[i]);
+		store(p, i, sp - 2, (*lo)[i]);
+	}
+	Lanes spl = p->spl - 2;
+	p->sph += (Lanes)(spl > p->spl);
+	p->spl = spl;
+}
+
+LANE_OP void pop(Pack *p, Lanes *hi, Lanes *lo) {
+	EACH_LANE(p, i) {
+		u16 sp   = SP_OF(p, i);
+		(*lo)[i] = p->memory[i][sp];
+		(*hi)[i] = p->memory[i][(u16)(sp + 1)];
+	}
+	Lanes spl = p->spl + 2;
+	p->sph -= (Lanes)(spl < p->spl);
+	p->spl = spl;
+}
+
+// Pushes the address of the next instruction, and jumps to 'to'
+LANE_OP void call(Pack *p, u16 to, u16 *next) {
+	Lanes hi = {0}, lo = {0};
+	hi += (u8)(*next >> 8);
+	lo += (u8)*next;
+	push(p, &hi, &lo);
+	*next = to;
+}
+
+// Pops the address to return to, which the lanes returning elsewhere
+// than the leader do by themselves
+LANE_OP void ret(Pack *p, u16 *next, u32 leader) {
+	Lanes hi = {0}, lo = {0};
+	EACH_LANE(p, i) {
+		u16 sp = SP_OF(p, i);
+		lo[i]  = p->memory[i][sp];
+		hi[i]  = p->memory[i][(u16)(sp + 1)];
+	}
+	pack_diverge(p, lanes_differing(p, &hi, leader) |
+	                    lanes_differing(p, &lo, leader));
+	Lanes spl = p->spl + 2;
+	p->sph -= (Lanes)(spl < p->spl);
+	p->spl = spl;
+	*next  = hi[leader] << 8 | lo[leader];
+}
+
+LANE_OP Lanes operand(Pack *p, u8 code) {
+	u8 reg = encoded[code];
+	return reg == M ? gather(p, &p->r[REG_H], &p->r[REG_L]) : p->r[reg];
+}
+
+// Flags
+// =====
+// Computed exactly like the interpreter does, including its quirks. The
+// auxiliary carry is set by the carry out of the whole byte of the sum
+// the interpreter derives it from, which is given in 'aux' like the
+// carry, as 0xff when set and 0 when not.
+
+LANE_OP void flags_szpa(Pack *p, const Lanes *res, const Lanes *aux) {
+	Lanes parity = *res ^ (*res >> 4);
+	parity ^= parity >> 2;
+	parity ^= parity >> 1;
+	F = (F & 0x2B) | (*res & 0x80) | ((Lanes)(*res == 0) & 0x40) |
+	    (*aux & 0x10) | ((~parity & 1) << 2);
+}
+
+LANE_OP void flags_all(Pack *p, const Lanes *res, const Lanes *aux,
+                       const Lanes *carry) {
+	flags_szpa(p, res, aux);
+	F = (F & 0xFE) | (*carry & 1);
+}
+
+LANE_OP void add(Pack *p, const Lanes *with) {
+	Lanes res   = A + *with;
+	Lanes carry = (Lanes)(res < A);
+	flags_all(p, &res, &carry, &carry);
+	A = res;
+}
+
+// The interpreter adds the two's complement of 'by', and inverts the
+// carry of that, so subtracting 0 sets it. A is left as it is when
+// 'keep' is set.
+LANE_OP void sub(Pack *p, const Lanes *by, bool keep) {
+	Lanes res     = A - *by;
+	Lanes carry   = (Lanes)(res < A);
+	Lanes borrow  = ~carry;
+	flags_all(p, &res, &carry, &borrow);
+	if(!keep)
+		A = res;
+}
+
+// Executes the arithmetic operation 'op' (in the order add, adc, sub,
+// sbb, ana, xra, ora, cmp, as encoded in the opcodes) of A with 'with'
+LANE_OP void arithmetic(Pack *p, u8 op, const Lanes *with) {
+	Lanes zero = {0}, ones = ~zero;
+	switch(op) {
+		case 0: add(p, with); break;
+		case 1: { // adc, whose auxiliary carry is that of adding the
+			      // operand and the carry to A
+			Lanes sum   = *with + (F & 1);
+			Lanes res   = A + sum;
+			Lanes aux   = (Lanes)(res < A);
+			Lanes carry = aux | (Lanes)(sum < *with);
+			flags_all(p, &res, &aux, &carry);
+			A = res;
+			break;
+		}
+		case 2: sub(p, with, false); break;
+		case 3: {
+			Lanes by = *with + (F & 1);
+			sub(p, &by, false);
+			break;
+		}
+		case 4:
+			A &= *with;
+			flags_all(p, &A, &ones, &zero);
+			break;
+		case 5:
+			A ^= *with;
+			flags_all(p, &A, &zero, &zero);
+			break;
+		case 6:
+			A |= *with;
+			flags_all(p, &A, &zero, &zero);
+			break;
+		case 7:
+			sub(p, with, true);
+			F = (F & 0xFE) | ((Lanes)(A < *with) & 1);
+			break;
+	}
+}
+
+// Instructions
+// ============
+
+// The instructions which talk to the rest of the machine, which each
+// machine executes by itself
+static bool is_stepped(u8 opcode) {
+	switch(opcode) {
+		case 0x20: // RIM
+		case 0x30: // SIM
+		case 0xD3: // OUT
+		case 0xDB: // IN
+		case 0xF3: // DI
+		case 0xFB: // EI
+			return true;
+	}
+	return false;
+}
+
+// Executes the instruction, returning the t-states it took, with 'next'
+// set to the address of the next one. The lanes which branch elsewhere
+// than the leader are left to themselves before it is executed.
+LANE_OP u8 execute(Pack *p, u8 opcode, u8 imm, u16 addr, u16 *next,
+                   u32 leader) {
+	if(opcode >= 0x40 && opcode < 0x80) { // MOV
+		u8 to = encoded[(opcode >> 3) & 7], from = encoded[opcode & 7];
+		if(to == M) {
+			scatter(p, &p->r[REG_H], &p->r[REG_L], &p->r[from]);
+			return 7;
+		}
+		p->r[to] = operand(p, opcode & 7);
+		return from == M ? 7 : 4;
+	}
+	// CMP M compares with the byte plus 1, and keeps the carry of the
+	// subtraction
+	if(opcode == 0xBE) {
+		Lanes by = operand(p, 6) + 1;
+		sub(p, &by, true);
+		return 7;
+	}
+	if(opcode >= 0x80 && opcode < 0xC0) {
+		Lanes with = operand(p, opcode & 7);
+		arithmetic(p, (opcode >> 3) & 7, &with);
+		return (opcode & 7) == 6 ? 7 : 4;
+	}
+	if((opcode & 0xC7) == 0xC6) { // immediate arithmetic
+		Lanes with = {0};
+		with += imm;
+		arithmetic(p, (opcode >> 3) & 7, &with);
+		return 7;
+	}
+	if(opcode < 0x40) {
+		u8 reg = encoded[(opcode >> 3) & 7];
+		switch(opcode & 7) {
+			case 4: // INR
+			case 5: { // DCR
+				Lanes value = reg == M ? operand(p, 6) : p->r[reg];
+				Lanes res   = value + (u8)((opcode & 1) ? 0xff : 1);
+				Lanes aux   = (opcode & 1) ? (Lanes)(value != 0)
+				                           : (Lanes)(res == 0);
+				flags_szpa(p, &res, &aux);
+				if(reg != M) {
+					p->r[reg] = res;
+					return 4;
+				}
+				scatter(p, &p->r[REG_H], &p->r[REG_L], &res);
+				return 10;
+			}
+			case 6: { // MVI
+				Lanes data = {0};
+				data += imm;
+				if(reg != M) {
+					p->r[reg] = data;
+					return 7;
+				}
+				scatter(p, &p->r[REG_H], &p->r[REG_L], &data);
+				return 10;
+			}
+		}
+		u8     pair = opcode >> 4;
+		Lanes *hi   = pair == 3 ? &p->sph : &p->r[2 * pair + 1];
+		Lanes *lo   = pair == 3 ? &p->spl : &p->r[2 * pair + 2];
+		switch(opcode & 0xF) {
+			case 0x1: // LXI
+				*hi = *lo = (Lanes){0};
+				*hi += (u8)(addr >> 8);
+				*lo += (u8)addr;
+				return 10;
+			case 0x3: { // INX
+				Lanes res = *lo + 1;
+				*hi -= (Lanes)(res == 0);
+				*lo = res;
+				return 6;
+			}
+			case 0xB: // DCX
+				*hi += (Lanes)(*lo == 0);
+				*lo -= 1;
+				return 6;
+			case 0x9: { // DAD, which only ever sets the carry
+				Lanes l  = p->r[REG_L] + *lo;
+				Lanes c  = (Lanes)(l < p->r[REG_L]);
+				Lanes h  = p->r[REG_H] + *hi;
+				Lanes ch = (Lanes)(h < p->r[REG_H]) |
+				           ((Lanes)(h == 0xff) & c);
+				p->r[REG_H] = h - c;
+				p->r[REG_L] = l;
+				F |= ch & 1;
+				return 10;
+			}
+		}
+		switch(opcode) {
+			case 0x00: return 4; // NOP
+			case 0x02: // STAX B
+			case 0x12: // STAX D
+				scatter(p, hi, lo, &A);
+				return 7;
+			case 0x0A: // LDAX B
+			case 0x1A: // LDAX D
+				A = gather(p, hi, lo);
+				return 7;
+			case 0x22: // SHLD
+				EACH_LANE(p, i) {
+					store(p, i, addr, p->r[REG_L][i]);
+					store(p, i, addr + 1, p->r[REG_H][i]);
+				}
+				return 16;
+			case 0x2A: // LHLD
+				EACH_LANE(p, i) {
+					p->r[REG_L][i] = p->memory[i][addr];
+					p->r[REG_H][i] = p->memory[i][(u16)(addr + 1)];
+				}
+				return 16;
+			case 0x32: // STA
+				EACH_LANE(p, i) store(p, i, addr, A[i]);
+				return 13;
+			case 0x3A: // LDA
+				EACH_LANE(p, i) A[i] = p->memory[i][addr];
+				return 13;
+			case 0x07: { // RLC
+				Lanes d7 = A >> 7;
+				A        = (A << 1) | d7;
+				F        = (F & 0xFE) | d7;
+				return 4;
+			}
+			case 0x0F: { // RRC
+				Lanes d0 = A & 1;
+				A        = (A >> 1) | (d0 << 7);
+				F        = (F & 0xFE) | d0;
+				return 4;
+			}
+			case 0x17: { // RAL
+				Lanes d0 = F & 1;
+				F        = (F & 0xFE) | (A >> 7);
+				A        = (A << 1) | d0;
+				return 4;
+			}
+			case 0x1F: { // RAR
+				Lanes d7 = F & 1;
+				F        = (F & 0xFE) | (A & 1);
+				A        = (A >> 1) | (d7 << 7);
+				return 4;
+			}
+			case 0x27: { // DAA, which tests the high nibble like the
+				         // interpreter does
+				Lanes low = A & 0x0f, with = {0};
+				with |= ((Lanes)(low > 9) | (Lanes)((F & 0x10) != 0)) & 6;
+				with |= ((Lanes)(A > 0x0f) | (Lanes)((F & 1) != 0)) & 0x60;
+				add(p, &with);
+				return 4;
+			}
+			case 0x2F: A = ~A; return 4;   // CMA
+			case 0x37: F |= 1; return 4;   // STC
+			case 0x3F: F ^= 1; return 4;   // CMC
+		}
+		return 4; // undefined
+	}
+
+	u8 cc = (opcode >> 3) & 7;
+	switch(opcode & 0xC7) {
+		case 0xC2:   // Jcc
+		case 0xC4:   // Ccc
+		case 0xC0: { // Rcc
+			u8 flag = condition_flag[cc >> 1];
+			Lanes tested = F & (u8)(1 << flag);
+			pack_diverge(p, lanes_differing(p, &tested, leader));
+			bool taken = ((F[leader] >> flag) & 1) == (cc & 1);
+			switch(opcode & 7) {
+				case 2:
+					if(!taken)
+						return 7;
+					*next = addr;
+					return 10;
+				case 4:
+					if(!taken)
+						return 9;
+					call(p, addr, next);
+					return 18;
+				default:
+					if(!taken)
+						return 6;
+					ret(p, next, leader);
+					return 12;
+			}
+		}
+		case 0xC7: // RST
+			call(p, cc * 8, next);
+			return 12;
+	}
+	u8     pair = (opcode >> 4) & 3;
+	Lanes *hi   = pair == 3 ? &A : &p->r[2 * pair + 1];
+	Lanes *lo   = pair == 3 ? &F : &p->r[2 * pair + 2];
+	switch(opcode) {
+		case 0xC1: // POP
+		case 0xD1:
+		case 0xE1:
+		case 0xF1: pop(p, hi, lo); return 10;
+		case 0xC5: // PUSH
+		case 0xD5:
+		case 0xE5:
+		case 0xF5: push(p, hi, lo); return 12;
+		case 0xC3: *next = addr; return 10;         // JMP
+		case 0xCD: call(p, addr, next); return 18;  // CALL
+		case 0xC9: ret(p, next, leader); return 10; // RET
+		case 0xE9: // PCHL
+			pack_diverge(p, lanes_differing(p, &p->r[REG_H], leader) |
+			                    lanes_differing(p, &p->r[REG_L], leader));
+			*next = p->r[REG_H][leader] << 8 | p->r[REG_L][leader];
+			return 6;
+		case 0xE3: // XTHL
+			EACH_LANE(p, i) {
+				u16 sp = SP_OF(p, i);
+				u8  h = p->memory[i][(u16)(sp + 1)], l = p->memory[i][sp];
+				store(p, i, sp + 1, p->r[REG_H][i]);
+				store(p, i, sp, p->r[REG_L][i]);
+				p->r[REG_H][i] = h;
+				p->r[REG_L][i] = l;
+			}
+			return 16;
+		case 0xEB: { // XCHG
+			Lanes h = p->r[REG_H], l = p->r[REG_L];
+			p->r[REG_H] = p->r[REG_D];
+			p->r[REG_L] = p->r[REG_E];
+			p->r[REG_D] = h;
+			p->r[REG_E] = l;
+			return 4;
+		}
+		case 0xF9: // SPHL
+			p->sph = p->r[REG_H];
+			p->spl = p->r[REG_L];
+			return 6;
+	}
+	return 4; // undefined
+}
+
+// Runs the active lanes together while they agree on the pc
+static void BATCH_TARGET pack_run(Pack *p) {
+	u64 limit = p->options->budget ? p->options->budget : u64_MAX;
+	while(p->active) {
+		if(p->cycles >= limit) {
+			pack_stop(p, RUN_BUDGET);
+			return;
+		}
+		u32 leader = __builtin_ctz(p->active);
+		u8 *memory = p->memory[leader];
+		u16 pc     = p->pc;
+		u8  opcode = memory[pc];
+		pack_verify(p, pc, opcode_length[opcode], leader);
+		if(opcode == 0x76) { // HLT
+			p->pc = pc + 1;
+			p->cycles += 5;
+			p->instructions++;
+			pack_stop(p, RUN_HALTED);
+			return;
+		}
+		if(is_stepped(opcode)) {
+			pack_step(p, leader);
+			continue;
+		}
+		u8  imm  = memory[(u16)(pc + 1)];
+		u16 addr = imm | memory[(u16)(pc + 2)] << 8;
+		u16 next = pc + opcode_length[opcode];
+		p->cycles += execute(p, opcode, imm, addr, &next, leader);
+		p->instructions++;
+		p->pc = next;
+	}
+}
+
+void batch_run(const u8 *image, u32 size, const BatchOptions *options,
+               const BatchInput *inputs, BatchResult *results, u32 count) {
+	Machine *m = (Machine *)malloc(sizeof(Machine));
+	machine_init(m);
+	m->issilent = 1;
+	m->engine   = options->engine;
+	u8 *padded  = (u8 *)calloc(1, LANE_MEMORY);
+	u8 *memory  = (u8 *)calloc(BATCH_LANES, LANE_MEMORY);
+	memcpy(padded, image, size);
+	// Large enough for its vectors to be aligned on the stack
+	Pack  pack;
+	Pack *p = &pack;
+	for(u32 i = 0; i < BATCH_LANES; i++) {
+		p->memory[i] = memory + (siz)LANE_MEMORY * i;
+		ALL_PAGES(p->written[i]);
+	}
+	p->machine = m;
+	p->io      = (BatchIo *)calloc(BATCH_LANES, sizeof(BatchIo));
+	p->options = options;
+	attach_io(m, &p->current);
+	for(u32 first = 0; first < count; first += BATCH_LANES) {
+		u32 lanes = count - first < BATCH_LANES ? count - first : BATCH_LANES;
+		memset(p->r, 0, sizeof(p->r));
+		p->sph = p->spl = (Lanes){0};
+		memset(p->verified, 0xff, sizeof(p->verified));
+		p->results = results + first;
+		for(u32 i = 0; i < lanes; i++) {
+			const BatchInput *input = &inputs[first + i];
+			load_memory(p->memory[i], p->written[i], padded, input);
+			load_io(&p->io[i], input);
+			interrupt_reset(m);
+			p->interrupts[i] = m->interrupts;
+			for(u32 k = 0; k < input->patch_count; k++) {
+				u16 addr = input->patches[k].addr;
+				p->verified[addr >> 3] &= ~(1 << (addr & 7));
+			}
+			for(u8 reg = 0; reg < 8; reg++)
+				p->r[reg][i] = input->registers[reg];
+			p->sph[i]              = input->sp >> 8;
+			p->spl[i]              = input->sp & 0xff;
+			p->results[i].diverged = false;
+		}
+		p->pc           = options->start;
+		p->cycles       = 0;
+		p->instructions = 0;
+		p->active = lanes == BATCH_LANES ? u32_MAX : (1u << lanes) - 1;
+		pack_deactivate(p, 0);
+		pack_run(p);
+		for(u32 i = 0; i < lanes; i++) {
+			record_diffs(&p->results[i], p->memory[i], p->written[i], padded);
+			record_outputs(&p->results[i], &p->io[i]);
+		}
+	}
+	free(p->io);
+	free(memory);
+	free(padded);
+	machine_destroy(m);
+	free(m);
+}
+
+#else
+
+void batch_run(const u8 *image, u32 size, const BatchOptions *options,
+               const BatchInput *inputs, BatchResult *results, u32 count) {
+	Machine *m = (Machine *)malloc(sizeof(Machine));
+	machine_init(m);
+	m->issilent = 1;
+	m->engine   = options->engine;
+	u8 *padded  = (u8 *)calloc(1, LANE_MEMORY);
+	u8 *memory  = (u8 *)calloc(1, LANE_MEMORY);
+	memcpy(padded, image, size);
+	BatchIo *io = (BatchIo *)calloc(1, sizeof(BatchIo));
+	attach_io(m, &io);
+	Pages written;
+	for(u32 i = 0; i < count; i++) {
+		ALL_PAGES(written);
+		load_memory(memory, written, padded, &inputs[i]);
+		load_io(io, &inputs[i]);
+		interrupt_reset(m);
+		memcpy(m->registers, inputs[i].registers, 8);
+		m->pc           = options->start;
+		m->sp           = inputs[i].sp;
+		m->cycles       = 0;
+		m->instructions = 0;
+		m->lazy.pending = 0;
+		m->isbroken     = 0;
+		finish(m, memory, options, &results[i]);
+		results[i].diverged = true;
+		ALL_PAGES(written);
+		record_diffs(&results[i], memory, written, padded);
+		record_outputs(&results[i], io);
+	}
+	free(io);
+	free(memory);
+	free(padded);
+	machine_destroy(m);
+	free(m);
+}
+
+#endif
+
+void batch_free(BatchResult *results, u32 count) {
+	for(u32 i = 0; i < count; i++) {
+		free(results[i].diffs);
+		free(results[i].outputs);
+		results[i].diffs   = NULL;
+		results[i].outputs = NULL;
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.h"
+#include "io.h"
+#include "vm.h"
+
+// The batch engine runs one program on many inputs. The machines which
+// are at the same address execute each instruction together, their
+// registers being kept in vectors of the host with one lane for each
+// machine, and a machine which takes another path than the rest is run
+// on by itself by run(). Vector extensions are a GNU extension, so
+// without them, or with NEOVM_NO_BATCH defined, every machine is run
+// by itself from the start.
+#if defined(__GNUC__) && !defined(NEOVM_NO_BATCH)
+#define NEOVM_BATCH
+#endif
+
+// Number of machines executed together
+#define BATCH_LANES 32
+
+typedef struct {
+	u16 addr;
+	u8  value;
+} BatchByte;
+
+// The bytes the 'in's of a port read one after the other
+typedef struct {
+	u8        port;
+	u32       count;
+	const u8 *bytes;
+} BatchStream;
+
+// The state a machine starts from, besides the program
+typedef struct {
+	u8               registers[8];
+	u16              sp;
+	u32              patch_count;
+	const BatchByte *patches; // written over the image before the start
+	// The 'in's of the ports without a stream, and past the end of
+	// their stream, read 0
+	u32                stream_count;
+	const BatchStream *streams;
+} BatchInput;
+
+typedef struct {
+	u8        registers[8]; // with the flags up to date
+	u16       pc;
+	u16       sp;
+	u64       cycles;
+	u64       instructions;
+	RunStatus status;   // RUN_HALTED, or RUN_BUDGET
+	bool      diverged; // left the others to finish by itself
+	// The bytes which differ from the image at the end, by address
+	u32        diff_count;
+	BatchByte *diffs;
+	// The bytes written by the 'out's, in order
+	u32     output_count;
+	IoByte *outputs;
+} BatchResult;
+
+typedef struct {
+	u16 start;  // where every machine starts executing
+	u64 budget; // the cycles each machine may run for, or 0 for any
+	u8  engine; // the engine the machines which diverge are run on
+} BatchOptions;
+
+// Runs the 'size' bytes of 'image' loaded at address 0 once for each of
+// the 'count' inputs, to the result of the same index. The machines
+// never touch the console, their 'in's reading the streams of their
+// input and their 'out's being kept in their results. Release the
+// results with batch_free().
+void batch_run(const u8 *image, u32 size, const BatchOptions *options,
+               const BatchInput *inputs, BatchResult *results, u32 count);
+void batch_free(BatchResult *results, u32 count);
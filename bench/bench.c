@@ -0,0 +1,289 @@
+// Benchmarks the virtual machine on every program under programs/, with
+// the same inputs each time. Each program is run with each engine, and
+// once more with the block engine while it keeps a journal, and is also
+// compiled and disassembled, each of them 'repeats' times. It shows the
+// host ns spent on each instruction emulated and the emulated MHz, from
+// the median run, and writes the median and the 99th percentile of each
+// of them as JSON lines, for the regressions in run(), the compiler or
+// the disassembler to be caught by comparing two builds. Run it from the
+// root of the repository :
+//
+// ./the8085_bench [<number of repeats>] [--json <file>]
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../bytecode.h"
+#include "../common.h"
+#include "../compiler.h"
+#include "../display.h"
+#include "../journal.h"
+#include "../util.h"
+#include "../vm.h"
+
+// The address every program is loaded at, same as the file mode of the8085
+#define LOAD_ADDRESS 0x0100
+#define DEFAULT_REPEATS 2000
+// The journal the block engine runs with once more, for what keeping
+// one costs
+#define JOURNAL_SIZE (1024 * 1024)
+// The cycles each run may take. programs/exam/merge_sort.8085 never
+// halts, and is measured over as many instead.
+#define BUDGET 2000000
+#define MAX_PROGRAMS 256
+
+// All the programs read their inputs from one of the following
+// addresses. Most of them are either a single value or a count
+// followed by that many values, so the same input serves all.
+static const u16 input_addresses[] = {0x8000, 0x8100, 0xc000};
+static const u8  input[] = {0x0a, 0x39, 0x07, 0x5c, 0x21, 0x4e,
+                           0x13, 0x62, 0x2a, 0x05, 0x48};
+
+// The ways each program is run, the last keeping a journal
+static const u8 engines[] = {ENGINE_SWITCH, ENGINE_THREADED, ENGINE_BLOCK,
+#ifdef NEOVM_JIT
+                             ENGINE_JIT,
+#endif
+                             ENGINE_BLOCK};
+
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+#define JOURNALED (NUM_ENGINES - 1)
+
+static char *programs[MAX_PROGRAMS];
+static u32   program_count = 0;
+
+static u8   image[0x10000], memory[0x10000];
+static u16  image_end; // past the last byte of the program
+static u64 *samples;   // the ns of each repeat
+
+// Lists the programs under 'dir', at any depth
+static void find_programs(const char *dir) {
+	DIR *d = opendir(dir);
+	if(d == NULL)
+		return;
+	struct dirent *entry;
+	while((entry = readdir(d)) != NULL) {
+		if(entry->d_name[0] == '.')
+			continue;
+		char path[1024];
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		siz length = strlen(entry->d_name);
+		if(length > 5 && strcmp(entry->d_name + length - 5, ".8085") == 0) {
+			if(program_count < MAX_PROGRAMS)
+				programs[program_count++] = strdup(path);
+		} else
+			find_programs(path);
+	}
+	closedir(d);
+}
+
+static int compare_paths(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int compare_samples(const void *a, const void *b) {
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+	return x < y ? -1 : x > y;
+}
+
+typedef struct {
+	u64 median;
+	u64 p99;
+} Stats;
+
+// The median and the 99th percentile of the 'count' samples
+static Stats stats(u32 count) {
+	qsort(samples, count, sizeof(u64), compare_samples);
+	return (Stats){samples[count / 2], samples[(count * 99 + 99) / 100 - 1]};
+}
+
+static bool compile_program(const char *source) {
+	memset(image, 0, sizeof(image));
+	for(siz i = 0; i < sizeof(input_addresses) / sizeof(input_addresses[0]);
+	    i++)
+		memcpy(&image[input_addresses[i]], input, sizeof(input));
+	u16 pointer = LOAD_ADDRESS;
+	compiler_reset();
+	CompilationStatus status = compile(source, &image[0], 0xffff, &pointer);
+	image_end                = pointer;
+	return status == COMPILE_OK;
+}
+
+typedef struct {
+	Stats     ns;
+	u64       instructions; // of each run
+	u64       cycles;
+	RunStatus status;
+} RunStats;
+
+// Runs the program with 'engine', keeping a journal of 'journal' bytes
+static RunStats bench_engine(u8 engine, u32 journal, u32 repeats) {
+	Machine  m;
+	RunStats r;
+	machine_init(&m);
+	m.issilent = 1;
+	m.engine   = engine;
+	journal_set_size(&m, journal);
+	// The program is the same in every repeat, so whatever the machine
+	// decodes in the first one stays valid for the rest
+	for(u32 i = 0; i < repeats; i++) {
+		memcpy(memory, image, sizeof(memory));
+		memset(m.registers, 0, sizeof(m.registers));
+		m.pc           = LOAD_ADDRESS;
+		m.sp           = 0xffff;
+		m.cycles       = 0;
+		m.instructions = 0;
+		machine_set_budget(&m, BUDGET);
+		u64 start  = monotonic_ns();
+		r.status   = run(&m, &memory[0], 0);
+		samples[i] = monotonic_ns() - start;
+	}
+	r.instructions = m.instructions;
+	r.cycles       = m.cycles;
+	r.ns           = stats(repeats);
+	machine_destroy(&m);
+	return r;
+}
+
+static Stats bench_compiler(const char *source, u32 repeats) {
+	for(u32 i = 0; i < repeats; i++) {
+		u64 start = monotonic_ns();
+		compile_program(source);
+		samples[i] = monotonic_ns() - start;
+	}
+	return stats(repeats);
+}
+
+// The disassembler writes to the terminal, which is not what is to be
+// measured, so it writes to /dev/null instead
+static Stats bench_disassembler(u32 repeats) {
+	fflush(stdout);
+	int   console = dup(STDOUT_FILENO);
+	FILE *null    = freopen("/dev/null", "w", stdout);
+	for(u32 i = 0; null && i < repeats; i++) {
+		u64 start = monotonic_ns();
+		bytecode_disassemble_chunk(&image[0], LOAD_ADDRESS, image_end - 1);
+		fflush(stdout);
+		samples[i] = monotonic_ns() - start;
+	}
+	dup2(console, STDOUT_FILENO);
+	close(console);
+	clearerr(stdout);
+	if(null == NULL)
+		memset(samples, 0, sizeof(u64) * repeats);
+	return stats(repeats);
+}
+
+static const char *engine_label(u32 e) {
+	if(e == JOURNALED)
+		return "block+journal";
+	return machine_engine_name(engines[e]);
+}
+
+static void write_stage(FILE *json, const char *program, const char *stage,
+                        u32 repeats, Stats s) {
+	fprintf(json,
+	        "{\"program\":\"%s\",\"stage\":\"%s\",\"repeats\":%u,"
+	        "\"median_ns\":%" Pu64 ",\"p99_ns\":%" Pu64 "}\n",
+	        program, stage, repeats, s.median, s.p99);
+}
+
+static void write_run(FILE *json, const char *program, u32 e, u32 repeats,
+                      const RunStats *r) {
+	double count  = r->instructions ? r->instructions : 1;
+	double median = r->ns.median ? r->ns.median : 1;
+	double p99    = r->ns.p99 ? r->ns.p99 : 1;
+	fprintf(json,
+	        "{\"program\":\"%s\",\"stage\":\"run\",\"engine\":\"%s\","
+	        "\"repeats\":%u,\"status\":\"%s\",\"instructions\":%" Pu64
+	        ",\"cycles\":%" Pu64 ",\"median_ns\":%" Pu64 ",\"p99_ns\":%" Pu64
+	        ",\"ns_per_instruction\":%.3lf,\"p99_ns_per_instruction\":%.3lf,"
+	        "\"mhz\":%.3lf,\"p99_mhz\":%.3lf}\n",
+	        program, engine_label(e), repeats,
+	        r->status == RUN_HALTED ? "halted" : "budget", r->instructions,
+	        r->cycles, r->ns.median, r->ns.p99, r->ns.median / count,
+	        r->ns.p99 / count, r->cycles * 1000.0 / median,
+	        r->cycles * 1000.0 / p99);
+}
+
+int main(int argc, char *argv[]) {
+	int         repeats = DEFAULT_REPEATS;
+	const char *path    = NULL;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			path = argv[++i];
+		else if((repeats = atoi(argv[i])) <= 0) {
+			perr("Usage : %s [<number of repeats>] [--json <file>]\n",
+			     argv[0]);
+			return 1;
+		}
+	}
+	FILE *json = NULL;
+	if(path && (json = fopen(path, "w")) == NULL) {
+		perr("Unable to write %s!\n", path);
+		return 1;
+	}
+	find_programs("programs");
+	if(program_count == 0) {
+		perr("No programs found, run it from the root of the repository!\n");
+		return 1;
+	}
+	qsort(programs, program_count, sizeof(char *), compare_paths);
+	samples = (u64 *)malloc(sizeof(u64) * repeats);
+
+	// The medians, summed over the programs, for the totals
+	u64 run_ns[NUM_ENGINES] = {0}, instructions[NUM_ENGINES] = {0},
+	    cycles[NUM_ENGINES] = {0}, compile_ns = 0, disassemble_ns = 0;
+	printf("%-50s", "Program (ns per instruction)");
+	for(u32 e = 0; e < NUM_ENGINES; e++) printf("%15s", engine_label(e));
+	printf("%15s%15s\n", "compile us", "disasm us");
+
+	for(u32 p = 0; p < program_count; p++) {
+		char *source = readFile(programs[p]);
+		if(source == NULL || !compile_program(source)) {
+			perr("Unable to load %s, skipping!\n", programs[p]);
+			free(source);
+			continue;
+		}
+		printf("%-50s", programs[p]);
+		for(u32 e = 0; e < NUM_ENGINES; e++) {
+			RunStats r = bench_engine(engines[e],
+			                          e == JOURNALED ? JOURNAL_SIZE : 0, repeats);
+			run_ns[e] += r.ns.median;
+			instructions[e] += r.instructions;
+			cycles[e] += r.cycles;
+			printf("%15.3lf", (double)r.ns.median / r.instructions);
+			if(json)
+				write_run(json, programs[p], e, repeats, &r);
+		}
+		Stats compiler    = bench_compiler(source, repeats);
+		Stats disassembly = bench_disassembler(repeats);
+		compile_ns += compiler.median;
+		disassemble_ns += disassembly.median;
+		printf("%15.3lf%15.3lf\n", compiler.median / 1000.0,
+		       disassembly.median / 1000.0);
+		if(json) {
+			write_stage(json, programs[p], "compile", repeats, compiler);
+			write_stage(json, programs[p], "disassemble", repeats,
+			            disassembly);
+		}
+		free(source);
+	}
+
+	printf("%-50s", "All (ns per instruction)");
+	for(u32 e = 0; e < NUM_ENGINES; e++)
+		printf("%15.3lf", (double)run_ns[e] / instructions[e]);
+	printf("%15.3lf%15.3lf\n", compile_ns / 1000.0, disassemble_ns / 1000.0);
+	printf("%-50s", "All (emulated MHz)");
+	for(u32 e = 0; e < NUM_ENGINES; e++)
+		printf("%15.3lf", cycles[e] * 1000.0 / run_ns[e]);
+	printf("\n");
+	if(json && fclose(json) != 0) {
+		perr("Unable to write %s!\n", path);
+		return 1;
+	}
+	for(u32 p = 0; p < program_count; p++) free(programs[p]);
+	free(samples);
+	return 0;
+}
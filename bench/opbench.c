@@ -0,0 +1,296 @@
+// Times each opcode by itself. The examples of the instruction table
+// are assembled to find the encodings of every opcode the assembler
+// knows, the rst's are added to them, and each opcode is run as a long
+// straight line of itself, with its operands varied among the encodings
+// found, and timed in run() with each engine. It shows the host ns spent
+// on each instruction next to its documented T-states, for the handlers
+// which are slow for what they do to stand out. Run it as :
+//
+// ./the8085_opbench [<number of repeats>] [--json <file>]
+//
+// The jumps and calls go to the next instruction, the returns pop the
+// address of the next instruction off a stack made for them, and the
+// direct loads and stores are kept to a scratch area, so that every
+// line runs through from its first instruction to the hlt after its
+// last. pchl, which jumps to the address in hl, is run in place for as
+// many times instead. The flags are all clear at the start, so which
+// conditional jumps, calls and returns are taken shows in the T-states
+// the machine counted. Each rst goes to a ret at its vector, which
+// returns to the next rst, and is timed along with that ret.
+#include <stdio.h>
+#include <string.h>
+
+#include "../common.h"
+#include "../compiler.h"
+#include "../display.h"
+#include "../instruction_details.h"
+#include "../io.h"
+#include "../scanner.h"
+#include "../util.h"
+#include "../vm.h"
+
+#define DEFAULT_REPEATS 200
+// The instructions in each line
+#define LENGTH 1000
+// The examples assembled for each variant of a mnemonic, enough to
+// come across every pair of registers of a mov
+#define EXAMPLES 1000
+// The encodings of an opcode its line goes through
+#define ENCODINGS 64
+
+#define LOAD_ADDRESS 0x0100
+// Where the direct loads and stores go, and the stack pointer starts
+#define SCRATCH 0x8000
+#define SCRATCH_MASK 0x3fff
+#define STACK 0xc000
+
+typedef struct {
+	const char *mnemonic;
+	char        example[24];
+	u8          documented[2]; // T-states, and when taken if conditional
+	u32         count;
+	u8          bytes[ENCODINGS][3];
+} Opcode;
+
+static Opcode opcodes[256];
+
+static const u8 engines[] = {ENGINE_SWITCH, ENGINE_THREADED, ENGINE_BLOCK,
+#ifdef NEOVM_JIT
+                             ENGINE_JIT
+#endif
+};
+
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+static u8   image[0x10000], memory[0x10000];
+static u64 *samples; // the ns of each repeat
+
+static int compare_samples(const void *a, const void *b) {
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+	return x < y ? -1 : x > y;
+}
+
+static bool is_jump(u8 op) {
+	// JMP, CALL, and Jcc and Ccc as 11ccc010 and 11ccc100
+	return op == 0xC3 || op == 0xCD || (op & 0xC7) == 0xC2 ||
+	       (op & 0xC7) == 0xC4;
+}
+
+static bool is_rst(u8 op) {
+	// RST n as 11nnn111
+	return (op & 0xC7) == 0xC7;
+}
+
+static bool is_direct(u8 op) {
+	// SHLD, LHLD, STA and LDA
+	return op == 0x22 || op == 0x2A || op == 0x32 || op == 0x3A;
+}
+
+// Assembles examples of each variant of each mnemonic, keeping the
+// encodings found for each opcode
+static void find_opcodes() {
+	char source[48];
+	u8   bytes[64];
+	for(siz num = 0; num < instruction_keywords_count; num++) {
+		int variants = instruction_variant_count(num);
+		for(int variant = 1; variant <= variants; variant++) {
+			for(u32 i = 0; i < EXAMPLES; i++) {
+				const char *example = instruction_example(num, variant);
+				if(example == NULL)
+					break;
+				snprintf(source, sizeof(source), "%s\nhlt\n", example);
+				u16 pointer = 0;
+				compiler_reset();
+				// The pairs an instruction cannot take do not assemble
+				if(compile(source, bytes, sizeof(bytes), &pointer) !=
+				   COMPILE_OK)
+					continue;
+				Opcode *op = &opcodes[bytes[0]];
+				if(op->count == 0) {
+					int taken    = variant + 1;
+					op->mnemonic = instruction_keywords[num].str;
+					strncpy(op->example, example, sizeof(op->example) - 1);
+					op->documented[0] = instruction_tstates(num, variant);
+					// The variant after a conditional one is when it is taken
+					if(taken <= variants &&
+					   instruction_example(num, taken) == NULL)
+						op->documented[1] = instruction_tstates(num, taken);
+				}
+				if(op->count < ENCODINGS)
+					memcpy(op->bytes[op->count++], bytes, 3);
+			}
+		}
+	}
+	// The rst's are not in the instruction table
+	for(u32 n = 0; n < 8; n++) {
+		Opcode *op = &opcodes[0xC7 | n << 3];
+		op->mnemonic = "rst";
+		snprintf(op->example, sizeof(op->example), "rst %u", n);
+		op->documented[0] = 12;
+		op->bytes[0][0]   = 0xC7 | n << 3;
+		op->count         = 1;
+	}
+}
+
+// Lays the line of 'opcode' out at LOAD_ADDRESS, followed by a hlt
+static void build_line(u8 opcode) {
+	Opcode *op     = &opcodes[opcode];
+	u8      length = opcode_length[opcode];
+	memset(image, 0, sizeof(image));
+	u16 addr = LOAD_ADDRESS;
+	for(u32 i = 0; i < LENGTH; i++) {
+		memcpy(&image[addr], op->bytes[i % op->count], length);
+		u16 next   = addr + length;
+		u16 target = 0;
+		if(is_jump(opcode))
+			target = next;
+		else if(is_direct(opcode))
+			target = SCRATCH | ((image[addr + 1] | image[addr + 2] << 8) &
+			                    SCRATCH_MASK);
+		if(target) {
+			image[addr + 1] = target & 0xff;
+			image[addr + 2] = target >> 8;
+		}
+		// The address each return pops
+		image[STACK + 2 * i]     = next & 0xff;
+		image[STACK + 2 * i + 1] = next >> 8;
+		addr                     = next;
+	}
+	image[addr] = 0x76; // hlt
+	if(is_rst(opcode))
+		image[opcode & 0x38] = 0xC9; // ret
+}
+
+static u8 null_read(void *device, Machine *m, u8 port) {
+	(void)device;
+	(void)m;
+	(void)port;
+	return 0;
+}
+
+static void null_write(void *device, Machine *m, u8 port, u8 value) {
+	(void)device;
+	(void)m;
+	(void)port;
+	(void)value;
+}
+
+typedef struct {
+	double ns[2];   // for each instruction, at the median and the p99
+	double tstates; // for each instruction, as counted by the machine
+} Timing;
+
+static Timing time_line(u8 opcode, u8 engine, u32 repeats) {
+	Machine m;
+	Timing  t;
+	u64     instructions = 0, cycles = 0;
+	machine_init(&m);
+	m.issilent = 1;
+	m.engine   = engine;
+	for(u32 port = 0; port < 256; port++) {
+		io_attach_in(&m, port, null_read, NULL);
+		io_attach_out(&m, port, null_write, NULL, NULL);
+	}
+	for(u32 i = 0; i < repeats; i++) {
+		memcpy(memory, image, sizeof(memory));
+		memset(m.registers, 0, sizeof(m.registers));
+		m.registers[REG_B] = 0x90;
+		m.registers[REG_D] = 0xa0;
+		m.registers[REG_H] = SCRATCH >> 8;
+		m.pc               = LOAD_ADDRESS;
+		m.sp               = STACK;
+		m.cycles           = 0;
+		m.instructions     = 0;
+		// A pchl jumps to itself until the budget runs out
+		if(opcode == 0xE9)
+			m.registers[REG_H] = LOAD_ADDRESS >> 8;
+		machine_set_budget(&m, opcode == 0xE9 ? LENGTH * 6 : LENGTH * 32);
+		u64       start  = monotonic_ns();
+		RunStatus status = run(&m, &memory[0], 0);
+		samples[i]       = monotonic_ns() - start;
+		// Without the hlt
+		instructions = m.instructions - (status == RUN_HALTED);
+		// Each rst along with its ret
+		if(is_rst(opcode))
+			instructions /= 2;
+		cycles       = m.cycles - (status == RUN_HALTED ? 5 : 0);
+	}
+	machine_destroy(&m);
+	qsort(samples, repeats, sizeof(u64), compare_samples);
+	if(instructions == 0)
+		instructions = 1;
+	t.ns[0]   = (double)samples[repeats / 2] / instructions;
+	t.ns[1]   = (double)samples[(repeats * 99 + 99) / 100 - 1] / instructions;
+	t.tstates = (double)cycles / instructions;
+	return t;
+}
+
+int main(int argc, char *argv[]) {
+	int         repeats = DEFAULT_REPEATS;
+	const char *path    = NULL;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			path = argv[++i];
+		else if((repeats = atoi(argv[i])) <= 0) {
+			perr("Usage : %s [<number of repeats>] [--json <file>]\n",
+			     argv[0]);
+			return 1;
+		}
+	}
+	FILE *json = NULL;
+	if(path && (json = fopen(path, "w")) == NULL) {
+		perr("Unable to write %s!\n", path);
+		return 1;
+	}
+	samples = (u64 *)malloc(sizeof(u64) * repeats);
+	// Not all the examples assemble, which is left unsaid
+	display_mute(true);
+	find_opcodes();
+	display_mute(false);
+
+	printf("%-8s%-20s%8s%8s", "Opcode", "Example", "T doc", "T run");
+	for(u32 e = 0; e < NUM_ENGINES; e++)
+		printf("%12s", machine_engine_name(engines[e]));
+	printf("%12s\n", "ns per T");
+	u32 count = 0;
+	for(u32 opcode = 0; opcode < 256; opcode++) {
+		Opcode *op = &opcodes[opcode];
+		// A hlt ends every line instead
+		if(op->count == 0 || opcode == 0x76)
+			continue;
+		count++;
+		build_line(opcode);
+		char documented[8];
+		if(is_rst(opcode))
+			sprintf(documented, "%u+10", op->documented[0]);
+		else if(op->documented[1])
+			sprintf(documented, "%u/%u", op->documented[0], op->documented[1]);
+		else
+			sprintf(documented, "%u", op->documented[0]);
+		Timing t[NUM_ENGINES];
+		for(u32 e = 0; e < NUM_ENGINES; e++)
+			t[e] = time_line(opcode, engines[e], repeats);
+		printf("0x%02x    %-20s%8s%8.2lf", opcode, op->example, documented,
+		       t[0].tstates);
+		for(u32 e = 0; e < NUM_ENGINES; e++) printf("%12.3lf", t[e].ns[0]);
+		// Of the fastest engine
+		printf("%12.3lf\n", t[NUM_ENGINES - 1].ns[0] / t[0].tstates);
+		for(u32 e = 0; json && e < NUM_ENGINES; e++)
+			fprintf(json,
+			        "{\"opcode\":%u,\"mnemonic\":\"%s\",\"example\":\"%s\","
+			        "\"documented_tstates\":\"%s\",\"tstates\":%.3lf,"
+			        "\"engine\":\"%s\",\"repeats\":%d,"
+			        "\"ns_per_instruction\":%.3lf,"
+			        "\"p99_ns_per_instruction\":%.3lf}\n",
+			        opcode, op->mnemonic, op->example, documented,
+			        t[e].tstates, machine_engine_name(engines[e]), repeats,
+			        t[e].ns[0], t[e].ns[1]);
+	}
+	printf("%u opcodes, and hlt\n", count);
+	free(samples);
+	if(json && fclose(json) != 0) {
+		perr("Unable to write %s!\n", path);
+		return 1;
+	}
+	return 0;
+}
@@ -2,6 +2,7 @@
 
 #include "compiler.h"
 #include "display.h"
+#include "util.h"
 #include "vm.h"
 
 // On a n Hz machine, this delay should be equal to about
@@ -18,75 +19,63 @@ static const char *sub_delay = "       mvi b, 00h\n"
 // The number of times the test should be performed
 // before settling on an average
 #define RUNCOUNT 100
-// The frequency of the machine in Hz
-#define MACHINE_FREQ 3000000.0
+// The number of rounds of the test at the target frequency, over which
+// the machine learns how late the host wakes it up
+#define ROUNDS 3
 
 #define total_tstates (35.0 + 7.0 + (14.0 * 0xff))
-static double required_time = (total_tstates / MACHINE_FREQ);
 
-void calibrate(Machine *m) {
-	(void)m;
-	Machine cm = {{0}, 0, 0xffff, {0}, 0, 0, 1, m->sleepfor};
+// Runs the delay RUNCOUNT times, and returns the frequency it ran at,
+// in mHz, with the wall time it took in 'total'
+static double time_runs(Machine *cm, u8 *memory, double *total) {
+	u64 start    = monotonic_ns();
+	u64 cycles   = cm->cycles;
+	int runcount = RUNCOUNT;
+	while(runcount--) {
+		// Run delay
+		cm->pc = 0;
+		run(cm, memory, 0);
+	}
+	*total = (monotonic_ns() - start) / 1000000000.0;
+	return (cm->cycles - cycles) / (*total * 1000000);
+}
+
+void calibrate(Machine *m, u32 hz) {
+	if(hz == 0) {
+		machine_set_frequency(m, 0);
+		pinfo("Running as fast as the host can");
+		return;
+	}
+	Machine cm;
 	u8      memory[0xff];
 	u16     pointer = 0;
+	machine_init(&cm);
+	cm.issilent = 1;
+	cm.engine   = m->engine;
 	compiler_reset();
 	compile(sub_delay, memory, 0xff, &pointer);
+	double required_time     = total_tstates / hz;
 	double req_tm_per_tstate = required_time / total_tstates;
 	pinfo("Estimated time : %lfs (%lfs/run) (%.10lfs/t-state) (%lf mHz)",
 	      required_time * RUNCOUNT, required_time, req_tm_per_tstate,
-	      MACHINE_FREQ / 1000000);
-	double total    = 0;
-	int    runcount = RUNCOUNT;
-	while(runcount--) {
-		clock_t start = clock();
-		// Run delay
-		cm.pc = 0;
-		run(&cm, memory, 0);
-		clock_t end = clock();
-		double  sec = (double)(end - start) / CLOCKS_PER_SEC;
-		// pinfo("Delay took %f seconds", sec);
-		total += sec;
-	}
-	double avg_tm_per_tstate = total / (total_tstates * RUNCOUNT);
-	double sleepfor          = 0;
-
-	pinfo("[Before] Total time : %lfs (%lfs/run) (%.10lfs/t-state) (%lf mHz)",
-	      total, RUNCOUNT, total / RUNCOUNT, avg_tm_per_tstate,
-	      (total_tstates * RUNCOUNT) / (total * 1000000));
-
-	if(avg_tm_per_tstate < req_tm_per_tstate) {
-		sleepfor = req_tm_per_tstate - avg_tm_per_tstate;
-
-		// double calmhz = (total_tstates * RUNCOUNT) / total;
-		// if(calmhz > MACHINE_FREQ)
-		//    sleepfor = 1/(calmhz - MACHINE_FREQ);
+	      hz / 1000000.0);
+	double total;
+	double mhz = time_runs(&cm, memory, &total);
+	pinfo("[Before] Total time : %lfs (%lfs/run) (%lf mHz)", total,
+	      total / RUNCOUNT, mhz);
 
-		cm.sleepfor.tv_sec = (time_t)sleepfor;
-		cm.sleepfor.tv_nsec =
-		    m->sleepfor.tv_nsec + (long)(sleepfor * 1000000000);
-
-		pinfo("Adjusting sleep for %ldns(%.10lfs)..", cm.sleepfor.tv_nsec,
-		      sleepfor);
-		m->sleepfor = cm.sleepfor;
-
-		total    = 0;
-		runcount = RUNCOUNT;
-		while(runcount--) {
-			clock_t start = clock();
-			// Run delay
-			cm.pc = 0;
-			run(&cm, memory, 0);
-			clock_t end = clock();
-			double  sec = (double)(end - start) / CLOCKS_PER_SEC;
-			// pinfo("Delay took %f seconds", sec);
-			total += sec;
-		}
-		avg_tm_per_tstate = total / (total_tstates * RUNCOUNT);
-
-		pinfo(
-		    "[After] Total time : %lfs (%lfs/run) (%.10lfs/t-state) (%lf mHz)",
-		    total, RUNCOUNT, total / RUNCOUNT, avg_tm_per_tstate,
-		    (total_tstates * RUNCOUNT) / (total * 1000000));
-	} else
-		pinfo("Not enough frequency delta to calibrate!");
+	// The machine sleeps whenever it gets ahead of the clock, so it needs
+	// no adjusting to how fast the host runs it, only to how late the
+	// host wakes it up, which it keeps measuring as it runs
+	pinfo("Throttling to %lf mHz..", hz / 1000000.0);
+	machine_set_frequency(&cm, hz);
+	for(int round = 1; round <= ROUNDS; round++) {
+		mhz = time_runs(&cm, memory, &total);
+		pinfo("[Round %d] Total time : %lfs (%lfs/run) (%lf mHz, waking up "
+		      "%" Pu64 "ns early)",
+		      round, total, total / RUNCOUNT, mhz, cm.throttle.lead);
+	}
+	machine_set_frequency(m, hz);
+	m->throttle.lead = cm.throttle.lead;
+	machine_destroy(&cm);
 }
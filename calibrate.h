@@ -2,4 +2,10 @@
 
 #include "vm.h"
 
-void calibrate(Machine *m);
+// The frequency of the machine in Hz, unless told otherwise
+#define MACHINE_FREQ 3000000
+
+// Throttles the machine to 'hz', reporting the frequency the delay
+// program runs at before and after, or lets it run as fast as the host
+// can when 'hz' is 0
+void calibrate(Machine *m, u32 hz);
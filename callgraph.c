@@ -0,0 +1,184 @@
+#include "callgraph.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Returns true for the calls and the restarts, which push the address
+// of the next instruction when they are taken
+static bool is_call(u8 opcode) {
+	// CALL, Ccc as 11ccc100 and RST as 11nnn111
+	return opcode == 0xCD || (opcode & 0xC7) == 0xC4 ||
+	       (opcode & 0xC7) == 0xC7;
+}
+
+static u32 node_add(CallGraph *g, u16 entry, u32 parent) {
+	if(g->node_count == g->node_capacity) {
+		g->node_capacity = g->node_capacity ? g->node_capacity * 2 : 64;
+		g->nodes         = (CallNode *)realloc(
+		    g->nodes, sizeof(CallNode) * g->node_capacity);
+	}
+	u32       index = g->node_count++;
+	CallNode *node  = &g->nodes[index];
+	node->entry     = entry;
+	node->parent    = parent;
+	node->child     = 0;
+	node->sibling   = 0;
+	node->tstates   = 0;
+	// The root is nobody's child, and so 0 can end the lists
+	if(index != parent) {
+		node->sibling          = g->nodes[parent].child;
+		g->nodes[parent].child = index;
+	}
+	return index;
+}
+
+static u32 node_child(CallGraph *g, u32 parent, u16 entry) {
+	for(u32 i = g->nodes[parent].child; i; i = g->nodes[i].sibling)
+		if(g->nodes[i].entry == entry)
+			return i;
+	return node_add(g, entry, parent);
+}
+
+static void enter(CallGraph *g, u16 entry, u16 sp) {
+	// Deeper calls are left to the innermost subroutine kept, which they
+	// return to without ever moving the stack pointer above it
+	if(g->depth == CALLGRAPH_DEPTH)
+		return;
+	u32 parent = g->depth ? g->frames[g->depth - 1].node : 0;
+	g->frames[g->depth].entry = entry;
+	g->frames[g->depth].sp    = sp;
+	g->frames[g->depth].node  = node_child(g, parent, entry);
+	g->frames[g->depth].start = g->tstates;
+	g->depth++;
+	g->calls[entry]++;
+	g->active[entry]++;
+}
+
+// Leaves the subroutines whose return address is no longer on the stack
+static void unwind(CallGraph *g, u16 sp) {
+	while(g->depth && sp > g->frames[g->depth - 1].sp) {
+		g->depth--;
+		u16 entry = g->frames[g->depth].entry;
+		if(--g->active[entry] == 0)
+			g->inclusive[entry] += g->tstates - g->frames[g->depth].start;
+	}
+}
+
+void callgraph_set(Machine *m, bool on) {
+	if(on && m->callgraph == NULL) {
+		m->callgraph = (CallGraph *)calloc(1, sizeof(CallGraph));
+		m->hooks |= HOOK_CALLGRAPH;
+	} else if(!on && m->callgraph) {
+		free(m->callgraph->nodes);
+		free(m->callgraph);
+		m->callgraph = NULL;
+		m->hooks &= ~HOOK_CALLGRAPH;
+	}
+}
+
+void callgraph_clear(Machine *m) {
+	CallGraph *g = m->callgraph;
+	if(g == NULL)
+		return;
+	CallNode *nodes    = g->nodes;
+	u32       capacity = g->node_capacity;
+	memset(g, 0, sizeof(CallGraph));
+	g->nodes         = nodes;
+	g->node_capacity = capacity;
+}
+
+u64 callgraph_inclusive(const Machine *m, u16 entry) {
+	const CallGraph *g = m->callgraph;
+	if(g == NULL)
+		return 0;
+	u64 tstates = g->inclusive[entry];
+	// Only the outermost call of it is still to be counted
+	for(u32 i = 0; i < g->depth; i++)
+		if(g->frames[i].entry == entry)
+			return tstates + g->tstates - g->frames[i].start;
+	return tstates;
+}
+
+u32 callgraph_hottest(const Machine *m, u16 *entries, u32 count) {
+	const CallGraph *g = m->callgraph;
+	u32              n = 0;
+	if(g == NULL || count == 0)
+		return 0;
+	u64 *tstates = (u64 *)malloc(sizeof(u64) * count);
+	// Kept sorted as they are found, as only a few are asked for
+	for(u32 entry = 0; entry < 0x10000; entry++) {
+		if(g->calls[entry] == 0)
+			continue;
+		u64 inclusive = callgraph_inclusive(m, entry);
+		if(n == count && inclusive <= tstates[n - 1])
+			continue;
+		u32 i = n < count ? n++ : n - 1;
+		for(; i > 0 && tstates[i - 1] < inclusive; i--) {
+			entries[i] = entries[i - 1];
+			tstates[i] = tstates[i - 1];
+		}
+		entries[i] = entry;
+		tstates[i] = inclusive;
+	}
+	free(tstates);
+	return n;
+}
+
+bool callgraph_write(const Machine *m, const char *path) {
+	const CallGraph *g = m->callgraph;
+	FILE *           f = fopen(path, "w");
+	if(f == NULL)
+		return false;
+	u16 chain[CALLGRAPH_DEPTH + 1];
+	for(u32 i = 0; g && i < g->node_count; i++) {
+		if(g->nodes[i].tstates == 0)
+			continue;
+		u32 length = 0;
+		for(u32 n = i; n; n = g->nodes[n].parent)
+			chain[length++] = g->nodes[n].entry;
+		chain[length++] = g->nodes[0].entry;
+		while(length--)
+			fprintf(f, "0x%04x%c", chain[length], length ? ';' : ' ');
+		fprintf(f, "%" Pu64 "\n", g->nodes[i].tstates);
+	}
+	return fclose(f) == 0;
+}
+
+void callgraph_begin(Machine *m, const u8 *memory) {
+	CallGraph *g = m->callgraph;
+	if(g->node_count == 0)
+		node_add(g, m->pc, 0);
+	// The stack may have been changed from outside of run()
+	unwind(g, m->sp);
+	g->sp     = m->sp;
+	g->opcode = memory[m->pc];
+}
+
+// Charges 'tstates' to the innermost subroutine
+static void charge(CallGraph *g, u8 tstates) {
+	g->tstates += tstates;
+	if(g->depth) {
+		g->nodes[g->frames[g->depth - 1].node].tstates += tstates;
+		g->exclusive[g->frames[g->depth - 1].entry] += tstates;
+	} else
+		g->nodes[0].tstates += tstates;
+}
+
+void callgraph_record(Machine *m, const u8 *memory, u8 tstates) {
+	CallGraph *g = m->callgraph;
+	// A call is charged to the caller, and a return to the callee
+	charge(g, tstates);
+	unwind(g, m->sp);
+	if(is_call(g->opcode) && m->sp == (u16)(g->sp - 2))
+		enter(g, m->pc, m->sp);
+	g->sp     = m->sp;
+	g->opcode = memory[m->pc];
+}
+
+void callgraph_interrupt(Machine *m, const u8 *memory) {
+	CallGraph *g = m->callgraph;
+	enter(g, m->pc, m->sp);
+	charge(g, 12);
+	g->sp     = m->sp;
+	g->opcode = memory[m->pc];
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// The call graph keeps a shadow of the subroutines the machine is in,
+// and charges the T-states of each instruction to the one it is
+// executed in, since the graph was started or cleared. A subroutine is
+// known by its entry address, and entered by a call or a restart which
+// pushes its return address, or by an interrupt taken, which is charged
+// to the handler at its vector. It is left once the stack pointer moves
+// above that return address, however that happens, be it a return, a
+// pop of the return address, sphl or a new stack, so that the shadow
+// stays in step with programs which handle the stack by themselves.
+// The machine runs in the debug mode while its call graph is kept.
+
+// The most subroutines kept one inside the other. The ones called
+// deeper than that are charged to the innermost one kept.
+#define CALLGRAPH_DEPTH 1024
+
+// The T-states spent in each subroutine by the chain of calls it was
+// reached through, for the stacks of the flame graphs
+typedef struct {
+	u16 entry;
+	u32 parent;
+	u32 child;   // the first subroutine called from this one
+	u32 sibling; // the next subroutine called from the parent
+	u64 tstates; // spent in this one, not in the ones it called
+} CallNode;
+
+typedef struct CallGraph {
+	u64 calls[0x10000];
+	// Spent from the entry of each subroutine to its exit, counted once
+	// for a subroutine which calls itself
+	u64 inclusive[0x10000];
+	// Spent in each subroutine, not in the ones it called
+	u64 exclusive[0x10000];
+	u32 active[0x10000]; // times each one is in the shadow stack
+	u64 tstates;         // spent in all, by the same clock
+
+	// The first node is the code outside of any subroutine, named by the
+	// address the machine was started from
+	CallNode *nodes;
+	u32       node_count;
+	u32       node_capacity;
+
+	struct {
+		u16 entry;
+		u16 sp;    // where the return address is
+		u32 node;
+		u64 start; // 'tstates' when it was called
+	} frames[CALLGRAPH_DEPTH];
+	u32 depth;
+
+	u16 sp; // before the instruction being executed
+	u8  opcode;
+} CallGraph;
+
+// Starts keeping the call graph of 'm', or stops and drops it if not 'on'
+void callgraph_set(Machine *m, bool on);
+void callgraph_clear(Machine *m);
+// The T-states spent from the entry of the subroutine at 'entry' to its
+// exit, including the time spent so far by the calls not yet returned
+u64 callgraph_inclusive(const Machine *m, u16 entry);
+// Puts the subroutines which took the most T-states, including the ones
+// they called, in 'entries', most first, and returns how many there are,
+// at most 'count'
+u32 callgraph_hottest(const Machine *m, u16 *entries, u32 count);
+// Writes a line for each chain of calls the machine spent T-states in,
+// the entry addresses from the outermost separated by ';' followed by
+// the T-states, as the collapsed stacks flame graph tools take. Returns
+// false if the file cannot be written.
+bool callgraph_write(const Machine *m, const char *path);
+
+// Used by the cores
+void callgraph_begin(Machine *m, const u8 *memory);
+void callgraph_record(Machine *m, const u8 *memory, u8 tstates);
+void callgraph_interrupt(Machine *m, const u8 *memory);
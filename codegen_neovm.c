@@ -37,6 +37,8 @@ static u8 codegen_get_opcode(Token t) {
 		case TOKEN_cpo: return 0xE4;
 		case TOKEN_cz: return 0xCC;
 		case TOKEN_daa: return 0x27;
+		case TOKEN_di: return 0xF3;
+		case TOKEN_ei: return 0xFB;
 		case TOKEN_hlt: return 0x76;
 		case TOKEN_in: return 0xDB;
 		case TOKEN_jc: return 0xDA;
@@ -58,6 +60,7 @@ static u8 codegen_get_opcode(Token t) {
 		case TOKEN_rar: return 0x1F;
 		case TOKEN_rc: return 0xD8;
 		case TOKEN_ret: return 0xC9;
+		case TOKEN_rim: return 0x20;
 		case TOKEN_rlc: return 0x07;
 		case TOKEN_rm: return 0xf8;
 		case TOKEN_rnc: return 0xD0;
@@ -69,6 +72,7 @@ static u8 codegen_get_opcode(Token t) {
 		case TOKEN_rz: return 0xC8;
 		case TOKEN_sbi: return 0xDE;
 		case TOKEN_shld: return 0x22;
+		case TOKEN_sim: return 0x30;
 		case TOKEN_sphl: return 0xF9;
 		case TOKEN_sta: return 0x32;
 		case TOKEN_stc: return 0x37;
@@ -57,6 +57,15 @@ typedef size_t siz;
 #define Psiz "zd"
 #define Ssiz "zd"
 
+// Storage which each thread has a copy of its own, for the state of the
+// compiler and the disassembler, so that machines can be set up and run
+// on many threads at once
+#ifdef __GNUC__
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 #define STACKTRACE_SHOW
 
 #ifdef __ANDROID__ // no execinfo.h
@@ -31,29 +31,30 @@ typedef struct {
 } PendingLabel;
 
 // C style list of labels
-static Label labelTable[NUM_LABELS] = {{NULL, 0, 0, 0}};
-static siz   labelPointer           = 0;
+static THREAD_LOCAL Label labelTable[NUM_LABELS] = {{NULL, 0, 0, 0}};
+static THREAD_LOCAL siz   labelPointer           = 0;
 
 // C style list of pending labels
-static PendingLabel pending_labels[NUM_PENDING_LABELS] = {{{}, 0, 0, 0}};
-static siz          pendingPointer                     = 0;
+static THREAD_LOCAL PendingLabel pending_labels[NUM_PENDING_LABELS] = {
+    {{}, 0, 0, 0}};
+static THREAD_LOCAL siz pendingPointer = 0;
 
 // Memory management for actually writing bytes
-static u16 memSize = 0, *offset = NULL;
-static u8 *memory = NULL;
+static THREAD_LOCAL u16 memSize = 0, *offset = NULL;
+static THREAD_LOCAL u8 *memory = NULL;
 
 // Since compiler_write_byte cannot directly return an
 // error code, it will denote memory full
 // by triggering this
-static u8 memory_full = 0;
+static THREAD_LOCAL u8 memory_full = 0;
 
 // Denotes whether there is atleast one halt
 // instruction in the program, which otherwise
 // may result in an infinite execution loop
-static u8 has_halt = 0;
+static THREAD_LOCAL u8 has_halt = 0;
 
 // Consumed tokens
-static Token presentToken = {}, previousToken = {};
+static THREAD_LOCAL Token presentToken = {}, previousToken = {};
 
 // Function type which compiles a particular token.
 // Since we're writing more of an assembler of sort,
@@ -167,8 +168,6 @@ CompilationStatus compile_label(Token t) {
 		token_highlight_source(presentToken);
 		return PARSE_ERROR;
 	}
-	if(labelPointer == NUM_LABELS)
-		return LABEL_FULL;
 	for(u16 i = 0; i < labelPointer; i++) {
 		if(labelTable[i].length == t.length &&
 		   memcmp(labelTable[i].label, t.start, t.length) == 0) {
@@ -177,6 +176,12 @@ CompilationStatus compile_label(Token t) {
 			return COMPILE_OK;
 		}
 	}
+	// Only a label which was not used before needs room
+	if(labelPointer == NUM_LABELS) {
+		perr("More than %d labels!", NUM_LABELS);
+		token_highlight_source(t);
+		return LABEL_FULL;
+	}
 	labelTable[labelPointer].label      = strdup(t.start);
 	labelTable[labelPointer].length     = t.length;
 	labelTable[labelPointer].offset     = *offset;
@@ -212,7 +217,16 @@ CompilationStatus compile_hex(u8 is16) {
 					}
 				}
 			}
-			// It might be a forward reference
+			// It might be a forward reference, which needs room in both
+			// of the tables
+			if(pendingPointer == NUM_PENDING_LABELS ||
+			   (!found && labelPointer == NUM_LABELS)) {
+				perr("More than %d labels, or %d uses of labels before "
+				     "they are declared!",
+				     NUM_LABELS, NUM_PENDING_LABELS);
+				token_highlight_source(t);
+				return LABEL_FULL;
+			}
 			if(!found) { // The label was not found earlier
 				labelTable[labelPointer].label      = strdup(t.start);
 				labelTable[labelPointer].length     = t.length;
@@ -441,6 +455,9 @@ static compilerFn compilationTable[] = {
     compile_regpair_or_sp, // TOKEN_DAD
     compile_reg_or_mem,    // TOKEN_DCR
     compile_regpair_or_sp, // TOKEN_DCX
+    compile_no_operand,    // TOKEN_DI
+
+    compile_no_operand, // TOKEN_EI
 
     compile_no_operand, // TOKEN_HLT
 
@@ -480,6 +497,7 @@ static compilerFn compilationTable[] = {
     compile_no_operand, // TOKEN_RAR
     compile_no_operand, // TOKEN_RC
     compile_no_operand, // TOKEN_RET
+    compile_no_operand, // TOKEN_RIM
     compile_no_operand, // TOKEN_RLC
     compile_no_operand, // TOKEN_RM
     compile_no_operand, // TOKEN_RNC
@@ -493,6 +511,7 @@ static compilerFn compilationTable[] = {
     compile_reg_or_mem,    // TOKEN_SBB
     compile_hex8_operand,  // TOKEN_SBI
     compile_hex16_operand, // TOKEN_SHLD
+    compile_no_operand,    // TOKEN_SIM
     compile_no_operand,    // TOKEN_SPHL
     compile_hex16_operand, // TOKEN_STA
     compile_ldax,          // TOKEN_STAX
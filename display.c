@@ -2,8 +2,21 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#include "common.h"
 #include "display.h"
 
+// Set on the threads which run machines with no console, such as the
+// workers of the batch mode
+static THREAD_LOCAL bool muted = false;
+
+void display_mute(bool mute) {
+	muted = mute;
+}
+
+bool display_muted() {
+	return muted;
+}
+
 #ifdef DEBUG
 #define setname(name) void d##name(const char *msg, ...) {
 #else
@@ -11,7 +24,8 @@
 #endif
 
 #define display(name, color, text)            \
-	setname(name) printf(ANSI_FONT_BOLD);     \
+	setname(name) if(muted) return;           \
+	printf(ANSI_FONT_BOLD);                   \
 	printf(ANSI_COLOR_##color "\n" text " "); \
 	printf(ANSI_COLOR_RESET);                 \
 	va_list args;                             \
@@ -25,6 +39,8 @@ display(dbg, GREEN, "[Debug]") display(info, BLUE, "[Info]")
 
 #define print(name, color)               \
 	void p##name(const char *msg, ...) { \
+		if(muted)                        \
+			return;                      \
 		printf(ANSI_COLOR_##color);      \
 		va_list args;                    \
 		va_start(args, msg);             \
@@ -38,6 +54,8 @@ display(dbg, GREEN, "[Debug]") display(info, BLUE, "[Info]")
 
 #define printh(name, color)                                   \
 	void ph##name(const char *header, const char *msg, ...) { \
+		if(muted)                                             \
+			return;                                           \
 		printf(ANSI_COLOR_##color);                           \
 		printf("%s", header);                                 \
 		printf(ANSI_COLOR_RESET);                             \
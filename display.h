@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+
 #define ANSI_COLOR_RED "\x1b[31m"
 #define ANSI_COLOR_GREEN "\x1b[32m"
 #define ANSI_COLOR_YELLOW "\x1b[33m"
@@ -43,3 +45,8 @@ void perr(const char *msg, ...);
 void pinfo(const char *msg, ...);
 void pwarn(const char *msg, ...);
 #endif
+
+// Silences all the messages shown on the present thread, or shows them
+// again if not 'mute'
+void display_mute(bool mute);
+bool display_muted();
@@ -0,0 +1,91 @@
+#include "event.h"
+#include <stdlib.h>
+
+static bool earlier(const Event *a, const Event *b) {
+	return a->at < b->at || (a->at == b->at && a->order < b->order);
+}
+
+static void sift_up(Events *e, u32 i) {
+	Event event = e->heap[i];
+	while(i > 0 && earlier(&event, &e->heap[(i - 1) / 2])) {
+		e->heap[i] = e->heap[(i - 1) / 2];
+		i          = (i - 1) / 2;
+	}
+	e->heap[i] = event;
+}
+
+static void sift_down(Events *e, u32 i) {
+	Event event = e->heap[i];
+	while(2 * i + 1 < e->count) {
+		u32 child = 2 * i + 1;
+		if(child + 1 < e->count &&
+		   earlier(&e->heap[child + 1], &e->heap[child]))
+			child++;
+		if(!earlier(&e->heap[child], &event))
+			break;
+		e->heap[i] = e->heap[child];
+		i          = child;
+	}
+	e->heap[i] = event;
+}
+
+// Takes the earliest event out of the heap
+static void remove_first(Events *e) {
+	e->heap[0] = e->heap[--e->count];
+	if(e->count)
+		sift_down(e, 0);
+}
+
+static void update_next(Machine *m) {
+	Events *e     = m->events;
+	m->next_event = e && e->count ? e->heap[0].at : u64_MAX;
+}
+
+void event_schedule(Machine *m, u64 at, EventFire fire, void *context) {
+	if(m->events == NULL)
+		m->events = (Events *)calloc(1, sizeof(Events));
+	Events *e = m->events;
+	if(e->count == e->capacity) {
+		e->capacity = e->capacity ? e->capacity * 2 : 16;
+		e->heap = (Event *)realloc(e->heap, sizeof(Event) * e->capacity);
+	}
+	e->heap[e->count] = (Event){at, e->scheduled++, fire, context};
+	sift_up(e, e->count++);
+	update_next(m);
+}
+
+u32 event_cancel(Machine *m, EventFire fire, void *context) {
+	Events *e = m->events;
+	if(e == NULL)
+		return 0;
+	// The rest are kept in the order they are in, and made a heap again
+	u32 kept = 0;
+	for(u32 i = 0; i < e->count; i++)
+		if(e->heap[i].fire != fire || e->heap[i].context != context)
+			e->heap[kept++] = e->heap[i];
+	u32 cancelled = e->count - kept;
+	e->count      = kept;
+	for(u32 i = kept / 2; i-- > 0;)
+		sift_down(e, i);
+	update_next(m);
+	return cancelled;
+}
+
+void event_clear(Machine *m) {
+	if(m->events)
+		free(m->events->heap);
+	free(m->events);
+	m->events     = NULL;
+	m->next_event = u64_MAX;
+}
+
+void event_fire(Machine *m) {
+	// What the events schedule for the present cycles is fired too, and
+	// an event may clear them all
+	while(m->next_event <= m->cycles) {
+		Event event = m->events->heap[0];
+		remove_first(m->events);
+		update_next(m);
+		event.fire(event.context, m, event.at);
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// Events call back the devices which act on time, such as timers, at
+// the cycles they are scheduled for. They are kept in a heap by their
+// cycles, and the machine keeps the cycles of the earliest one, which
+// the cores stop at as they stop at the end of the budget, so that a
+// machine pays for the events only when one is due. An event is fired
+// after the instruction which reaches its cycles, with the machine's
+// cycles up to date, and may raise an interrupt or schedule another
+// one. A hlt waits through the events while there are any, for one of
+// them to raise an interrupt which wakes the machine up, be it TRAP
+// while the interrupts are disabled, and halts the machine once there
+// are none left.
+
+// Called with the context the event was scheduled with, and the cycles
+// it was scheduled for, which a periodic event counts its next one from
+typedef void (*EventFire)(void *context, Machine *m, u64 at);
+
+typedef struct {
+	u64       at;
+	u64       order; // of scheduling, for the events of the same cycles
+	EventFire fire;
+	void *    context;
+} Event;
+
+typedef struct Events {
+	Event *heap; // the earliest first
+	u32    count;
+	u32    capacity;
+	u64    scheduled; // events scheduled so far
+} Events;
+
+// Calls 'fire' with 'context' once the machine reaches the cycles 'at'.
+// The events of the same cycles are fired in the order they were
+// scheduled in.
+void event_schedule(Machine *m, u64 at, EventFire fire, void *context);
+// Drops the events scheduled with 'fire' and 'context', and returns how
+// many there were
+u32 event_cancel(Machine *m, EventFire fire, void *context);
+// Drops all the events
+void event_clear(Machine *m);
+
+// Used by the cores
+void event_fire(Machine *m);
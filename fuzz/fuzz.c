@@ -0,0 +1,572 @@
+// Runs random programs with every engine, and on the lanes of a batch,
+// and compares what each of them did with what the switch engine, the
+// plainest of them, did. Each program is a random stream of the examples
+// of the instruction table, assembled, started on random registers, and
+// run once in one go and once more a block at a time, as compiled code
+// stops after a block. A program an engine does not agree on is cut down
+// to as few instructions as still disagree, and shown along with what
+// differed. It runs until stopped unless told how many programs to run :
+//
+// ./the8085_fuzz [<seed> [<number of programs>]]
+//
+// Each program is made from the seed it is numbered with, so that the
+// first program shown to disagree is made again with that seed and 1.
+// The jumps and calls go to the instructions of the program, the direct
+// loads and stores to a scratch area, and the returns pop addresses of
+// instructions off a stack made for them, while everything else, such
+// as where a pchl or an 'm' lands, is left to chance. The budget stops
+// programs which never halt.
+//
+// Events raise random interrupts at random cycles, whose vectors hold an
+// ei and a ret. Compiled code takes them only between its blocks, so the
+// switch engine raises each of them at the cycles the other engine
+// fired it at instead. The lanes of a batch, which start on registers
+// of their own, take no interrupts.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../batch.h"
+#include "../common.h"
+#include "../compiler.h"
+#include "../display.h"
+#include "../event.h"
+#include "../instruction_details.h"
+#include "../interrupt.h"
+#include "../io.h"
+#include "../scanner.h"
+#include "../util.h"
+#include "../vm.h"
+
+#define LOAD_ADDRESS 0x0100
+// The instructions in each program, before its hlt
+#define MIN_LINES 4
+#define MAX_LINES 32
+#define LINE_SIZE 32
+// The cycles each program may take
+#define BUDGET 20000
+// Where the direct loads and stores go, and hl, bc and de start
+#define SCRATCH 0x8000
+#define SCRATCH_SIZE 0x100
+// Where the stack pointer starts, with return addresses on either side
+#define STACK 0xc000
+#define STACK_SIZE 0x100
+// The programs between two reports of how many were run
+#define REPORT_EVERY 1000
+// The events each program may have
+#define EVENTS 4
+// The lanes of a batch each program is run on, the first of them on the
+// registers the engines start on
+#define LANES 8
+// Stands for the lanes of a batch among the engines
+#define BATCH 0xff
+// The bytes the 'in's of a port can read in a run, which are 10 cycles
+#define STREAM_SIZE (BUDGET / 10)
+// The cycles an event may be fired at after it is due, for the longest
+// block of compiled code, of 32 instructions of up to 18 cycles
+#define LATEST (32 * 18)
+
+typedef struct {
+	u32  seed;
+	u32  count;
+	char lines[MAX_LINES][LINE_SIZE];
+	bool removed[MAX_LINES]; // by the minimisation, leaving the label
+	bool jumps[MAX_LINES];
+	u8   targets[MAX_LINES]; // of the jumps and calls, p->count being the hlt
+	u8   registers[LANES][8];
+	u8   scratch[SCRATCH_SIZE];
+	u16  returns[STACK_SIZE / 2]; // picks of the instruction each pops to
+	u32  event_count;
+	u64  event_at[EVENTS];
+	u8   event_lines[EVENTS]; // the interrupts each event raises
+} Program;
+
+// The devices on every port. An 'in' reads the next byte of the stream
+// of its port, and the 'out's are kept as a hash.
+typedef struct {
+	u16 reads[256];
+	u32 writes;
+	u32 hash;
+} Ports;
+
+typedef struct {
+	Machine   m;
+	u8        memory[0x10000];
+	Ports     ports;
+	RunStatus status;
+} Runner;
+
+static const u8 engines[] = {ENGINE_SWITCH,
+#ifdef NEOVM_THREADED
+                             ENGINE_THREADED, ENGINE_BLOCK,
+#endif
+#ifdef NEOVM_JIT
+                             ENGINE_JIT,
+#endif
+                             BATCH};
+
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+static const char *register_names[] = {"a", "b", "c", "d",
+                                       "e", "h", "l", "flags"};
+
+static u8     image[0x10000];
+static char   source[(MAX_LINES + 1) * (LINE_SIZE + 8)];
+static Runner reference, other;
+// What the last check found to differ
+static char difference[128];
+static u64  difference_at;
+static char difference_how[32];
+static u32  difference_lane;
+
+// The bytes each port reads, made from the port and the number of reads
+// before, and the same as the streams of the inputs of a batch
+static u8          streams[256][STREAM_SIZE];
+static BatchStream batch_streams[256];
+
+// The interrupts the events of the other runner raised, when they were
+// due and the cycles they fired at, which the reference raises them at
+typedef struct {
+	u64 due;
+	u64 at;
+	u8  lines;
+} Raised;
+
+static Raised raised[EVENTS];
+static u32    raised_count, raised_given;
+
+static const char *engine_name(u8 engine) {
+	return engine == BATCH ? "batch" : machine_engine_name(engine);
+}
+
+static bool is_jump(u8 op) {
+	// JMP, CALL, and Jcc and Ccc as 11ccc010 and 11ccc100
+	return op == 0xC3 || op == 0xCD || (op & 0xC7) == 0xC2 ||
+	       (op & 0xC7) == 0xC4;
+}
+
+static bool is_direct(u8 op) {
+	// SHLD, LHLD, STA and LDA
+	return op == 0x22 || op == 0x2A || op == 0x32 || op == 0x3A;
+}
+
+// Makes the line 'i' of 'p' from a random example which assembles
+static void random_line(Program *p, u32 i) {
+	char test[48];
+	u8   bytes[64];
+	while(true) {
+		int num     = random_at_most(instruction_keywords_count - 1);
+		int variant = 1 + random_at_most(instruction_variant_count(num) - 1);
+		const char *example = instruction_example(num, variant);
+		// The variants which only differ in their T-states
+		if(example == NULL)
+			continue;
+		snprintf(test, sizeof(test), "%s\nhlt\n", example);
+		u16 pointer = 0;
+		compiler_reset();
+		if(compile(test, bytes, sizeof(bytes), &pointer) != COMPILE_OK)
+			continue;
+		// The only hlt is the one the program ends with
+		if(bytes[0] == 0x76)
+			continue;
+		const char *mnemonic = instruction_keywords[num].str;
+		if(is_jump(bytes[0])) {
+			p->jumps[i]   = true;
+			p->targets[i] = random_at_most(p->count);
+			snprintf(p->lines[i], LINE_SIZE, "%s l%u", mnemonic, p->targets[i]);
+		} else if(is_direct(bytes[0]))
+			snprintf(p->lines[i], LINE_SIZE, "%s %xh", mnemonic,
+			         SCRATCH + (u32)random_at_most(SCRATCH_SIZE - 2));
+		else
+			snprintf(p->lines[i], LINE_SIZE, "%s", example);
+		// The examples are padded with spaces
+		char *line = p->lines[i];
+		for(siz end = strlen(line); end > 0 && line[end - 1] == ' '; end--)
+			line[end - 1] = '\0';
+		return;
+	}
+}
+
+static void generate(Program *p, u32 seed) {
+	srandom(seed);
+	memset(p, 0, sizeof(Program));
+	p->seed  = seed;
+	p->count = MIN_LINES + random_at_most(MAX_LINES - MIN_LINES);
+	for(u32 i = 0; i < p->count; i++) random_line(p, i);
+	for(u32 lane = 0; lane < LANES; lane++) {
+		u8 *registers = p->registers[lane];
+		for(u32 i = 0; i < 8; i++) registers[i] = random_at_most(0xff);
+		// Only the flags an instruction can set
+		registers[REG_FL] &= 0xd5;
+		registers[REG_H] = SCRATCH >> 8;
+		registers[REG_B] = SCRATCH >> 8;
+		registers[REG_D] = SCRATCH >> 8;
+	}
+	for(u32 i = 0; i < SCRATCH_SIZE; i++)
+		p->scratch[i] = random_at_most(0xff);
+	for(u32 i = 0; i < STACK_SIZE / 2; i++)
+		p->returns[i] = random_at_most(0xffff);
+	p->event_count = random_at_most(EVENTS);
+	for(u32 i = 0; i < p->event_count; i++) {
+		p->event_at[i]    = random_at_most(BUDGET - 1);
+		p->event_lines[i] = 1 + random_at_most(0x0e);
+	}
+}
+
+// Writes the source of 'p', with the labels the jumps left go to
+static void write_source(const Program *p) {
+	bool labelled[MAX_LINES + 1] = {false};
+	for(u32 i = 0; i < p->count; i++)
+		if(p->jumps[i] && !p->removed[i])
+			labelled[p->targets[i]] = true;
+	siz length = 0;
+	for(u32 i = 0; i <= p->count; i++) {
+		if(labelled[i])
+			length += sprintf(source + length, "l%u:%s", i,
+			                  i < p->count && p->removed[i] ? "\n" : " ");
+		if(i == p->count)
+			sprintf(source + length, "hlt\n");
+		else if(!p->removed[i])
+			length += sprintf(source + length, "%s\n", p->lines[i]);
+	}
+}
+
+// Assembles 'p' into the image, with its scratch area and its stack
+static bool build(const Program *p) {
+	write_source(p);
+	memset(image, 0, sizeof(image));
+	u16 pointer = LOAD_ADDRESS;
+	compiler_reset();
+	display_mute(true);
+	CompilationStatus status = compile(source, &image[0], 0xffff, &pointer);
+	display_mute(false);
+	if(status != COMPILE_OK)
+		return false;
+	u16 starts[MAX_LINES + 1];
+	u32 count = 0;
+	for(u16 addr = LOAD_ADDRESS; addr < pointer;
+	    addr += opcode_length[image[addr]])
+		starts[count++] = addr;
+	memcpy(&image[SCRATCH], p->scratch, SCRATCH_SIZE);
+	for(u32 i = 0; i < STACK_SIZE / 2; i++) {
+		u16 to = starts[p->returns[i] % count];
+		image[STACK - STACK_SIZE / 2 + 2 * i]     = to & 0xff;
+		image[STACK - STACK_SIZE / 2 + 2 * i + 1] = to >> 8;
+	}
+	// The handlers of TRAP, RST 5.5, RST 6.5 and RST 7.5
+	for(u16 vector = 0x24; vector <= 0x3c; vector += 8) {
+		image[vector]     = 0xFB; // ei
+		image[vector + 1] = 0xC9; // ret
+	}
+	return true;
+}
+
+static void make_streams() {
+	for(u32 port = 0; port < 256; port++) {
+		for(u32 i = 0; i < STREAM_SIZE; i++)
+			streams[port][i] = (port * 151 + i * 37) & 0xff;
+		batch_streams[port] = (BatchStream){port, STREAM_SIZE, streams[port]};
+	}
+}
+
+static u8 port_read(void *device, Machine *m, u8 port) {
+	Ports *ports = (Ports *)device;
+	(void)m;
+	// As a batch reads past the end of a stream
+	if(ports->reads[port] == STREAM_SIZE)
+		return 0;
+	return streams[port][ports->reads[port]++];
+}
+
+static void port_write(void *device, Machine *m, u8 port, u8 value) {
+	Ports *ports = (Ports *)device;
+	(void)m;
+	ports->writes++;
+	ports->hash = ports->hash * 31 + (port << 8 | value);
+}
+
+// Raises the lines the event was scheduled with, keeping the cycles the
+// other runner is at for the reference
+static void raise_recorded(void *context, Machine *m, u64 at) {
+	u8 lines = *(const u8 *)context;
+	(void)at;
+	raised[raised_count++] = (Raised){at, m->cycles, lines};
+	interrupt_raise(m, lines);
+}
+
+static void raise_lines(void *context, Machine *m, u64 at) {
+	(void)at;
+	interrupt_raise(m, *(const u8 *)context);
+}
+
+// Stands for an event of the other runner in the reference, for a hlt
+// of the reference to wait for it as the other's does, until it is
+// known when the other raised its interrupts
+static void wake(void *context, Machine *m, u64 at) {
+	(void)context;
+	(void)m;
+	(void)at;
+}
+
+static void start(Runner *r, const u8 *registers, u8 engine) {
+	machine_init(&r->m);
+	r->m.issilent = 1;
+	r->m.engine   = engine;
+	memset(&r->ports, 0, sizeof(Ports));
+	for(u32 port = 0; port < 256; port++) {
+		io_attach_in(&r->m, port, port_read, &r->ports);
+		io_attach_out(&r->m, port, port_write, NULL, &r->ports);
+	}
+	memcpy(r->memory, image, sizeof(image));
+	memcpy(r->m.registers, registers, 8);
+	r->m.pc   = LOAD_ADDRESS;
+	r->m.sp   = STACK;
+	r->status = RUN_BUDGET;
+}
+
+// Runs 'r' until it has taken 'cycles' cycles, which ends on the same
+// instruction as the engine which took as many did if they agree
+static void catch_up(Runner *r, u64 cycles) {
+	if(r->status != RUN_BUDGET || r->m.cycles >= cycles)
+		return;
+	machine_set_budget(&r->m, cycles - r->m.cycles);
+	r->status = run(&r->m, r->memory, 0);
+}
+
+#define DIFFER(name, x, y)                                            \
+	{                                                                 \
+		snprintf(difference, sizeof(difference),                      \
+		         "%s : 0x%" PRIx64 " with switch, 0x%" PRIx64 " with %s", \
+		         name, (u64)(x), (u64)(y), engine_name(engine));          \
+		return false;                                                 \
+	}
+#define COMPARE(name, field)           \
+	if(reference.field != other.field) \
+	DIFFER(name, reference.field, other.field)
+
+// Tells whether the reference and the other runner are in the same state
+static bool same(u8 engine) {
+	difference_at = other.m.instructions;
+	COMPARE("status", status);
+	COMPARE("cycles", m.cycles);
+	COMPARE("instructions", m.instructions);
+	COMPARE("pc", m.pc);
+	COMPARE("sp", m.sp);
+	for(u32 i = 0; i < 8; i++)
+		COMPARE(register_names[i], m.registers[i]);
+	COMPARE("interrupts enabled", m.interrupts.enabled);
+	COMPARE("interrupt mask", m.interrupts.mask);
+	COMPARE("serial output", m.interrupts.sod);
+	COMPARE("pending interrupts", m.interrupts.pending);
+	for(u32 port = 0; port < 256; port++)
+		if(reference.ports.reads[port] != other.ports.reads[port]) {
+			char name[24];
+			snprintf(name, sizeof(name), "reads of port 0x%02x", port);
+			DIFFER(name, reference.ports.reads[port], other.ports.reads[port]);
+		}
+	COMPARE("writes to the ports", ports.writes);
+	COMPARE("hash of the writes", ports.hash);
+	if(memcmp(reference.memory, other.memory, sizeof(image)) == 0)
+		return true;
+	for(u32 addr = 0; addr < 0x10000; addr++)
+		if(reference.memory[addr] != other.memory[addr]) {
+			char name[24];
+			snprintf(name, sizeof(name), "memory at 0x%04x", addr);
+			DIFFER(name, reference.memory[addr], other.memory[addr]);
+		}
+	return true;
+}
+
+// Tells whether the other runner fired the event in time, as soon as it
+// could stop after it was due
+static bool in_time(const Raised *r, u8 engine) {
+	difference_at = other.m.instructions;
+	if(r->at - r->due > LATEST)
+		DIFFER("cycles an event was fired at", r->due, r->at);
+	return true;
+}
+
+// Runs 'p' on the lanes of a batch, and each lane by itself with the
+// switch engine
+static bool batch_agree(const Program *p) {
+	static BatchInput  inputs[LANES];
+	static BatchResult results[LANES];
+	if(!build(p))
+		return true;
+	BatchOptions options = {LOAD_ADDRESS, BUDGET, ENGINE_SWITCH};
+	for(u32 lane = 0; lane < LANES; lane++) {
+		memset(&inputs[lane], 0, sizeof(BatchInput));
+		memcpy(inputs[lane].registers, p->registers[lane], 8);
+		inputs[lane].sp           = STACK;
+		inputs[lane].stream_count = 256;
+		inputs[lane].streams      = batch_streams;
+	}
+	batch_run(image, sizeof(image), &options, inputs, results, LANES);
+	bool ok = true;
+	for(u32 lane = 0; ok && lane < LANES; lane++) {
+		const BatchResult *r = &results[lane];
+		start(&reference, p->registers[lane], ENGINE_SWITCH);
+		catch_up(&reference, BUDGET);
+		other.status         = r->status;
+		other.m.cycles       = r->cycles;
+		other.m.instructions = r->instructions;
+		other.m.pc           = r->pc;
+		other.m.sp           = r->sp;
+		memcpy(other.m.registers, r->registers, 8);
+		// Which a batch does not tell
+		other.m.interrupts = reference.m.interrupts;
+		memcpy(other.ports.reads, reference.ports.reads,
+		       sizeof(other.ports.reads));
+		other.ports.writes = r->output_count;
+		other.ports.hash   = 0;
+		for(u32 i = 0; i < r->output_count; i++)
+			other.ports.hash = other.ports.hash * 31 +
+			                   (r->outputs[i].port << 8 | r->outputs[i].value);
+		memcpy(other.memory, image, sizeof(image));
+		for(u32 i = 0; i < r->diff_count; i++)
+			other.memory[r->diffs[i].addr] = r->diffs[i].value;
+		snprintf(difference_how, sizeof(difference_how), "in lane %u", lane);
+		difference_lane = lane;
+		ok              = same(BATCH);
+		machine_destroy(&reference.m);
+	}
+	batch_free(results, LANES);
+	return ok;
+}
+
+// Runs 'p' with 'engine' and with the switch engine, a block at a time,
+// for the first block they disagree after to be found, and then in one
+// go, for the blocks to be chained as they are when nothing stops them.
+// Returns whether they agreed, after keeping what differed if not.
+static bool agree(const Program *p, u8 engine) {
+	if(engine == BATCH)
+		return batch_agree(p);
+	if(!build(p))
+		return true;
+	bool ok = true;
+	for(u32 pass = 0; ok && pass < 2; pass++) {
+		bool in_blocks = pass == 0;
+		start(&reference, p->registers[0], ENGINE_SWITCH);
+		start(&other, p->registers[0], engine);
+		raised_count = raised_given = 0;
+		for(u32 i = 0; i < p->event_count; i++) {
+			event_schedule(&other.m, p->event_at[i], raise_recorded,
+			               (void *)&p->event_lines[i]);
+			event_schedule(&reference.m, p->event_at[i], wake, NULL);
+		}
+		snprintf(difference_how, sizeof(difference_how), "%s",
+		         in_blocks ? "a block at a time" : "in one go");
+		difference_lane = 0;
+		// A budget of one cycle stops compiled code after the block it
+		// is in, and the interpreters after the instruction
+		machine_set_budget(&other.m, in_blocks ? 1 : BUDGET);
+		while(ok) {
+			other.status = run(&other.m, other.memory, 0);
+			for(; raised_given < raised_count; raised_given++) {
+				Raised *r = &raised[raised_given];
+				ok &= in_time(r, engine);
+				event_schedule(&reference.m, r->at, raise_lines, &r->lines);
+			}
+			catch_up(&reference, other.m.cycles);
+			ok = ok && same(engine);
+			if(other.status != RUN_BUDGET || other.m.cycles >= BUDGET)
+				break;
+			machine_set_budget(&other.m, 1);
+		}
+		machine_destroy(&reference.m);
+		machine_destroy(&other.m);
+	}
+	return ok;
+}
+
+// Removes as many of the instructions of 'p' as it can while 'engine'
+// still disagrees, halving the runs of them it tries to remove
+static void minimise(Program *p, u8 engine) {
+	bool removed[MAX_LINES];
+	for(u32 size = p->count; size > 0; size /= 2) {
+		bool progress = true;
+		while(progress) {
+			progress = false;
+			for(u32 from = 0; from < p->count; from += size) {
+				memcpy(removed, p->removed, sizeof(removed));
+				bool any = false;
+				for(u32 i = from; i < from + size && i < p->count; i++) {
+					any |= !p->removed[i];
+					p->removed[i] = true;
+				}
+				if(any && !agree(p, engine))
+					progress = true;
+				else
+					memcpy(p->removed, removed, sizeof(removed));
+			}
+		}
+	}
+	// What differed in the smallest program
+	agree(p, engine);
+}
+
+static void report(Program *p, u8 engine) {
+	u32 before = p->count;
+	minimise(p, engine);
+	u32 after = 0;
+	for(u32 i = 0; i < p->count; i++) after += !p->removed[i];
+	const u8 *registers = p->registers[difference_lane];
+	printf("\nThe program of seed %u disagrees with %s %s, after %" Pu64
+	       " instructions, on\n  %s\n",
+	       p->seed, engine_name(engine), difference_how, difference_at,
+	       difference);
+	printf("Cut down from %u instructions to %u, run from a=0x%02x "
+	       "b=0x%02x c=0x%02x d=0x%02x e=0x%02x h=0x%02x l=0x%02x "
+	       "flags=0x%02x sp=0x%04x",
+	       before, after, registers[REG_A], registers[REG_B],
+	       registers[REG_C], registers[REG_D], registers[REG_E],
+	       registers[REG_H], registers[REG_L], registers[REG_FL], STACK);
+	for(u32 i = 0; engine != BATCH && i < p->event_count; i++)
+		printf("%s 0x%x at %" Pu64 " cycles",
+		       i ? "," : ", raising the interrupts", p->event_lines[i],
+		       p->event_at[i]);
+	printf(" :\n");
+	write_source(p);
+	printf("%s", source);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+	if(argc > 3) {
+		perr("Usage : %s [<seed> [<number of programs>]]\n", argv[0]);
+		return 1;
+	}
+	u32 seed  = argc > 1 ? strtoul(argv[1], NULL, 0) : (u32)time(NULL);
+	u64 count = argc > 2 ? strtoull(argv[2], NULL, 0) : u64_MAX;
+	printf("Comparing");
+	for(u32 e = 1; e < NUM_ENGINES; e++)
+		printf(" %s", engine_name(engines[e]));
+	printf(" with switch, from seed %u\n", seed);
+
+	static Program program;
+	u64            disagreements = 0;
+	make_streams();
+	for(u64 i = 0; i < count; i++) {
+		// The examples which do not assemble are left unsaid
+		display_mute(true);
+		generate(&program, seed + i);
+		display_mute(false);
+		for(u32 e = 1; e < NUM_ENGINES; e++) {
+			if(agree(&program, engines[e]))
+				continue;
+			disagreements++;
+			report(&program, engines[e]);
+			break;
+		}
+		if((i + 1) % REPORT_EVERY == 0) {
+			printf("%" Pu64 " programs, %" Pu64 " disagreeing\n", i + 1,
+			       disagreements);
+			fflush(stdout);
+		}
+	}
+	if(count % REPORT_EVERY != 0)
+		printf("%" Pu64 " programs, %" Pu64 " disagreeing\n", count,
+		       disagreements);
+	return disagreements > 0;
+}
@@ -26,6 +26,8 @@ INSTRUCTION(daa, 3)
 INSTRUCTION(dad, 3)
 INSTRUCTION(dcr, 3)
 INSTRUCTION(dcx, 3)
+INSTRUCTION(di, 2)
+INSTRUCTION(ei, 2)
 INSTRUCTION(hlt, 3)
 INSTRUCTION(in, 2)
 INSTRUCTION(inr, 3)
@@ -56,6 +58,7 @@ INSTRUCTION(ral, 3)
 INSTRUCTION(rar, 3)
 INSTRUCTION(rc, 2)
 INSTRUCTION(ret, 3)
+INSTRUCTION(rim, 3)
 INSTRUCTION(rlc, 3)
 INSTRUCTION(rm, 2)
 INSTRUCTION(rnc, 3)
@@ -68,6 +71,7 @@ INSTRUCTION(rz, 2)
 INSTRUCTION(sbb, 3)
 INSTRUCTION(sbi, 3)
 INSTRUCTION(shld, 4)
+INSTRUCTION(sim, 3)
 INSTRUCTION(sphl, 4)
 INSTRUCTION(sta, 3)
 INSTRUCTION(stax, 4)
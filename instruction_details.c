@@ -1,5 +1,6 @@
 #include "bytecode.h"
 #include "display.h"
+#include "instruction_details.h"
 #include "util.h"
 #include <stdint.h>
 #include <stdio.h>
@@ -71,8 +72,16 @@ static const char *type_get_str(uint16_t code, uint8_t part) {
 	return type_strings[10 + typ - 4];
 }
 
-static char example[20] = {0}, partins[6] = {0}, operand1[7] = {0},
-            operand2[7] = {0};
+static THREAD_LOCAL char example[20] = {0}, partins[6] = {0},
+                         operand1[8] = {0}, operand2[8] = {0};
+
+// Writes 'value' in hex after 'before', as the assembler reads it, with
+// a 0 in front of a leading letter, as in 0cdh
+static void sprint_hex(char *to, const char *before, uint16_t value) {
+	uint16_t leading = value;
+	while(leading > 0xf) leading >>= 4;
+	sprintf(to, "%s%s%xh", before, leading > 9 ? "0" : "", value);
+}
 
 static uint16_t get_random_16() {
 	// srand(time(NULL));
@@ -113,13 +122,11 @@ static void type_gen_example(uint16_t code, uint8_t part, int ins) {
 		switch(typ) {
 			case 0:
 			case 1: {
-				uint16_t el = get_random_16();
-				sprintf(operand1, "%xh", el);
+				sprint_hex(operand1, "", get_random_16());
 				break;
 			}
 			case 2: {
-				uint16_t el = get_random_8();
-				sprintf(operand1, "%xh", el);
+				sprint_hex(operand1, "", get_random_8());
 				break;
 			}
 			case 3: {
@@ -127,7 +134,7 @@ static void type_gen_example(uint16_t code, uint8_t part, int ins) {
 			}
 			case 4: {
 				sprintf(operand1, "%c,", get_random_reg());
-				sprintf(operand2, " %xh", get_random_8());
+				sprint_hex(operand2, " ", get_random_8());
 				break;
 			}
 			case 5: {
@@ -145,7 +152,7 @@ static void type_gen_example(uint16_t code, uint8_t part, int ins) {
 			}
 			case 8: {
 				sprintf(operand1, "%s,", get_random_pair());
-				sprintf(operand2, " %xh", get_random_16());
+				sprint_hex(operand2, " ", get_random_16());
 				break;
 			}
 			case 9: {
@@ -158,7 +165,7 @@ static void type_gen_example(uint16_t code, uint8_t part, int ins) {
 		switch(typ) {
 			case 4:
 				sprintf(operand1, "m,");
-				sprintf(operand2, " %xh", get_random_8());
+				sprint_hex(operand2, " ", get_random_8());
 				break;
 			case 5:
 				sprintf(operand1, "%c,", get_random_reg());
@@ -192,7 +199,7 @@ static const char *len_get_str(uint16_t code) {
  */
 
 static uint8_t mc_istwice(uint8_t mc) {
-	return mc == 1 || mc == 2 || mc == 3 || mc == 5 || mc == 7;
+	return mc == 1 || mc == 2 || mc == 3 || mc == 5 || mc == 6;
 }
 
 static uint8_t mc_get(uint16_t code, uint8_t part) {
@@ -299,8 +306,8 @@ static uint16_t opcode_details[] = {
     0x7070, // DAD
     0x6136, // DCR
     0x700a, // DCX
-    // 0x3005,   // DI
-    // 0x3005,   // EI
+    0x3005, // DI
+    0x3005, // EI
     0x3049, // HLT
     0x2370, // IN
     0x6136, // INR
@@ -331,7 +338,7 @@ static uint16_t opcode_details[] = {
     0x3005, // RAR
     0x303b, // RC
     0x3070, // RET
-    // 0x3005,   // RIM
+    0x3005, // RIM
     0x3005, // RLC
     0x303b, // RM
     0x303b, // RNC
@@ -344,7 +351,7 @@ static uint16_t opcode_details[] = {
     0x6117, // SBB
     0x234c, // SBI
     0x1593, // SHLD
-    // 0x3005,   // SIM
+    0x3005, // SIM
     0x300a, // SPHL
     0x0582, // STA
     0x904c, // STAX
@@ -357,13 +364,27 @@ static uint16_t opcode_details[] = {
     0x3093, // XTHL
 };
 
+int instruction_variant_count(int num) {
+	uint16_t op = opcode_details[num];
+	return 1 +
+	       (type_isdual(extract_nibble(op, 3)) ||
+	        mc_istwice(extract_nibble(op, 1)) ||
+	        tstate_istwice(extract_nibble(op, 0))) +
+	       type_isthrice(extract_nibble(op, 3));
+}
+
+const char *instruction_example(int num, int variant) {
+	type_gen_example(opcode_details[num], variant, num);
+	return partins[0] == ' ' ? NULL : example;
+}
+
+int instruction_tstates(int num, int variant) {
+	return tstate_get(opcode_details[num], variant);
+}
+
 void instruction_print_details(int num) {
 	uint16_t op     = opcode_details[num];
-	int      target = 2;
-	target += type_isdual(extract_nibble(op, 3)) ||
-	          mc_istwice(extract_nibble(op, 1)) ||
-	          tstate_istwice(extract_nibble(op, 0));
-	target += type_isthrice(extract_nibble(op, 3));
+	int      target = 1 + instruction_variant_count(num);
 	// Headers
 	printf("\n%9sOperand Type%*.sLength%2s\tM/C\tT/S\t Example\n", " ", 11, " ",
 	       " ");
@@ -1,3 +1,13 @@
 #pragma once
 
 void instruction_print_details(int num);
+// The rows instruction_print_details() shows for the mnemonic 'num' of
+// the instruction table, one for each of its variants, such as the
+// register and the memory operands of mov, or a conditional jump which
+// is not taken and one which is
+int instruction_variant_count(int num);
+// A random example of the variant 'variant', from 1, of 'num', such as
+// "mvi b, 3fh", or NULL for the variants which only differ in their
+// T-states. It is overwritten by the next example made on the thread.
+const char *instruction_example(int num, int variant);
+int         instruction_tstates(int num, int variant);
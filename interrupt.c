@@ -0,0 +1,81 @@
+#include "interrupt.h"
+#include <string.h>
+
+#define MASKABLE (INTERRUPT_RST55 | INTERRUPT_RST65 | INTERRUPT_RST75)
+
+// Brings 'ready' up to date with the rest of the state
+static void update(Machine *m) {
+	struct Interrupts *i = &m->interrupts;
+	i->ready = (i->pending & INTERRUPT_TRAP) ||
+	           (i->enabled && (i->pending & ~i->mask & MASKABLE));
+}
+
+void interrupt_raise(Machine *m, u8 lines) {
+	m->interrupts.pending |= lines;
+	update(m);
+}
+
+void interrupt_clear(Machine *m, u8 lines) {
+	m->interrupts.pending &= ~lines;
+	update(m);
+}
+
+void interrupt_reset(Machine *m) {
+	memset(&m->interrupts, 0, sizeof(m->interrupts));
+	m->interrupts.mask       = MASKABLE;
+	m->interrupts.enabled_at = u64_MAX;
+}
+
+void interrupt_enable(Machine *m, bool enable, u64 instructions) {
+	m->interrupts.enabled = enable;
+	// ei counts itself as done
+	if(enable)
+		m->interrupts.enabled_at = instructions + 1;
+	update(m);
+}
+
+u8 interrupt_rim(const Machine *m) {
+	const struct Interrupts *i = &m->interrupts;
+	return i->sid << 7 | (i->pending & MASKABLE) << 4 | i->enabled << 3 |
+	       i->mask;
+}
+
+void interrupt_sim(Machine *m, u8 value) {
+	struct Interrupts *i = &m->interrupts;
+	if(value & 0x08) // mask set enable
+		i->mask = value & MASKABLE;
+	if(value & 0x10) // reset RST 7.5
+		i->pending &= ~INTERRUPT_RST75;
+	if(value & 0x40) // serial output enable
+		i->sod = value >> 7;
+	update(m);
+}
+
+u16 interrupt_take(Machine *m, u64 instructions) {
+	struct Interrupts *i = &m->interrupts;
+	u16                vector;
+	u8                 line;
+	if(i->pending & INTERRUPT_TRAP) {
+		line   = INTERRUPT_TRAP;
+		vector = 0x24;
+	} else if(instructions == i->enabled_at) {
+		// Not before the instruction after ei is done
+		return 0;
+	} else {
+		u8 takeable = i->pending & ~i->mask & MASKABLE;
+		if(takeable & INTERRUPT_RST75) {
+			line   = INTERRUPT_RST75;
+			vector = 0x3c;
+		} else if(takeable & INTERRUPT_RST65) {
+			line   = INTERRUPT_RST65;
+			vector = 0x34;
+		} else {
+			line   = INTERRUPT_RST55;
+			vector = 0x2c;
+		}
+	}
+	i->pending &= ~line;
+	i->enabled = 0;
+	update(m);
+	return vector;
+}
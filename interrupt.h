@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// The machine takes the TRAP, RST 7.5, RST 6.5 and RST 5.5 interrupts,
+// in that order of priority, between two instructions, by pushing the
+// pc and jumping to 0x24, 0x3c, 0x34 and 0x2c. The three RSTs are masked
+// by sim, which all of them are after a reset, and all but TRAP are
+// disabled by di and by the taking of any interrupt, until ei enables
+// them again after the instruction which follows it. A line raised
+// stays pending until its interrupt is taken, or it is cleared, or sim
+// resets it for RST 7.5. The cores test whether an interrupt can be
+// taken only when they stop for the budget or the throttle, and what
+// can make one takeable makes them stop after the present instruction,
+// so that a machine with no interrupt pending does not pay for them.
+#define INTERRUPT_RST55 (1 << 0)
+#define INTERRUPT_RST65 (1 << 1)
+#define INTERRUPT_RST75 (1 << 2)
+#define INTERRUPT_TRAP (1 << 3)
+
+// Raises the INTERRUPT_* in 'lines'. Raised from a device during an
+// 'in' or an 'out', or between two runs, the interrupt is taken after
+// the present instruction, or before the first one of the next run.
+void interrupt_raise(Machine *m, u8 lines);
+// Drops the INTERRUPT_* in 'lines' which have not been taken yet
+void interrupt_clear(Machine *m, u8 lines);
+// Disables and masks all the interrupts, and drops the pending ones
+void interrupt_reset(Machine *m);
+
+// Used by the cores
+void interrupt_enable(Machine *m, bool enable, u64 instructions);
+u8   interrupt_rim(const Machine *m);
+void interrupt_sim(Machine *m, u8 value);
+// Takes the interrupt of the highest priority which can be taken after
+// the 'instructions'th instruction, returning its vector, or 0 if none
+u16 interrupt_take(Machine *m, u64 instructions);
@@ -0,0 +1,154 @@
+#include "io.h"
+#include "display.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The bytes written to the console are kept back as the text they are
+// shown as. The machines of a thread share the terminal, and so the
+// text kept back, each thread having its own.
+#define CONSOLE_BUFFER 4096
+// How a byte written to the console is shown, which is at most
+// CONSOLE_RECORD long
+#define CONSOLE_OUT ANSI_COLOR_YELLOW "\n[out:0x%x]" ANSI_COLOR_RESET " 0x%x"
+#define CONSOLE_RECORD 64
+
+static THREAD_LOCAL struct {
+	char text[CONSOLE_BUFFER];
+	u32  used;
+} console;
+
+void io_attach_in(Machine *m, u8 port, PortRead read, void *device) {
+	m->in[port].read   = read;
+	m->in[port].device = device;
+}
+
+void io_attach_out(Machine *m, u8 port, PortWrite write, PortFlush flush,
+                   void *device) {
+	m->out[port].write  = write;
+	m->out[port].flush  = flush;
+	m->out[port].device = device;
+}
+
+void io_reset(Machine *m) {
+	for(u32 port = 0; port < 256; port++) {
+		io_attach_in(m, port, console_read, NULL);
+		io_attach_out(m, port, console_write, console_flush, NULL);
+	}
+}
+
+void io_flush(Machine *m) {
+	for(u32 port = 0; port < 256; port++)
+		if(m->out[port].flush)
+			m->out[port].flush(m->out[port].device);
+}
+
+u8 console_read(void *device, Machine *m, u8 port) {
+	(void)device;
+	(void)m;
+	u32 val = 0;
+	// The question must come after all that was written out before it
+	console_flush(NULL);
+	pblue("\n[in:0x%x] ", port);
+	if(scanf("%x", &val) != 1)
+		val = 0;
+	return (u8)val;
+}
+
+void console_write(void *device, Machine *m, u8 port, u8 value) {
+	(void)device;
+	if(m->issilent)
+		return;
+	if(console.used + CONSOLE_RECORD > CONSOLE_BUFFER)
+		console_flush(NULL);
+	console.used += snprintf(&console.text[console.used],
+	                         CONSOLE_BUFFER - console.used, CONSOLE_OUT, port,
+	                         value);
+}
+
+void console_flush(void *device) {
+	(void)device;
+	if(console.used == 0)
+		return;
+	fwrite(console.text, 1, console.used, stdout);
+	fflush(stdout);
+	console.used = 0;
+}
+
+void io_stream_bytes(IoStream *s, const u8 *bytes, u32 count) {
+	memset(s, 0, sizeof(IoStream));
+	s->bytes = bytes;
+	s->count = count;
+}
+
+bool io_stream_file(IoStream *s, const char *path) {
+	memset(s, 0, sizeof(IoStream));
+	char *text = readFile(path);
+	if(text == NULL)
+		return false;
+	// There are never more bytes than separated words
+	u8 *bytes = (u8 *)malloc(strlen(text) / 2 + 1);
+	u32 count = 0;
+	char *rest;
+	char *word = strtok_r(text, " \t\r\n", &rest);
+	while(word) {
+		if(!parse_hex_byte(word, &bytes[count++])) {
+			free(bytes);
+			free(text);
+			return false;
+		}
+		word = strtok_r(NULL, " \t\r\n", &rest);
+	}
+	free(text);
+	s->bytes = s->owned = bytes;
+	s->count            = count;
+	return true;
+}
+
+void io_stream_generator(IoStream *s, IoGenerator generate, void *context) {
+	memset(s, 0, sizeof(IoStream));
+	s->generate = generate;
+	s->context  = context;
+}
+
+void io_stream_rewind(IoStream *s) {
+	s->consumed = 0;
+}
+
+void io_stream_free(IoStream *s) {
+	free(s->owned);
+	memset(s, 0, sizeof(IoStream));
+}
+
+u8 io_stream_read(void *stream, Machine *m, u8 port) {
+	IoStream *s = (IoStream *)stream;
+	(void)m;
+	u64 index = s->consumed++;
+	if(s->generate)
+		return s->generate(s->context, port, index);
+	return index < s->count ? s->bytes[index] : 0;
+}
+
+void io_attach_stream(Machine *m, u8 port, IoStream *s) {
+	io_attach_in(m, port, io_stream_read, s);
+}
+
+void io_capture_write(void *capture, Machine *m, u8 port, u8 value) {
+	IoCapture *c = (IoCapture *)capture;
+	(void)m;
+	if(c->count == c->capacity) {
+		c->capacity = c->capacity ? c->capacity * 2 : 64;
+		c->bytes = (IoByte *)realloc(c->bytes, sizeof(IoByte) * c->capacity);
+	}
+	c->bytes[c->count++] = (IoByte){port, value};
+}
+
+void io_capture_free(IoCapture *c) {
+	free(c->bytes);
+	memset(c, 0, sizeof(IoCapture));
+}
+
+void io_attach_capture(Machine *m, u8 port, IoCapture *c) {
+	io_attach_out(m, port, io_capture_write, NULL, c);
+}
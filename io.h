@@ -0,0 +1,68 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// 'in' and 'out' talk to the device attached to their port. A machine
+// starts with the console on all the ports, which asks for the byte of
+// each 'in' on the terminal, and keeps the bytes of the 'out's back
+// until run() returns, or the console asks for a byte, so that a
+// program which writes out a lot is not slowed down by the terminal.
+
+// Attaches 'read' to 'port', to be called with 'device' for each 'in'
+void io_attach_in(Machine *m, u8 port, PortRead read, void *device);
+// Attaches 'write' to 'port', to be called with 'device' for each 'out',
+// and 'flush', if any, to write out what the device kept back
+void io_attach_out(Machine *m, u8 port, PortWrite write, PortFlush flush,
+                   void *device);
+// Attaches the console to all the ports
+void io_reset(Machine *m);
+// Has the devices on the output ports write out what they kept back
+void io_flush(Machine *m);
+
+// The console, which takes no device
+u8   console_read(void *device, Machine *m, u8 port);
+void console_write(void *device, Machine *m, u8 port, u8 value);
+void console_flush(void *device);
+
+// A stream of the bytes the 'in's of a port read one after the other,
+// from an array, a file or a generator. Once it runs out, the 'in's
+// read 0.
+typedef u8 (*IoGenerator)(void *context, u8 port, u64 index);
+typedef struct {
+	const u8 *  bytes;
+	u32         count;
+	u64         consumed; // bytes read so far, including past the end
+	u8 *        owned;    // the bytes read from a file
+	IoGenerator generate; // called with the index of each byte, if set
+	void *      context;
+} IoStream;
+
+// The stream reads the 'count' bytes at 'bytes', which are not copied
+void io_stream_bytes(IoStream *s, const u8 *bytes, u32 count);
+// The stream reads the hexadecimal bytes in the file at 'path',
+// separated by white space. Returns false if the file cannot be read
+// or holds anything else.
+bool io_stream_file(IoStream *s, const char *path);
+void io_stream_generator(IoStream *s, IoGenerator generate, void *context);
+// Starts the stream over from its first byte
+void io_stream_rewind(IoStream *s);
+void io_stream_free(IoStream *s);
+u8   io_stream_read(void *stream, Machine *m, u8 port);
+void io_attach_stream(Machine *m, u8 port, IoStream *s);
+
+// Keeps the bytes the 'out's of the ports it is attached to write
+typedef struct {
+	u8 port;
+	u8 value;
+} IoByte;
+
+typedef struct {
+	IoByte *bytes;
+	u32     count;
+	u32     capacity;
+} IoCapture;
+
+void io_capture_write(void *capture, Machine *m, u8 port, u8 value);
+void io_capture_free(IoCapture *c);
+void io_attach_capture(Machine *m, u8 port, IoCapture *c);
@@ -0,0 +1,1244 @@
+#include "jit.h"
+
+#ifdef NEOVM_JIT
+
+#include <cpuid.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// The JIT
+// =======
+// A hot block is compiled to a function which loads the registers of the
+// machine to the registers of the host, executes the instructions of the
+// block on them, and stores them back on exit. The flags are computed
+// exactly like the interpreter does, including its quirks, so switching
+// between the two in the middle of a program is never visible, and the
+// flags which are overwritten later in the block without being read are
+// not computed at all.
+// Instructions which interact with the user or the rest of the machine
+// (in, out, hlt, and the interrupt related ones) are never compiled.
+// The compiled code stops right before them, and the interpreter takes
+// over from there.
+
+#define JIT_ARENA_SIZE (1 << 20)
+// Upper bound of the code generated for a single instruction, with its
+// exits
+#define JIT_MAX_INSTRUCTION 256
+// Upper bound of the code generated for a block besides its instructions
+#define JIT_MAX_OVERHEAD 160
+#define JIT_MAX_BLOCK 32
+// Number of compiled blocks, and of the exits of the compiled blocks to
+// the ones which are not compiled yet, the JIT keeps track of
+#define JIT_MAX_COMPILED 8192
+#define JIT_MAX_PENDING 4096
+
+struct Jit {
+	u8 *arena; // mapped executable while not compiling
+	siz used;
+	// Offset of the code of the instructions of the block compiled for
+	// each address in the arena, or 0 if there is none
+	u32 entry[0x10000];
+	u16 compiled[JIT_MAX_COMPILED];
+	u16 compiled_count;
+	// Exits which are to be linked to the block at 'to', once it is
+	// compiled. 'jump' is the offset of the displacement of the jump
+	// which presently goes to the exit.
+	struct {
+		u32 jump;
+		u16 to;
+	} pending[JIT_MAX_PENDING];
+	u16 pending_count;
+};
+
+// T-states of each instruction, as counted by the interpreter, the
+// conditional ones being counted as not taken
+// clang-format off
+static const u8 opcode_tstates[256] = {
+	 4, 10,  7,  6,  4,  4,  7,  4,  4, 10,  7,  6,  4,  4,  7,  4, // 0x00
+	 4, 10,  7,  6,  4,  4,  7,  4,  4, 10,  7,  6,  4,  4,  7,  4, // 0x10
+	 4, 10, 16,  6,  4,  4,  7,  4,  4, 10, 16,  6,  4,  4,  7,  4, // 0x20
+	 4, 10, 13,  6, 10, 10, 10,  4,  4, 10, 13,  6,  4,  4,  7,  4, // 0x30
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x40
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x50
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x60
+	 7,  7,  7,  7,  7,  7,  5,  7,  4,  4,  4,  4,  4,  4,  7,  4, // 0x70
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x80
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0x90
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0xA0
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4, // 0xB0
+	 6, 10,  7, 10,  9, 12,  7, 12,  6, 10,  7,  4,  9, 18,  7, 12, // 0xC0
+	 6, 10,  7, 10,  9, 12,  7, 12,  6,  4,  7, 10,  9,  4,  7, 12, // 0xD0
+	 6, 10,  7, 16,  9, 12,  7, 12,  6,  6,  7,  4,  9,  4,  7, 12, // 0xE0
+	 6, 10,  7,  4,  9, 12,  7, 12,  6,  6,  7,  4,  9,  4,  7, 12, // 0xF0
+};
+// clang-format on
+
+// Host registers
+enum {
+	RAX,
+	RCX,
+	RDX,
+	RBX,
+	RSP,
+	RBP,
+	RSI,
+	RDI,
+	R8,
+	R9,
+	R10,
+	R11,
+	R12,
+	R13,
+	R14,
+	R15
+};
+
+// Host register holding each register of the machine, by REG_*. The
+// rest are :
+// rdi : the machine
+// rsi : the memory
+// r15 : the stack pointer
+// r11 : the address of the present memory access, or an operand
+// rax, rcx, rdx : scratch, rax being used to read the host flags
+// and the bitmap of decoded addresses is kept on the stack.
+static const u8 host[8] = {R8, R9, R10, RBX, RBP, R12, R13, R14};
+
+#define A host[REG_A]
+#define F host[REG_FL]
+#define H host[REG_H]
+#define L host[REG_L]
+#define SP R15
+
+// Register of the machine encoded in the bits of an opcode, in the
+// order B C D E H L M A. M is not a register, and is marked as 8.
+static const u8 encoded[8] = {REG_B, REG_C, REG_D, REG_E,
+                              REG_H, REG_L, 8,     REG_A};
+#define M 8
+
+// Opcodes of the 8 bit arithmetic instructions, of the form op r/m8, r8
+#define X_ADD 0x00
+#define X_OR 0x08
+#define X_ADC 0x10
+#define X_AND 0x20
+#define X_SUB 0x28
+#define X_XOR 0x30
+#define X_CMP 0x38
+#define X_XCHG 0x86
+#define X_MOV 0x88
+// Extensions of the opcodes of the immediate, shift and unary forms
+#define E_ADD 0
+#define E_OR 1
+#define E_ADC 2
+#define E_AND 4
+#define E_SUB 5
+#define E_XOR 6
+#define E_ROL 0
+#define E_ROR 1
+#define E_RCL 2
+#define E_RCR 3
+#define E_SHL 4
+#define E_SHR 5
+#define E_NOT 2
+#define E_NEG 3
+// Condition codes
+#define C_B 2
+#define C_Z 4
+#define C_NZ 5
+
+typedef struct {
+	Jit *jit;
+	u8 * out;      // where the next byte goes
+	u8 * epilogue; // stores the registers back, and returns eax
+	u8 * loop;     // the code of the first instruction of the block
+	u16  start;    // address of the first instruction of the block
+	// T-states and instructions from the start of the block to the point
+	// the code is being emitted for, which the exits add to the counters
+	// of the machine
+	u32 cycles;
+	u16 instructions;
+	// Jumps to the exits for writes to decoded addresses, with the
+	// address of the instruction to continue from
+	struct {
+		u8 *jump;
+		u16 pc;
+		u32 cycles;
+		u16 instructions;
+	} flushes[JIT_MAX_BLOCK];
+	u8 flush_count;
+} Emitter;
+
+static void emit8(Emitter *e, u8 byte) {
+	*e->out++ = byte;
+}
+
+static void emit16(Emitter *e, u16 word) {
+	memcpy(e->out, &word, 2);
+	e->out += 2;
+}
+
+static void emit32(Emitter *e, u32 dword) {
+	memcpy(e->out, &dword, 4);
+	e->out += 4;
+}
+
+// A REX prefix is emitted for all the 8 bit operations, so that the low
+// bytes of rsp, rbp, rsi and rdi are addressed instead of ah, ch, dh, bh
+static void rex(Emitter *e, u8 w, u8 r, u8 x, u8 b) {
+	emit8(e, 0x40 | (w << 3) | ((r >> 3) << 2) | ((x >> 3) << 1) | (b >> 3));
+}
+
+static void modrm(Emitter *e, u8 mod, u8 r, u8 rm) {
+	emit8(e, (mod << 6) | ((r & 7) << 3) | (rm & 7));
+}
+
+// [rsi + index]
+static void memory_operand(Emitter *e, u8 r, u8 index) {
+	modrm(e, 0, r, RSP);
+	emit8(e, ((index & 7) << 3) | (RSI & 7));
+}
+
+// op dst8, src8
+static void alu8(Emitter *e, u8 op, u8 dst, u8 src) {
+	rex(e, 0, src, 0, dst);
+	emit8(e, op);
+	modrm(e, 3, src, dst);
+}
+
+// op dst8, imm8
+static void alu8_imm(Emitter *e, u8 ext, u8 dst, u8 imm) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0x80);
+	modrm(e, 3, ext, dst);
+	emit8(e, imm);
+}
+
+// op dst32, src32
+static void alu32(Emitter *e, u8 op, u8 dst, u8 src) {
+	rex(e, 0, src, 0, dst);
+	emit8(e, op + 1);
+	modrm(e, 3, src, dst);
+}
+
+// op dst32, imm8, the immediate being sign extended
+static void alu32_imm(Emitter *e, u8 ext, u8 dst, i8 imm) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0x83);
+	modrm(e, 3, ext, dst);
+	emit8(e, (u8)imm);
+}
+
+static void alu16_imm(Emitter *e, u8 ext, u8 dst, i8 imm) {
+	emit8(e, 0x66);
+	alu32_imm(e, ext, dst, imm);
+}
+
+static void mov8_imm(Emitter *e, u8 dst, u8 imm) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0xB0 + (dst & 7));
+	emit8(e, imm);
+}
+
+static void mov16_imm(Emitter *e, u8 dst, u16 imm) {
+	emit8(e, 0x66);
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0xB8 + (dst & 7));
+	emit16(e, imm);
+}
+
+static void mov32_imm(Emitter *e, u8 dst, u32 imm) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0xB8 + (dst & 7));
+	emit32(e, imm);
+}
+
+static void movzx8(Emitter *e, u8 dst, u8 src) {
+	rex(e, 0, dst, 0, src);
+	emit8(e, 0x0F);
+	emit8(e, 0xB6);
+	modrm(e, 3, dst, src);
+}
+
+static void movzx16(Emitter *e, u8 dst, u8 src) {
+	rex(e, 0, dst, 0, src);
+	emit8(e, 0x0F);
+	emit8(e, 0xB7);
+	modrm(e, 3, dst, src);
+}
+
+static void shift8(Emitter *e, u8 ext, u8 dst, u8 imm) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0xC0);
+	modrm(e, 3, ext, dst);
+	emit8(e, imm);
+}
+
+static void shift32(Emitter *e, u8 ext, u8 dst, u8 imm) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0xC1);
+	modrm(e, 3, ext, dst);
+	emit8(e, imm);
+}
+
+// rol, ror, rcl or rcr by 1
+static void rotate8(Emitter *e, u8 ext, u8 dst) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0xD0);
+	modrm(e, 3, ext, dst);
+}
+
+// not or neg
+static void unary8(Emitter *e, u8 ext, u8 dst) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0xF6);
+	modrm(e, 3, ext, dst);
+}
+
+static void test8_imm(Emitter *e, u8 dst, u8 imm) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0xF6);
+	modrm(e, 3, 0, dst);
+	emit8(e, imm);
+}
+
+static void setcc(Emitter *e, u8 cc, u8 dst) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0x0F);
+	emit8(e, 0x90 + cc);
+	modrm(e, 3, 0, dst);
+}
+
+// Copies bit 'bit' of dst to the carry of the host
+static void bt32_imm(Emitter *e, u8 dst, u8 bit) {
+	rex(e, 0, 0, 0, dst);
+	emit8(e, 0x0F);
+	emit8(e, 0xBA);
+	modrm(e, 3, 4, dst);
+	emit8(e, bit);
+}
+
+// mov dst8, [rsi + index]
+static void load8(Emitter *e, u8 dst, u8 index) {
+	rex(e, 0, dst, index, RSI);
+	emit8(e, 0x8A);
+	memory_operand(e, dst, index);
+}
+
+// movzx dst32, byte [rsi + index]
+static void loadzx8(Emitter *e, u8 dst, u8 index) {
+	rex(e, 0, dst, index, RSI);
+	emit8(e, 0x0F);
+	emit8(e, 0xB6);
+	memory_operand(e, dst, index);
+}
+
+// mov [rsi + index], src8
+static void store8(Emitter *e, u8 index, u8 src) {
+	rex(e, 0, src, index, RSI);
+	emit8(e, 0x88);
+	memory_operand(e, src, index);
+}
+
+// mov between a register and a field of the machine, 'op' being 0x8A to
+// load and 0x88 to store
+static void field8(Emitter *e, u8 op, u8 r, u8 offset) {
+	rex(e, 0, r, 0, RDI);
+	emit8(e, op);
+	modrm(e, 1, r, RDI);
+	emit8(e, offset);
+}
+
+static void field16(Emitter *e, u8 op, u8 r, u8 offset) {
+	emit8(e, 0x66);
+	field8(e, op + 1, r, offset);
+}
+
+// op r64, [rdi + offset]
+static void field64(Emitter *e, u8 op, u8 r, u8 offset) {
+	rex(e, 1, r, 0, RDI);
+	emit8(e, op);
+	modrm(e, 1, r, RDI);
+	emit8(e, offset);
+}
+
+// add qword [rdi + offset], imm32
+static void field64_add(Emitter *e, u8 offset, u32 imm) {
+	rex(e, 1, 0, 0, RDI);
+	emit8(e, 0x81);
+	modrm(e, 1, E_ADD, RDI);
+	emit8(e, offset);
+	emit32(e, imm);
+}
+
+static void set_pc(Emitter *e, u16 pc) {
+	emit8(e, 0x66);
+	emit8(e, 0xC7);
+	modrm(e, 1, 0, RDI);
+	emit8(e, offsetof(Machine, pc));
+	emit16(e, pc);
+}
+
+// Jumps, returning the address of their displacement to patch later
+static u8 *jump(Emitter *e) {
+	emit8(e, 0xE9);
+	emit32(e, 0);
+	return e->out - 4;
+}
+
+static u8 *jump_if(Emitter *e, u8 cc) {
+	emit8(e, 0x0F);
+	emit8(e, 0x80 + cc);
+	emit32(e, 0);
+	return e->out - 4;
+}
+
+static void patch(u8 *displacement, u8 *target) {
+	i32 relative = (i32)(target - (displacement + 4));
+	memcpy(displacement, &relative, 4);
+}
+
+// Adds the T-states and the instructions executed on the way to the
+// present exit to the counters of the machine
+static void count(Emitter *e) {
+	if(e->instructions == 0)
+		return;
+	field64_add(e, offsetof(Machine, cycles), e->cycles);
+	field64_add(e, offsetof(Machine, instructions), e->instructions);
+}
+
+static void leave(Emitter *e, u16 pc, u32 status) {
+	set_pc(e, pc);
+	mov32_imm(e, RAX, status);
+	patch(jump(e), e->epilogue);
+}
+
+// Returns to the interpreter, which continues from 'pc'
+static void exit_at(Emitter *e, u16 pc, u32 status) {
+	count(e);
+	leave(e, pc, status);
+}
+
+// Continues execution from 'pc' after the last instruction of the block.
+// If the block at 'pc' is compiled, the compiled blocks jump straight
+// to each other, keeping the registers in the host. Otherwise, the jump
+// goes to an exit to the interpreter until the block is compiled.
+static void exit_to(Emitter *e, u16 pc) {
+	Jit *jit = e->jit;
+	count(e);
+	if(pc == e->start)
+		patch(jump(e), e->loop);
+	else if(jit->entry[pc])
+		patch(jump(e), jit->arena + jit->entry[pc]);
+	else {
+		u8 *link = jump(e);
+		patch(link, e->out);
+		if(jit->pending_count < JIT_MAX_PENDING) {
+			jit->pending[jit->pending_count].jump = link - jit->arena;
+			jit->pending[jit->pending_count].to   = pc;
+			jit->pending_count++;
+		}
+		leave(e, pc, JIT_EXIT);
+	}
+}
+
+// Returns to the interpreter once the machine has reached the stop of
+// the core, for the end of the budget, an event or an interrupt, which
+// is checked on entering each block, so that the compiled blocks
+// looping through each other stop in time
+static void check_stop(Emitter *e) {
+	field64(e, 0x8B, RAX, offsetof(Machine, cycles));
+	field64(e, 0x3B, RAX, offsetof(Machine, stop_at));
+	u8 *go = jump_if(e, C_B);
+	leave(e, e->start, JIT_EXIT);
+	patch(go, e->out);
+}
+
+// Addresses
+// =========
+
+// r11 = (hi << 8) | lo
+static void address_pair(Emitter *e, u8 hi, u8 lo) {
+	movzx8(e, R11, host[hi]);
+	shift32(e, E_SHL, R11, 8);
+	alu8(e, X_OR, R11, host[lo]);
+}
+
+#define address_hl(e) address_pair(e, REG_H, REG_L)
+
+// r11 = (u16)(sp + offset)
+static void address_sp(Emitter *e, i8 offset) {
+	movzx16(e, R11, SP);
+	if(offset) {
+		alu32_imm(e, E_ADD, R11, offset);
+		movzx16(e, R11, R11);
+	}
+}
+
+// Writes
+// ======
+// Each write marks its page as written in the machine, and is followed
+// by a lookup of its address in the bitmap of decoded addresses, which
+// is accumulated in dl, so that an instruction writing to more than one
+// address still finishes before the block exits to have the blocks
+// flushed.
+
+static void write(Emitter *e, u8 src, bool first) {
+	store8(e, R11, src);
+	alu32(e, X_MOV, RCX, R11);
+	shift32(e, E_SHR, RCX, PAGE_BITS);
+	// mov byte [rdi + rcx + offsetof(Machine, written)], 1
+	rex(e, 0, 0, RCX, RDI);
+	emit8(e, 0xC6);
+	modrm(e, 2, 0, RSP);
+	emit8(e, ((RCX & 7) << 3) | (RDI & 7));
+	emit32(e, offsetof(Machine, written));
+	emit8(e, 1);
+	// mov rcx, [rsp]
+	emit8(e, 0x48);
+	emit8(e, 0x8B);
+	emit8(e, 0x0C);
+	emit8(e, 0x24);
+	// bt [rcx], r11d
+	rex(e, 0, R11, 0, RCX);
+	emit8(e, 0x0F);
+	emit8(e, 0xA3);
+	modrm(e, 0, R11, RCX);
+	if(first)
+		setcc(e, C_B, RDX);
+	else
+		alu8_imm(e, E_ADC, RDX, 0);
+}
+
+
+static void write_imm(Emitter *e, u8 imm, bool first) {
+	mov8_imm(e, RAX, imm);
+	write(e, RAX, first);
+}
+
+// Exits to flush the blocks if any of the writes of the present
+// instruction was to a decoded address, continuing from 'pc'
+static void end_writes(Emitter *e, u16 pc) {
+	test8_imm(e, RDX, 0xff);
+	e->flushes[e->flush_count].jump         = jump_if(e, C_NZ);
+	e->flushes[e->flush_count].pc           = pc;
+	e->flushes[e->flush_count].cycles       = e->cycles;
+	e->flushes[e->flush_count].instructions = e->instructions;
+	e->flush_count++;
+}
+
+// Flags
+// =====
+// lahf loads the sign, zero, auxiliary carry, parity and carry flags of
+// the host to ah, at the same bits as in the flags of the 8085. Only the
+// auxiliary carry is computed differently by the interpreter, which is
+// derived from the carry here.
+
+// al = the flags of the host
+static void host_flags(Emitter *e) {
+	emit8(e, 0x9F); // lahf
+	shift32(e, E_SHR, RAX, 8);
+}
+
+// Sets the auxiliary carry in al to the carry in al
+static void carry_to_aux(Emitter *e) {
+	alu8(e, X_MOV, RCX, RAX);
+	alu8_imm(e, E_AND, RCX, 1);
+	shift8(e, E_SHL, RCX, 4);
+	alu8(e, X_OR, RAX, RCX);
+}
+
+// Replaces the flags in 'mask' with al, which has no other bits set
+static void merge_flags(Emitter *e, u8 mask) {
+	alu8_imm(e, E_AND, F, ~mask);
+	alu8(e, X_OR, F, RAX);
+}
+
+// After an addition, with the auxiliary carry being the carry
+static void flags_add(Emitter *e) {
+	host_flags(e);
+	alu8_imm(e, E_AND, RAX, 0xC5);
+	carry_to_aux(e);
+	merge_flags(e, 0xD5);
+}
+
+// After the addition of the two's complement of the subtrahend, with the
+// carry being inverted, and the auxiliary carry not
+static void flags_sub(Emitter *e) {
+	host_flags(e);
+	alu8_imm(e, E_AND, RAX, 0xC5);
+	carry_to_aux(e);
+	alu8_imm(e, E_XOR, RAX, 1);
+	merge_flags(e, 0xD5);
+}
+
+static void flags_logical(Emitter *e, u8 aux) {
+	host_flags(e);
+	alu8_imm(e, E_AND, RAX, 0xC4);
+	if(aux)
+		alu8_imm(e, E_OR, RAX, 1 << FLG_A);
+	merge_flags(e, 0xD5);
+}
+
+// After adding 1, the auxiliary carry being set if the result is 0
+static void flags_inr(Emitter *e) {
+	host_flags(e);
+	alu8_imm(e, E_AND, RAX, 0xC4);
+	alu8(e, X_MOV, RCX, RAX);
+	shift8(e, E_SHR, RCX, FLG_Z - FLG_A);
+	alu8_imm(e, E_AND, RCX, 1 << FLG_A);
+	alu8(e, X_OR, RAX, RCX);
+	merge_flags(e, 0xD4);
+}
+
+// After subtracting 1, the auxiliary carry being set unless it borrowed
+static void flags_dcr(Emitter *e) {
+	host_flags(e);
+	alu8_imm(e, E_AND, RAX, 0xC5);
+	alu8_imm(e, E_XOR, RAX, 1);
+	carry_to_aux(e);
+	alu8_imm(e, E_AND, RAX, 0xD4);
+	merge_flags(e, 0xD4);
+}
+
+// Sets the carry of the machine to the carry of the host
+static void flags_carry(Emitter *e) {
+	setcc(e, C_B, RAX);
+	merge_flags(e, 1 << FLG_C);
+}
+
+// Arithmetic
+// ==========
+
+// Returns the host register holding the operand encoded as 'code'
+// in an opcode, loading it to r11 if it is in the memory
+static u8 operand(Emitter *e, u8 code) {
+	u8 reg = encoded[code];
+	if(reg != M)
+		return host[reg];
+	address_hl(e);
+	load8(e, R11, R11);
+	return R11;
+}
+
+static u8 operand_imm(Emitter *e, u8 imm) {
+	mov8_imm(e, R11, imm);
+	return R11;
+}
+
+// r11 = src
+static void to_r11(Emitter *e, u8 src) {
+	if(src != R11)
+		alu8(e, X_MOV, R11, src);
+}
+
+// Emits the arithmetic operation 'op' (in the order add, adc, sub,
+// sbb, ana, xra, ora, cmp, as encoded in the opcodes) of A with src
+static void arithmetic(Emitter *e, u8 op, u8 src, bool flags) {
+	switch(op) {
+		case 0: // add
+			alu8(e, X_ADD, A, src);
+			if(flags)
+				flags_add(e);
+			break;
+		case 1: // adc
+			// The auxiliary carry is the carry of adding the operand
+			// to A after the carry is added to it, while the carry
+			// is the carry of either addition
+			to_r11(e, src);
+			bt32_imm(e, F, FLG_C);
+			alu8_imm(e, E_ADC, R11, 0);
+			setcc(e, C_B, RDX);
+			alu8(e, X_ADD, A, R11);
+			if(flags) {
+				host_flags(e);
+				alu8_imm(e, E_AND, RAX, 0xC5);
+				carry_to_aux(e);
+				alu8(e, X_OR, RAX, RDX);
+				merge_flags(e, 0xD5);
+			}
+			break;
+		case 3: // sbb
+			to_r11(e, src);
+			bt32_imm(e, F, FLG_C);
+			alu8_imm(e, E_ADC, R11, 0);
+			src = R11;
+			// fallthrough
+		case 2: // sub
+			to_r11(e, src);
+			unary8(e, E_NEG, R11);
+			alu8(e, X_ADD, A, R11);
+			if(flags)
+				flags_sub(e);
+			break;
+		case 4: // ana
+			alu8(e, X_AND, A, src);
+			if(flags)
+				flags_logical(e, 1);
+			break;
+		case 5: // xra
+			alu8(e, X_XOR, A, src);
+			if(flags)
+				flags_logical(e, 0);
+			break;
+		case 6: // ora
+			alu8(e, X_OR, A, src);
+			if(flags)
+				flags_logical(e, 0);
+			break;
+		case 7: // cmp, which only changes the flags
+			if(!flags)
+				break;
+			// The flags of a subtraction, with the carry
+			// set only if A is smaller
+			alu8(e, X_MOV, RCX, src);
+			unary8(e, E_NEG, RCX);
+			alu8(e, X_ADD, RCX, A);
+			host_flags(e);
+			alu8_imm(e, E_AND, RAX, 0xC5);
+			carry_to_aux(e);
+			alu8_imm(e, E_AND, RAX, 0xD4);
+			alu8(e, X_CMP, A, src);
+			setcc(e, C_B, RCX);
+			alu8(e, X_OR, RAX, RCX);
+			merge_flags(e, 0xD5);
+			break;
+	}
+}
+
+// Flow of control
+// ===============
+
+// Flag tested by a condition encoded in an opcode, in the order
+// nz z nc c po pe p m
+static const u8 condition_flag[4] = {FLG_Z, FLG_C, FLG_P, FLG_S};
+
+// Emits a test of the condition, returning the jump to patch, which is
+// taken if the condition does not hold
+static u8 *unless(Emitter *e, u8 cc) {
+	test8_imm(e, F, 1 << condition_flag[cc >> 1]);
+	return jump_if(e, (cc & 1) ? C_Z : C_NZ);
+}
+
+static void call(Emitter *e, u16 to, u16 ret) {
+	address_sp(e, -1);
+	write_imm(e, ret >> 8, true);
+	address_sp(e, -2);
+	write_imm(e, ret & 0xff, false);
+	alu16_imm(e, E_SUB, SP, 2);
+	end_writes(e, to);
+	exit_to(e, to);
+}
+
+static void ret(Emitter *e) {
+	address_sp(e, 0);
+	loadzx8(e, RDX, R11);
+	address_sp(e, 1);
+	loadzx8(e, RCX, R11);
+	shift32(e, E_SHL, RCX, 8);
+	alu32(e, X_OR, RDX, RCX);
+	field16(e, 0x88, RDX, offsetof(Machine, pc));
+	alu16_imm(e, E_ADD, SP, 2);
+	count(e);
+	mov32_imm(e, RAX, JIT_EXIT);
+	patch(jump(e), e->epilogue);
+}
+
+// Analysis
+// ========
+
+static bool compiled(u8 opcode) {
+	switch(opcode) {
+		case 0x76: // HLT
+		case 0xDB: // IN
+		case 0xD3: // OUT
+		case 0x27: // DAA
+		case 0x20: // RIM
+		case 0x30: // SIM
+		case 0xF3: // DI
+		case 0xFB: // EI
+		// undefined
+		case 0x08:
+		case 0x10:
+		case 0x18:
+		case 0x28:
+		case 0x38:
+		case 0xCB:
+		case 0xD9:
+		case 0xDD:
+		case 0xED:
+		case 0xFD: return false;
+	}
+	return true;
+}
+
+static bool ends_block(u8 opcode) {
+	switch(opcode & 0xC7) {
+		case 0xC0: // Rcc
+		case 0xC2: // Jcc
+		case 0xC4: // Ccc
+		case 0xC7: // RST
+			return true;
+	}
+	return opcode == 0xC3 || opcode == 0xC9 || opcode == 0xCD ||
+	       opcode == 0xE9; // JMP RET CALL PCHL
+}
+
+static bool writes_memory(u8 opcode) {
+	if(opcode >= 0x70 && opcode <= 0x77) // MOV M, r
+		return true;
+	switch(opcode) {
+		case 0x02: // STAX B
+		case 0x12: // STAX D
+		case 0x22: // SHLD
+		case 0x32: // STA
+		case 0x34: // INR M
+		case 0x35: // DCR M
+		case 0x36: // MVI M
+		case 0xE3: // XTHL
+		case 0xC5: // PUSH
+		case 0xD5:
+		case 0xE5:
+		case 0xF5: return true;
+	}
+	// CALL and RST end the block anyway
+	return false;
+}
+
+// The flags read and fully overwritten by an instruction
+static void flags_used(u8 opcode, u8 *reads, u8 *writes) {
+	*reads = *writes = 0;
+	if((opcode >= 0x80 && opcode <= 0xBF) || (opcode & 0xC7) == 0xC6) {
+		*writes = 0xD5;
+		u8 op   = (opcode >> 3) & 7;
+		if(op == 1 || op == 3) // adc sbb
+			*reads = 1 << FLG_C;
+		return;
+	}
+	if(opcode < 0x40 && ((opcode & 7) == 4 || (opcode & 7) == 5)) { // INR DCR
+		*writes = 0xD4;
+		return;
+	}
+	switch(opcode & 0xC7) {
+		case 0xC0:
+		case 0xC2:
+		case 0xC4: *reads = 1 << condition_flag[(opcode >> 4) & 3]; return;
+	}
+	switch(opcode) {
+		case 0x07: // RLC
+		case 0x0F: // RRC
+		case 0x37: // STC
+			*writes = 1 << FLG_C;
+			return;
+		case 0x17: // RAL
+		case 0x1F: // RAR
+		case 0x3F: // CMC
+			*reads = *writes = 1 << FLG_C;
+			return;
+		case 0x09: // DAD, which only sets the carry
+		case 0x19:
+		case 0x29:
+		case 0x39: *reads = 1 << FLG_C; return;
+		case 0xF5: *reads = 0xff; return;  // PUSH PSW
+		case 0xF1: *writes = 0xff; return; // POP PSW
+	}
+}
+
+// Code generation
+// ===============
+
+// Emits the instruction at 'pc', 'live' being the flags which may be
+// read after it
+static void instruction(Emitter *e, const u8 *memory, u16 pc, u8 live) {
+	u8  opcode = memory[pc];
+	u8  imm    = memory[(u16)(pc + 1)];
+	u16 addr   = imm | (memory[(u16)(pc + 2)] << 8);
+	u16 next   = pc + opcode_length[opcode];
+	u8  reads, writes;
+	flags_used(opcode, &reads, &writes);
+	bool flags = (live & writes) != 0;
+	e->cycles += opcode_tstates[opcode];
+	e->instructions++;
+
+	if(opcode >= 0x40 && opcode <= 0x7F) { // MOV
+		u8 to = encoded[(opcode >> 3) & 7], from = encoded[opcode & 7];
+		if(to == M) {
+			address_hl(e);
+			write(e, host[from], true);
+			end_writes(e, next);
+		} else if(from == M) {
+			address_hl(e);
+			load8(e, host[to], R11);
+		} else if(to != from)
+			alu8(e, X_MOV, host[to], host[from]);
+		return;
+	}
+	if(opcode >= 0x80 && opcode <= 0xBF) {
+		if(opcode == 0xBE) { // CMP M
+			// The interpreter compares with the byte plus one, with
+			// the flags of a subtraction
+			if(!flags)
+				return;
+			operand(e, 6);
+			alu8_imm(e, E_ADD, R11, 1);
+			unary8(e, E_NEG, R11);
+			alu8(e, X_MOV, RCX, A);
+			alu8(e, X_ADD, RCX, R11);
+			flags_sub(e);
+			return;
+		}
+		arithmetic(e, (opcode >> 3) & 7, operand(e, opcode & 7), flags);
+		return;
+	}
+	if((opcode & 0xC7) == 0xC6) { // immediate arithmetic
+		arithmetic(e, (opcode >> 3) & 7, operand_imm(e, imm), flags);
+		return;
+	}
+	if(opcode < 0x40) {
+		u8 reg = encoded[(opcode >> 3) & 7];
+		// register pairs, with the stack pointer as 3
+		u8 pair = opcode >> 4, hi = 2 * pair + 1, lo = hi + 1;
+		switch(opcode & 7) {
+			case 4: // INR
+			case 5: // DCR
+				if(reg == M) {
+					address_hl(e);
+					load8(e, RDX, R11);
+				}
+				alu8_imm(e, (opcode & 1) ? E_SUB : E_ADD,
+				         reg == M ? RDX : host[reg], 1);
+				if(flags) {
+					if(opcode & 1)
+						flags_dcr(e);
+					else
+						flags_inr(e);
+				}
+				if(reg == M) {
+					write(e, RDX, true);
+					end_writes(e, next);
+				}
+				return;
+			case 6: // MVI
+				if(reg == M) {
+					address_hl(e);
+					write_imm(e, imm, true);
+					end_writes(e, next);
+				} else
+					mov8_imm(e, host[reg], imm);
+				return;
+		}
+		switch(opcode & 0xF) {
+			case 0x1: // LXI
+				if(pair == 3)
+					mov16_imm(e, SP, addr);
+				else {
+					mov8_imm(e, host[hi], addr >> 8);
+					mov8_imm(e, host[lo], addr & 0xff);
+				}
+				return;
+			case 0x3: // INX
+				if(pair == 3)
+					alu16_imm(e, E_ADD, SP, 1);
+				else {
+					alu8_imm(e, E_ADD, host[lo], 1);
+					alu8_imm(e, E_ADC, host[hi], 0);
+				}
+				return;
+			case 0xB: // DCX
+				if(pair == 3)
+					alu16_imm(e, E_SUB, SP, 1);
+				else {
+					alu8_imm(e, E_SUB, host[lo], 1);
+					// sbb
+					alu8_imm(e, 3, host[hi], 0);
+				}
+				return;
+			case 0x9: // DAD
+				if(pair == 3) {
+					alu32(e, X_MOV, RAX, SP);
+					alu32(e, X_MOV, RCX, SP);
+					shift32(e, E_SHR, RCX, 8);
+					alu8(e, X_ADD, L, RAX);
+					alu8(e, X_ADC, H, RCX);
+				} else {
+					alu8(e, X_ADD, L, host[lo]);
+					alu8(e, X_ADC, H, host[hi]);
+				}
+				if(live & (1 << FLG_C)) {
+					setcc(e, C_B, RAX);
+					alu8(e, X_OR, F, RAX);
+				}
+				return;
+		}
+		switch(opcode) {
+			case 0x00: return; // NOP
+			case 0x02:         // STAX B
+			case 0x12:         // STAX D
+				address_pair(e, hi, lo);
+				write(e, A, true);
+				end_writes(e, next);
+				return;
+			case 0x0A: // LDAX B
+			case 0x1A: // LDAX D
+				address_pair(e, hi, lo);
+				load8(e, A, R11);
+				return;
+			case 0x22: // SHLD
+				mov32_imm(e, R11, addr);
+				write(e, L, true);
+				mov32_imm(e, R11, (u16)(addr + 1));
+				write(e, H, false);
+				end_writes(e, next);
+				return;
+			case 0x2A: // LHLD
+				mov32_imm(e, R11, addr);
+				load8(e, L, R11);
+				mov32_imm(e, R11, (u16)(addr + 1));
+				load8(e, H, R11);
+				return;
+			case 0x32: // STA
+				mov32_imm(e, R11, addr);
+				write(e, A, true);
+				end_writes(e, next);
+				return;
+			case 0x3A: // LDA
+				mov32_imm(e, R11, addr);
+				load8(e, A, R11);
+				return;
+			case 0x07: // RLC
+			case 0x0F: // RRC
+			case 0x17: // RAL
+			case 0x1F: // RAR
+				if(opcode & 0x10)
+					bt32_imm(e, F, FLG_C);
+				rotate8(e, (opcode >> 3) & 3, A);
+				if(flags)
+					flags_carry(e);
+				return;
+			case 0x2F: unary8(e, E_NOT, A); return;          // CMA
+			case 0x37: alu8_imm(e, E_OR, F, 1); return;      // STC
+			case 0x3F: alu8_imm(e, E_XOR, F, 1); return;     // CMC
+		}
+	}
+
+	// 0xC0 - 0xFF
+	// The conditional instructions take longer when the condition holds
+	u8 cc = (opcode >> 3) & 7, taken;
+	switch(opcode & 0xC7) {
+		case 0xC2: { // Jcc
+			u8 *skip = unless(e, cc);
+			taken    = 10 - opcode_tstates[opcode];
+			e->cycles += taken;
+			exit_to(e, addr);
+			e->cycles -= taken;
+			patch(skip, e->out);
+			exit_to(e, next);
+			return;
+		}
+		case 0xC4: { // Ccc
+			u8 *skip = unless(e, cc);
+			taken    = 18 - opcode_tstates[opcode];
+			e->cycles += taken;
+			call(e, addr, next);
+			e->cycles -= taken;
+			patch(skip, e->out);
+			exit_to(e, next);
+			return;
+		}
+		case 0xC0: { // Rcc
+			u8 *skip = unless(e, cc);
+			taken    = 12 - opcode_tstates[opcode];
+			e->cycles += taken;
+			ret(e);
+			e->cycles -= taken;
+			patch(skip, e->out);
+			exit_to(e, next);
+			return;
+		}
+		case 0xC7: // RST
+			call(e, cc * 8, next);
+			return;
+	}
+	u8 pair = (opcode >> 4) & 3, hi = 2 * pair + 1, lo = hi + 1;
+	if(pair == 3)
+		hi = REG_A, lo = REG_FL;
+	switch(opcode) {
+		case 0xC1: // POP
+		case 0xD1:
+		case 0xE1:
+		case 0xF1:
+			address_sp(e, 0);
+			load8(e, host[lo], R11);
+			address_sp(e, 1);
+			load8(e, host[hi], R11);
+			alu16_imm(e, E_ADD, SP, 2);
+			return;
+		case 0xC5: // PUSH
+		case 0xD5:
+		case 0xE5:
+		case 0xF5:
+			address_sp(e, -1);
+			write(e, host[hi], true);
+			address_sp(e, -2);
+			write(e, host[lo], false);
+			alu16_imm(e, E_SUB, SP, 2);
+			end_writes(e, next);
+			return;
+		case 0xC3: exit_to(e, addr); return;  // JMP
+		case 0xCD: call(e, addr, next); return; // CALL
+		case 0xC9: ret(e); return;           // RET
+		case 0xE9:                            // PCHL
+			address_hl(e);
+			field16(e, 0x88, R11, offsetof(Machine, pc));
+			count(e);
+			mov32_imm(e, RAX, JIT_EXIT);
+			patch(jump(e), e->epilogue);
+			return;
+		case 0xE3: // XTHL
+			address_sp(e, 0);
+			load8(e, RAX, R11);
+			write(e, L, true);
+			alu8(e, X_MOV, L, RAX);
+			address_sp(e, 1);
+			load8(e, RAX, R11);
+			write(e, H, false);
+			alu8(e, X_MOV, H, RAX);
+			end_writes(e, next);
+			return;
+		case 0xEB: // XCHG
+			alu8(e, X_XCHG, H, host[REG_D]);
+			alu8(e, X_XCHG, L, host[REG_E]);
+			return;
+		case 0xF9: // SPHL
+			address_hl(e);
+			movzx16(e, SP, R11);
+			return;
+	}
+}
+
+static const u8 saved[] = {RBX, RBP, R12, R13, R14, R15};
+
+static void push(Emitter *e, u8 r) {
+	if(r >= R8)
+		emit8(e, 0x41);
+	emit8(e, 0x50 + (r & 7));
+}
+
+static void pop(Emitter *e, u8 r) {
+	if(r >= R8)
+		emit8(e, 0x41);
+	emit8(e, 0x58 + (r & 7));
+}
+
+static void epilogue(Emitter *e) {
+	e->epilogue = e->out;
+	for(u8 i = 0; i < 8; i++)
+		field8(e, 0x88, host[i], offsetof(Machine, registers) + i);
+	field16(e, 0x88, SP, offsetof(Machine, sp));
+	pop(e, RCX); // the bitmap
+	for(int i = sizeof(saved) - 1; i >= 0; i--) pop(e, saved[i]);
+	emit8(e, 0xC3);
+}
+
+static void prologue(Emitter *e) {
+	for(u8 i = 0; i < sizeof(saved); i++) push(e, saved[i]);
+	push(e, RDX);
+	for(u8 i = 0; i < 8; i++)
+		field8(e, 0x8A, host[i], offsetof(Machine, registers) + i);
+	field16(e, 0x8A, SP, offsetof(Machine, sp));
+}
+
+Jit *jit_new() {
+	u32 eax, ebx, ecx, edx;
+	// lahf is missing on some of the earliest x86-64 processors
+	if(!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) ||
+	   !(ecx & bit_LAHF_LM))
+		return NULL;
+	void *arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC,
+	                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(arena == MAP_FAILED)
+		return NULL;
+	Jit *jit   = (Jit *)calloc(1, sizeof(Jit));
+	jit->arena = (u8 *)arena;
+	return jit;
+}
+
+void jit_free(Jit *jit) {
+	munmap(jit->arena, JIT_ARENA_SIZE);
+	free(jit);
+}
+
+void jit_reset(Jit *jit) {
+	for(u16 i = 0; i < jit->compiled_count; i++)
+		jit->entry[jit->compiled[i]] = 0;
+	jit->compiled_count = 0;
+	jit->pending_count  = 0;
+	jit->used           = 0;
+}
+
+JitBlock jit_compile(Jit *jit, const u8 *memory, u16 start, u16 count) {
+	u16 pc[JIT_MAX_BLOCK + 1];
+	u8  live[JIT_MAX_BLOCK];
+	u16 n = 0;
+	pc[0] = start;
+	while(n < count && n < JIT_MAX_BLOCK && compiled(memory[pc[n]])) {
+		pc[n + 1] = pc[n] + opcode_length[memory[pc[n]]];
+		n++;
+	}
+	if(n == 0 || jit->compiled_count == JIT_MAX_COMPILED ||
+	   jit->used + n * JIT_MAX_INSTRUCTION + JIT_MAX_OVERHEAD > JIT_ARENA_SIZE)
+		return NULL;
+
+	// All the flags are needed after the last instruction, and after
+	// the ones which may exit to flush the blocks
+	u8 needed = 0xff;
+	for(int i = n - 1; i >= 0; i--) {
+		u8 reads, writes;
+		if(writes_memory(memory[pc[i]]))
+			needed = 0xff;
+		live[i] = needed;
+		flags_used(memory[pc[i]], &reads, &writes);
+		needed = (needed & ~writes) | reads;
+	}
+
+	if(mprotect(jit->arena, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE) != 0)
+		return NULL;
+	Emitter e;
+	e.jit         = jit;
+	e.out         = jit->arena + jit->used;
+	e.start        = start;
+	e.cycles       = 0;
+	e.instructions = 0;
+	e.flush_count  = 0;
+	epilogue(&e);
+	u8 *entry = e.out;
+	prologue(&e);
+	e.loop = e.out;
+	check_stop(&e);
+	for(u16 i = 0; i < n; i++) instruction(&e, memory, pc[i], live[i]);
+	if(!ends_block(memory[pc[n - 1]]))
+		exit_at(&e, pc[n], JIT_EXIT);
+	for(u8 i = 0; i < e.flush_count; i++) {
+		patch(e.flushes[i].jump, e.out);
+		e.cycles       = e.flushes[i].cycles;
+		e.instructions = e.flushes[i].instructions;
+		exit_at(&e, e.flushes[i].pc, JIT_FLUSH);
+	}
+	jit->used = e.out - jit->arena;
+
+	// Link the compiled blocks which exit to this one
+	jit->entry[start]                    = e.loop - jit->arena;
+	jit->compiled[jit->compiled_count++] = start;
+	for(u16 i = 0; i < jit->pending_count;) {
+		if(jit->pending[i].to == start) {
+			patch(jit->arena + jit->pending[i].jump, e.loop);
+			jit->pending[i] = jit->pending[--jit->pending_count];
+		} else
+			i++;
+	}
+
+	if(mprotect(jit->arena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC) != 0)
+		return NULL;
+	return (JitBlock)entry;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+#ifdef NEOVM_JIT
+
+// Returned by a compiled block, after which the interpreter continues
+// from the pc of the machine
+#define JIT_EXIT 0
+// Returned by a compiled block which wrote to an address some block was
+// decoded from, after which the decoded blocks must be flushed before
+// the interpreter continues from the pc of the machine
+#define JIT_FLUSH 1
+
+typedef struct Jit Jit;
+
+// A compiled block executes the instructions of the block starting from
+// the first one, keeping the registers of the machine in the registers
+// of the host, and goes on to the compiled blocks it exits to, until it
+// reaches an instruction which is left to the interpreter or a block
+// which is not compiled. It returns JIT_EXIT or JIT_FLUSH, with the pc
+// of the machine pointing to the next instruction. 'code' is the bitmap
+// of the addresses which are part of some decoded block.
+typedef u32 (*JitBlock)(Machine *m, u8 *memory, const u8 *code);
+
+// Returns NULL if the host does not support executing generated code
+Jit *jit_new();
+void jit_free(Jit *jit);
+// Drops all the compiled blocks
+void jit_reset(Jit *jit);
+// Compiles the block of 'count' instructions starting at 'start'. Only
+// a prefix of the block is compiled if it contains an instruction which
+// is left to the interpreter, and NULL is returned if the first one is
+// such an instruction, or the JIT has run out of space.
+JitBlock jit_compile(Jit *jit, const u8 *memory, u16 start, u16 count);
+
+#endif
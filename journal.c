@@ -0,0 +1,121 @@
+#include "journal.h"
+#include "display.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The most bytes one step writes, by an interrupt taken before it which
+// pushes the return address, and by a call, a push, shld or xthl
+#define MAX_WRITES 4
+
+// What one instruction changed, along with an interrupt taken before it
+typedef struct {
+	u8                registers[8]; // before it
+	struct LazyFlags  lazy;
+	struct Interrupts interrupts;
+	u16               pc;
+	u16               sp;
+	u64               cycles;
+	u8                write_count;
+	u16               addr[MAX_WRITES]; // the bytes it wrote
+	u8                old[MAX_WRITES];  // what they held before
+} Step;
+
+// The instructions are kept in a ring, the one being executed being at
+// 'head', so that it is recorded in place
+struct Journal {
+	Step *steps;
+	u32   capacity;
+	u32   head;
+	u32   count; // the instructions before 'head' which can be undone
+};
+
+void journal_set_size(Machine *m, u32 size) {
+	if(m->journal) {
+		free(m->journal->steps);
+		free(m->journal);
+		m->journal = NULL;
+		m->hooks &= ~HOOK_JOURNAL;
+	}
+	u32 capacity = size / sizeof(Step);
+	if(capacity < 2)
+		return;
+	struct Journal *j = (struct Journal *)calloc(1, sizeof(struct Journal));
+	j->steps    = (Step *)malloc(capacity * sizeof(Step));
+	j->capacity = capacity;
+	m->journal  = j;
+	m->hooks |= HOOK_JOURNAL;
+}
+
+void journal_clear(Machine *m) {
+	if(m->journal)
+		m->journal->count = 0;
+}
+
+u32 journal_length(const Machine *m) {
+	return m->journal ? m->journal->count : 0;
+}
+
+bool journal_step_back(Machine *m, u8 *memory) {
+	struct Journal *j = m->journal;
+	if(j == NULL || j->count == 0)
+		return false;
+	j->head = (j->head ? j->head : j->capacity) - 1;
+	j->count--;
+	Step *s = &j->steps[j->head];
+	for(u8 i = s->write_count; i-- > 0;) {
+		memory[s->addr[i]] = s->old[i];
+		machine_mark_written(m, s->addr[i], 1);
+	}
+	memcpy(m->registers, s->registers, sizeof(m->registers));
+	m->lazy       = s->lazy;
+	m->interrupts = s->interrupts;
+	m->pc         = s->pc;
+	m->sp         = s->sp;
+	m->cycles     = s->cycles;
+	m->instructions--;
+	m->isbroken = 1;
+	return true;
+}
+
+u32 journal_reverse_continue(Machine *m, u8 *memory) {
+	u32 count = 0;
+	while(journal_step_back(m, memory)) {
+		count++;
+		if(BREAKPOINT_AT(m, m->pc))
+			break;
+	}
+	return count;
+}
+
+void journal_begin(Machine *m) {
+	Step *s = &m->journal->steps[m->journal->head];
+	memcpy(s->registers, m->registers, sizeof(s->registers));
+	s->lazy        = m->lazy;
+	s->interrupts  = m->interrupts;
+	s->pc          = m->pc;
+	s->sp          = m->sp;
+	s->cycles      = m->cycles;
+	s->write_count = 0;
+}
+
+void journal_write(Machine *m, u16 addr, u8 old) {
+	Step *s = &m->journal->steps[m->journal->head];
+	// Stepping back would leave the memory wrong
+	if(s->write_count == MAX_WRITES) {
+		perr("[Internal error] The journal has no room for the write to "
+		     "0x%04x of the instruction at 0x%04x!\n",
+		     addr, s->pc);
+		abort();
+	}
+	s->addr[s->write_count] = addr;
+	s->old[s->write_count]  = old;
+	s->write_count++;
+}
+
+void journal_record(Machine *m) {
+	struct Journal *j = m->journal;
+	j->head           = j->head + 1 == j->capacity ? 0 : j->head + 1;
+	if(j->count < j->capacity - 1)
+		j->count++;
+	journal_begin(m);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// The journal keeps what each instruction the machine executes changes,
+// the registers and the interrupt state before it and the bytes it
+// overwrote, with those of an interrupt taken before it, in a ring of a
+// fixed size, so that the latest instructions can be undone one by one.
+// The machine runs in the debug mode while it keeps a journal.
+
+// Keeps a journal of 'size' bytes, dropping the one kept before, or
+// stops keeping any when 'size' is 0
+void journal_set_size(Machine *m, u32 size);
+// Forgets all the instructions in the journal
+void journal_clear(Machine *m);
+// The number of instructions which can be undone
+u32 journal_length(const Machine *m);
+// Undoes the last instruction, pausing the machine before it. Returns
+// false when the journal is empty. The memory is changed from outside
+// of run(), so the decoded blocks must be flushed before running again.
+bool journal_step_back(Machine *m, u8 *memory);
+// Undoes instructions until the machine is on a breakpoint or the
+// journal is empty, returning the number of instructions undone
+u32 journal_reverse_continue(Machine *m, u8 *memory);
+
+// Used by the cores
+void journal_begin(Machine *m);
+void journal_write(Machine *m, u16 addr, u8 old);
+void journal_record(Machine *m);
@@ -1,11 +1,17 @@
 #include "bytecode.h"
 #include "display.h"
+#include "event.h"
+#include "interrupt.h"
+#include "io.h"
 #include "vm.h"
+#include "watch.h"
+#include <string.h>
 
 #define GET_FLAG(x) ((m->registers[REG_FL] >> x) & 1)
 
 void machine_print(Machine *m) {
 	char regs[] = {'A', 'B', 'C', 'D', 'E', 'H', 'L'};
+	machine_sync_flags(m);
 	pgrn("\n[Registers]\t");
 	for(u8 i = 0; i < 7; i++) pcyn("%4c\t", regs[i], " ");
 
@@ -27,63 +33,141 @@ void machine_print(Machine *m) {
 
 	phblue("\n[PC] ", "0x%0x", m->pc);
 	phylw("\n[SP] ", "0x%0x", m->sp);
+	phcyn("\n[T-states] ", "%" Pu64 " in %" Pu64 " instructions", m->cycles,
+	      m->instructions);
 }
 
-bool machine_add_breakpoint(Machine *m, u16 addr) {
-	if(m->breakpoint_pointer == MAX_BREAKPOINT_COUNT)
-		return false;
-	for(u16 i = 0; i < m->breakpoint_pointer; i++) {
-		if(m->breakpoints[i] == addr)
-			return true;
-	}
-	m->breakpoints[m->breakpoint_pointer++] = addr;
-	return true;
+void machine_add_breakpoint(Machine *m, u16 addr) {
+	if(BREAKPOINT_AT(m, addr))
+		return;
+	m->breakpoints[addr >> 3] |= 1 << (addr & 7);
+	m->breakpoint_count++;
+	m->hooks |= HOOK_BREAKPOINT;
+}
+
+// Pauses the machine, showing it after what it wrote out
+static void pause_machine(Machine *m) {
+	m->isbroken = 1;
+	io_flush(m);
 }
 
 bool machine_on_breakpoint(Machine *m, u8 *memory, u8 step) {
+	if((m->hooks & HOOK_WATCH) && m->watch->caught) {
+		pause_machine(m);
+		watch_caught(m);
+		machine_print(m);
+		bytecode_disassemble(memory, m->pc);
+		return true;
+	}
 	if(step) {
-		m->isbroken = 1;
+		pause_machine(m);
 		phgrn("\n[step]", " Stepped on address 0x%x", m->pc);
 		machine_print(m);
 		bytecode_disassemble(memory, m->pc);
 		return true;
 	}
-	for(u16 i = 0; i < m->breakpoint_pointer; i++) {
-		if(m->breakpoints[i] == m->pc) {
-			m->isbroken = 1;
-			phgrn("\n[break]", " Breakpoint caught on address 0x%x",
-			      m->breakpoints[i]);
-			machine_print(m);
-			bytecode_disassemble(memory, m->breakpoints[i]);
-			return true;
-		}
+	if(BREAKPOINT_AT(m, m->pc)) {
+		pause_machine(m);
+		phgrn("\n[break]", " Breakpoint caught on address 0x%x", m->pc);
+		machine_print(m);
+		bytecode_disassemble(memory, m->pc);
+		return true;
 	}
 	return false;
 }
 
 bool machine_remove_breakpoint(Machine *m, u16 addr) {
-	for(u16 i = 0; i < m->breakpoint_pointer; i++) {
-		if(m->breakpoints[i] == addr) {
-			while(i < m->breakpoint_pointer - 1) {
-				m->breakpoints[i] = m->breakpoints[i + 1];
-				i++;
-			}
-			m->breakpoint_pointer--;
-			return true;
-		}
-	}
-	return false;
+	if(!BREAKPOINT_AT(m, addr))
+		return false;
+	m->breakpoints[addr >> 3] &= ~(1 << (addr & 7));
+	if(--m->breakpoint_count == 0)
+		m->hooks &= ~HOOK_BREAKPOINT;
+	return true;
 }
 
 void machine_reset_breakpoints(Machine *m) {
-	m->breakpoint_pointer = 0;
+	memset(m->breakpoints, 0, sizeof(m->breakpoints));
+	m->breakpoint_count = 0;
+	m->hooks &= ~HOOK_BREAKPOINT;
 }
 
 void machine_init(Machine *machine) {
 	machine->pc                 = 0;
 	machine->sp                 = 0xffff;
-	machine->breakpoint_pointer = 0;
+	machine->lazy.pending       = 0;
+	machine->cycles             = 0;
+	machine->instructions       = 0;
+	machine->cycle_limit        = u64_MAX;
+	machine->stop_at            = u64_MAX;
+	machine->hooks              = 0;
 	machine->isbroken           = 0;
 	machine->issilent           = 0;
-	machine->sleepfor.tv_nsec   = 0;
+	io_reset(machine);
+	interrupt_reset(machine);
+	machine->next_event = u64_MAX;
+	machine->events     = NULL;
+	machine_set_frequency(machine, 0);
+	machine->engine             = ENGINE_DEFAULT;
+	machine->cache              = NULL;
+	machine->snapshot           = NULL;
+	machine->journal            = NULL;
+	machine->trace              = NULL;
+	machine->profile            = NULL;
+	machine->callgraph          = NULL;
+	machine->watch              = NULL;
+	memset(machine->watch_pages, 0, sizeof(machine->watch_pages));
+	memset(machine->written, 0, sizeof(machine->written));
+	machine_reset_breakpoints(machine);
+}
+
+void machine_mark_written(Machine *m, u16 addr, u32 size) {
+	if(size == 0)
+		return;
+	u32 last = addr + size - 1;
+	if(last > 0xffff)
+		last = 0xffff;
+	memset(&m->written[addr >> PAGE_BITS], 1,
+	       (last >> PAGE_BITS) - (addr >> PAGE_BITS) + 1);
+}
+
+void machine_set_frequency(Machine *m, u32 hz) {
+	m->throttle.hz         = hz;
+	m->throttle.slice      = hz / THROTTLE_SLICES_PER_SECOND;
+	m->throttle.lead       = 0;
+	m->throttle.run_cycles = 0;
+	m->throttle.run_ns     = 0;
+	if(m->throttle.slice == 0)
+		m->throttle.slice = 1;
+}
+
+double machine_frequency(Machine *m) {
+	if(m->throttle.run_ns == 0)
+		return 0;
+	return m->throttle.run_cycles * 1000000000.0 / m->throttle.run_ns;
+}
+
+void machine_set_budget(Machine *m, u64 cycles) {
+	m->cycle_limit = cycles ? m->cycles + cycles : u64_MAX;
+}
+
+const char *machine_engine_name(u8 engine) {
+	switch(engine) {
+		case ENGINE_SWITCH: return "switch";
+#ifdef NEOVM_THREADED
+		case ENGINE_THREADED: return "threaded";
+		case ENGINE_DEFAULT:
+		case ENGINE_BLOCK: return "block";
+#ifdef NEOVM_JIT
+		case ENGINE_JIT: return "jit";
+#else
+		case ENGINE_JIT: return "block";
+#endif
+#else
+		case ENGINE_DEFAULT:
+		case ENGINE_THREADED:
+		case ENGINE_BLOCK:
+		case ENGINE_JIT: return "switch";
+#endif
+	}
+	return "unknown";
 }
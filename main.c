@@ -1,24 +1,35 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "Cell/cell.h"
 #include "asm.h"
 #include "bytecode.h"
 #include "calibrate.h"
+#include "callgraph.h"
 #include "compiler.h"
 #include "cosmetic.h"
 #include "display.h"
 #include "dump.h"
+#include "interrupt.h"
+#include "journal.h"
+#include "manifest.h"
+#include "profile.h"
+#include "snapshot.h"
 #include "test.h"
+#include "trace.h"
 #include "util.h"
 #include "vm.h"
+#include "watch.h"
 
 // State
-static Machine machine;
-static u8      memory[0xffff]  = {0};
-static u16     memory_pointer  = 0;
-static u8      no_usage        = 0;
-static u8      load_successful = 0;
+static Machine  machine;
+static u8       memory[0xffff]  = {0};
+static u16      memory_pointer  = 0;
+static u8       no_usage        = 0;
+static u8       load_successful = 0;
+static Snapshot snapshot;
+static u8       snapshot_saved = 0;
 
 static void usage(const char *usg) {
 	if(no_usage)
@@ -26,6 +37,15 @@ static void usage(const char *usg) {
 	phgrn("\n[Usage] ", "%s", usg);
 }
 
+// Shows how close to its frequency a throttled machine has run
+static void show_frequency(const char *header) {
+	if(machine.throttle.hz == 0)
+		return;
+	phgrn(header, " Running at %lf mHz on average, for a target of %lf mHz",
+	      machine_frequency(&machine) / 1000000,
+	      machine.throttle.hz / 1000000.0);
+}
+
 void exec_action(CellStringParts parts, Cell *cell) {
 	(void)cell;
 	u16 from;
@@ -34,9 +54,11 @@ void exec_action(CellStringParts parts, Cell *cell) {
 			phgrn("\n[exec]", " Executing from 0x%x ", from);
 			fflush(stdout);
 			machine.pc = from;
+			machine_flush_cache(&machine);
 			run(&machine, &memory[0], 0);
 			if(!machine.isbroken) {
 				phgrn("\n[exec]", " Execution completed!");
+				show_frequency("\n[exec]");
 			}
 			return;
 		}
@@ -84,6 +106,7 @@ void set_action(CellStringParts parts, Cell *cell) {
 				if(parse_hex_byte(parts.parts[i], &val)) {
 					u8 old       = memory[addr];
 					memory[addr] = val;
+					machine_mark_written(&machine, addr, 1);
 					pgrn("\n[set]");
 					pred(" 0x%04x: ", addr);
 					printf("0x%02x -> 0x%02x", old, memory[addr]);
@@ -112,6 +135,8 @@ void load_action(CellStringParts parts, Cell *cell) {
 				compiler_reset();
 				load_successful = 0;
 				stat = compile(source, &memory[0], 0xffff, &memory_pointer);
+				machine_mark_written(&machine, addr,
+				                     (u16)(memory_pointer - addr));
 				switch(stat) {
 					case LABEL_FULL:
 						perr("Number of used labels exceeded the maximum "
@@ -185,13 +210,8 @@ void brkadd_action(CellStringParts parts, Cell *cell) {
 	u16 addr;
 	if(parts.part_count > 1) {
 		if(parse_hex_16(parts.parts[1], &addr)) {
-			if(!machine_add_breakpoint(&machine, addr)) {
-				perr("Maximum number(%d) of breakpoints already set!",
-				     MAX_BREAKPOINT_COUNT);
-			} else {
-				phgrn("\n[break add]", " Breakpoint added at address 0x%x",
-				      addr);
-			}
+			machine_add_breakpoint(&machine, addr);
+			phgrn("\n[break add]", " Breakpoint added at address 0x%x", addr);
 			return;
 		}
 	} else
@@ -204,9 +224,11 @@ void cont_action(CellStringParts cp, Cell *cell) {
 	(void)cell;
 	if(machine.isbroken) {
 		machine.isbroken = 0;
+		machine_flush_cache(&machine);
 		run(&machine, &memory[0], 0);
 		if(!machine.isbroken) {
 			phgrn("\n[continue]", " Execution completed!");
+			show_frequency("\n[continue]");
 		}
 	} else {
 		perr("No program is running! Unable to continue!");
@@ -217,6 +239,7 @@ void step_action(CellStringParts cp, Cell *cell) {
 	(void)cp;
 	(void)cell;
 	if(machine.isbroken) {
+		machine_flush_cache(&machine);
 		run(&machine, &memory[0], 1);
 		if(!machine.isbroken) {
 			phgrn("\n[step]", " Execution completed!");
@@ -226,15 +249,251 @@ void step_action(CellStringParts cp, Cell *cell) {
 	}
 }
 
+// Shows where the machine has been stepped back to
+static void show_stepped_back(const char *header, u32 count) {
+	phgrn(header, " Stepped back over %" Pu32 " instructions to 0x%x", count,
+	      machine.pc);
+	machine_print(&machine);
+	bytecode_disassemble(&memory[0], machine.pc);
+}
+
+void stepback_action(CellStringParts cp, Cell *cell) {
+	(void)cell;
+	long count = 1;
+	if(cp.part_count > 1) {
+		char *end;
+		count = strtol(cp.parts[1], &end, 10);
+		if(*end != 0 || count <= 0) {
+			perr("Wrong count '%s'!", cp.parts[1]);
+			usage("step back [<number of instructions>]");
+			return;
+		}
+	}
+	if(journal_length(&machine) == 0) {
+		perr("Nothing to step back over! See 'help journal'");
+		return;
+	}
+	u32 done = 0;
+	while(done < count && journal_step_back(&machine, &memory[0])) done++;
+	show_stepped_back("\n[step back]", done);
+}
+
+void contback_action(CellStringParts cp, Cell *cell) {
+	(void)cp;
+	(void)cell;
+	if(journal_length(&machine) == 0) {
+		perr("Nothing to continue back over! See 'help journal'");
+		return;
+	}
+	u32 done = journal_reverse_continue(&machine, &memory[0]);
+	show_stepped_back("\n[continue back]", done);
+	if(!BREAKPOINT_AT(&machine, machine.pc))
+		pinfo("Reached the start of the journal");
+}
+
+void journal_action(CellStringParts csp, Cell *c) {
+	(void)c;
+	if(csp.part_count > 1) {
+		char *end;
+		long  kib = strtol(csp.parts[1], &end, 10);
+		if(strcmp(csp.parts[1], "off") == 0)
+			journal_set_size(&machine, 0);
+		else if(*end == 0 && kib > 0 && kib <= 1024 * 1024)
+			journal_set_size(&machine, kib * 1024);
+		else {
+			perr("Wrong size '%s'!", csp.parts[1]);
+			usage("journal [<size in KiB> | off]");
+			return;
+		}
+	}
+	if(machine.journal == NULL)
+		phgrn("\n[journal]", " Not keeping a journal");
+	else
+		phgrn("\n[journal]", " %" Pu32 " instructions can be stepped back",
+		      journal_length(&machine));
+}
+
+void trace_action(CellStringParts csp, Cell *c) {
+	(void)c;
+	if(csp.part_count > 1) {
+		u64  length  = trace_length(&machine);
+		bool tracing = machine.trace != NULL;
+		if(!trace_stop(&machine))
+			perr("Unable to write all of the trace!");
+		else if(tracing)
+			phgrn("\n[trace]", " Wrote %" Pu64 " instructions", length);
+		if(strcmp(csp.parts[1], "off") == 0)
+			return;
+		if(!trace_start(&machine, &memory[0], sizeof(memory),
+		                csp.parts[1])) {
+			perr("Unable to write to '%s'!", csp.parts[1]);
+			return;
+		}
+	}
+	if(machine.trace == NULL)
+		phgrn("\n[trace]", " Not tracing the machine");
+	else
+		phgrn("\n[trace]", " %" Pu64 " instructions written so far",
+		      trace_length(&machine));
+}
+
+// The hot addresses shown by 'profile' when not told how many
+#define PROFILE_SHOWN 10
+
+void profile_action(CellStringParts csp, Cell *c) {
+	(void)c;
+	u32 count = PROFILE_SHOWN;
+	if(csp.part_count > 1) {
+		char *end;
+		long  n = strtol(csp.parts[1], &end, 10);
+		if(strcmp(csp.parts[1], "on") == 0) {
+			profile_set(&machine, true);
+			phgrn("\n[profile]", " Profiling the machine");
+			return;
+		} else if(strcmp(csp.parts[1], "off") == 0) {
+			profile_set(&machine, false);
+			phgrn("\n[profile]", " Stopped profiling the machine");
+			return;
+		} else if(strcmp(csp.parts[1], "clear") == 0) {
+			profile_clear(&machine);
+			phgrn("\n[profile]", " Cleared the profile");
+			return;
+		} else if(*end == 0 && n > 0 && n <= 0x10000)
+			count = n;
+		else {
+			perr("Wrong argument '%s'!", csp.parts[1]);
+			usage("profile [on | off | clear | <number of addresses>]");
+			return;
+		}
+	}
+	const Profile *p = machine.profile;
+	if(p == NULL) {
+		phgrn("\n[profile]", " Not profiling the machine");
+		return;
+	}
+	if(p->total == 0) {
+		phgrn("\n[profile]",
+		      " Nothing executed since the profile was started or cleared");
+		return;
+	}
+	u16 *addresses = (u16 *)malloc(count * sizeof(u16));
+	u32  found     = profile_hottest(&machine, addresses, count);
+	u64  shown     = 0;
+	phgrn("\n[profile]",
+	      " %" Pu64 " T-states in all. Executions, T-states, share and"
+	      " cumulative share of the hottest %" Pu32 " addresses :",
+	      p->total, found);
+	for(u32 i = 0; i < found; i++) {
+		u16 addr = addresses[i];
+		shown += p->tstates[addr];
+		bytecode_disassemble(&memory[0], addr);
+		printf(" %10" Pu64 " %12" Pu64 " %6.2lf%% %6.2lf%%",
+		       p->executions[addr], p->tstates[addr],
+		       p->tstates[addr] * 100.0 / p->total, shown * 100.0 / p->total);
+	}
+	free(addresses);
+}
+
+// The subroutines shown by 'calls'
+#define CALLS_SHOWN 10
+
+void calls_action(CellStringParts csp, Cell *c) {
+	(void)c;
+	if(csp.part_count > 1) {
+		if(strcmp(csp.parts[1], "on") == 0) {
+			callgraph_set(&machine, true);
+			phgrn("\n[calls]", " Keeping the call graph of the machine");
+		} else if(strcmp(csp.parts[1], "off") == 0) {
+			callgraph_set(&machine, false);
+			phgrn("\n[calls]", " Stopped keeping the call graph");
+		} else if(strcmp(csp.parts[1], "clear") == 0) {
+			callgraph_clear(&machine);
+			phgrn("\n[calls]", " Cleared the call graph");
+		} else if(machine.callgraph == NULL)
+			phgrn("\n[calls]", " Not keeping the call graph of the machine");
+		else if(!callgraph_write(&machine, csp.parts[1]))
+			perr("Unable to write to '%s'!", csp.parts[1]);
+		else
+			phgrn("\n[calls]", " Wrote the collapsed stacks to '%s'",
+			      csp.parts[1]);
+		return;
+	}
+	const CallGraph *g = machine.callgraph;
+	if(g == NULL) {
+		phgrn("\n[calls]", " Not keeping the call graph of the machine");
+		return;
+	}
+	u16 entries[CALLS_SHOWN];
+	u32 found = callgraph_hottest(&machine, entries, CALLS_SHOWN);
+	if(found == 0) {
+		phgrn("\n[calls]",
+		      " No subroutine called since the call graph was started or"
+		      " cleared");
+		return;
+	}
+	phgrn("\n[calls]",
+	      " %" Pu64 " T-states in all. Calls, T-states with and without the"
+	      " subroutines called, of the slowest %" Pu32 " :",
+	      g->tstates, found);
+	for(u32 i = 0; i < found; i++) {
+		u16 entry     = entries[i];
+		u64 inclusive = callgraph_inclusive(&machine, entry);
+		printf("\n0x%04x %10" Pu64 " %12" Pu64 " %6.2lf%% %12" Pu64
+		       " %6.2lf%%",
+		       entry, g->calls[entry], inclusive,
+		       inclusive * 100.0 / g->tstates, g->exclusive[entry],
+		       g->exclusive[entry] * 100.0 / g->tstates);
+	}
+}
+
+// The interrupts by the name 'interrupt' takes, in the order of the
+// INTERRUPT_* bits
+static const char *interrupt_names[] = {"5.5", "6.5", "7.5", "trap"};
+
+void interrupt_action(CellStringParts csp, Cell *c) {
+	(void)c;
+	if(csp.part_count > 2) {
+		perr("Wrong arguments!");
+		usage("interrupt [trap | 7.5 | 6.5 | 5.5]");
+		return;
+	}
+	if(csp.part_count == 2) {
+		for(u8 i = 0; i < 4; i++) {
+			if(strcmp(csp.parts[1], interrupt_names[i]) != 0)
+				continue;
+			interrupt_raise(&machine, 1 << i);
+			phgrn("\n[interrupt]", " Raised %s%s", i < 3 ? "RST " : "TRAP",
+			      i < 3 ? interrupt_names[i] : "");
+			return;
+		}
+		perr("No such interrupt '%s'!", csp.parts[1]);
+		usage("interrupt [trap | 7.5 | 6.5 | 5.5]");
+		return;
+	}
+	const struct Interrupts *in = &machine.interrupts;
+	phgrn("\n[interrupt]", " %s", in->enabled ? "Enabled" : "Disabled");
+	printf(", masked :");
+	for(u8 i = 0; i < 3; i++)
+		if(in->mask & (1 << i))
+			printf(" %s", interrupt_names[i]);
+	printf(", pending :");
+	for(u8 i = 0; i < 4; i++)
+		if(in->pending & (1 << i))
+			printf(" %s", interrupt_names[i]);
+}
+
 void brkview_action(CellStringParts cp, Cell *cell) {
 	(void)cell;
 	(void)cp;
-	if(machine.breakpoint_pointer == 0)
+	if(machine.breakpoint_count == 0)
 		pinfo("No breakpoints attached!");
 	else {
-		for(u16 i = 0; i < machine.breakpoint_pointer; i++) {
-			pylw("\n[Breakpoint %" Pu16 "]", i);
-			printf(" 0x%x", machine.breakpoints[i]);
+		u32 i = 0;
+		for(u32 addr = 0; addr <= 0xffff; addr++) {
+			if(BREAKPOINT_AT(&machine, addr)) {
+				pylw("\n[Breakpoint %" Pu32 "]", i++);
+				printf(" 0x%x", addr);
+			}
 		}
 	}
 }
@@ -244,7 +503,7 @@ void brkrm_action(CellStringParts cp, Cell *cell) {
 	u16 addr;
 	if(cp.part_count > 1) {
 		if(parse_hex_16(cp.parts[1], &addr)) {
-			if(machine.breakpoint_pointer == 0) {
+			if(machine.breakpoint_count == 0) {
 				pwarn("No breakpoints attached!");
 			} else if(!machine_remove_breakpoint(&machine, addr)) {
 				perr("No such breakpoint found!");
@@ -259,9 +518,158 @@ void brkrm_action(CellStringParts cp, Cell *cell) {
 	usage("break remove <16-bit address>");
 }
 
+void watch_action(CellStringParts parts, Cell *cell) {
+	(void)cell;
+	(void)parts;
+	perr("Wrong arguments");
+	pinfo("See 'help watch'");
+}
+
+// Reads the '<from> [<to>] [r | w | rw]' of 'watch add' and 'watch
+// remove'. Both kinds are watched when none is given.
+static bool parse_watch(CellStringParts cp, u16 *from, u16 *to, u8 *kinds) {
+	if(cp.part_count < 2 || cp.part_count > 4 ||
+	   !parse_hex_16(cp.parts[1], from))
+		return false;
+	*to    = *from;
+	*kinds = WATCH_READ | WATCH_WRITE;
+	int i  = 2;
+	if(i < cp.part_count && !strchr("rw", cp.parts[i][0])) {
+		if(!parse_hex_16(cp.parts[i++], to) || *to < *from)
+			return false;
+	}
+	if(i < cp.part_count) {
+		if(strcmp(cp.parts[i], "r") == 0)
+			*kinds = WATCH_READ;
+		else if(strcmp(cp.parts[i], "w") == 0)
+			*kinds = WATCH_WRITE;
+		else if(strcmp(cp.parts[i], "rw") != 0)
+			return false;
+		i++;
+	}
+	return i == cp.part_count;
+}
+
+static const char *watch_kind_names[] = {"", "read", "write", "read/write"};
+
+void watchadd_action(CellStringParts cp, Cell *cell) {
+	(void)cell;
+	u16 from, to;
+	u8  kinds;
+	if(!parse_watch(cp, &from, &to, &kinds)) {
+		perr("Wrong arguments!");
+		usage("watch add <from> [<to>] [r | w | rw]");
+		return;
+	}
+	watch_add(&machine, from, to, kinds);
+	phgrn("\n[watch add]", " Watching 0x%x to 0x%x for %s", from, to,
+	      watch_kind_names[kinds]);
+}
+
+void watchrm_action(CellStringParts cp, Cell *cell) {
+	(void)cell;
+	u16 from, to;
+	u8  kinds;
+	if(!parse_watch(cp, &from, &to, &kinds)) {
+		perr("Wrong arguments!");
+		usage("watch remove <from> [<to>] [r | w | rw]");
+		return;
+	}
+	u32 removed = watch_remove(&machine, from, to, kinds);
+	if(removed == 0)
+		perr("No such watchpoint found!");
+	else
+		phgrn("\n[watch remove]",
+		      " Stopped watching %" Pu32 " addresses for %s", removed,
+		      watch_kind_names[kinds]);
+}
+
+void watchview_action(CellStringParts cp, Cell *cell) {
+	(void)cell;
+	(void)cp;
+	if(machine.watch == NULL) {
+		pinfo("No watchpoints attached!");
+		return;
+	}
+	// Each run of addresses watched for the same kinds is shown once
+	u32 i = 0;
+	for(u32 addr = 0; addr <= 0xffff;) {
+		u8  kinds = watch_kinds(&machine, addr);
+		u32 end   = addr;
+		while(end < 0xffff && watch_kinds(&machine, end + 1) == kinds) end++;
+		if(kinds) {
+			pylw("\n[Watchpoint %" Pu32 "]", i++);
+			printf(" 0x%x to 0x%x for %s", addr, end, watch_kind_names[kinds]);
+		}
+		addr = end + 1;
+	}
+}
+
+void snap_action(CellStringParts parts, Cell *cell) {
+	(void)cell;
+	(void)parts;
+	perr("Wrong arguments");
+	pinfo("See 'help snapshot'");
+}
+
+void snapsave_action(CellStringParts parts, Cell *cell) {
+	(void)cell;
+	(void)parts;
+	snapshot_save(&snapshot, &machine, &memory[0], sizeof(memory));
+	snapshot_saved = 1;
+	phgrn("\n[snapshot save]", " Saved the machine at 0x%x", machine.pc);
+}
+
+void snaprestore_action(CellStringParts parts, Cell *cell) {
+	(void)cell;
+	(void)parts;
+	if(!snapshot_saved) {
+		perr("No snapshot saved! Unable to restore!");
+		return;
+	}
+	snapshot_restore(&snapshot, &machine, &memory[0]);
+	phgrn("\n[snapshot restore]", " Restored the machine at 0x%x",
+	      machine.pc);
+}
+
 void calb_action(CellStringParts csp, Cell *c) {
-	(void)c, (void)csp;
-	calibrate(&machine);
+	(void)c;
+	u32 hz = MACHINE_FREQ;
+	if(csp.part_count > 1) {
+		char * end;
+		double mhz = strtod(csp.parts[1], &end);
+		if(strcmp(csp.parts[1], "off") == 0)
+			hz = 0;
+		else if(*end == 0 && mhz > 0 && mhz < 4000)
+			hz = mhz * 1000000;
+		else {
+			perr("Wrong frequency '%s'!", csp.parts[1]);
+			usage("calibrate [<frequency in MHz> | off]");
+			return;
+		}
+	}
+	calibrate(&machine, hz);
+}
+
+void engine_action(CellStringParts parts, Cell *cell) {
+	(void)cell;
+	if(parts.part_count > 1) {
+		if(strcmp(parts.parts[1], "switch") == 0)
+			machine.engine = ENGINE_SWITCH;
+		else if(strcmp(parts.parts[1], "threaded") == 0)
+			machine.engine = ENGINE_THREADED;
+		else if(strcmp(parts.parts[1], "block") == 0)
+			machine.engine = ENGINE_BLOCK;
+		else if(strcmp(parts.parts[1], "jit") == 0)
+			machine.engine = ENGINE_JIT;
+		else {
+			perr("No such engine '%s'!", parts.parts[1]);
+			usage("engine [switch | threaded | block | jit]");
+			return;
+		}
+	}
+	phgrn("\n[engine]", " Executing using the %s engine",
+	      machine_engine_name(machine.engine));
 }
 
 void exit_action(CellStringParts parts, Cell *cell) {
@@ -341,8 +749,8 @@ static const char *longhelp[] = {
         "\ninstruction and then halt again, use 'step'."
         "\nThis will only work if the machine was halted on a breakpoint before."
         "\n" husage(step),
-    "Use 'break view' to show all the attached breakpoints, sorted in the order of"
-        "\ninsertion."
+    "Use 'break view' to show all the attached breakpoints, sorted by their"
+        "\naddresses."
         "\n" husage(break) "view",
     "To add a breakpoint at an address, i.e. to halt the machine when the program"
         "\ncounter reaches a particular address, use 'break add' like the following : "
@@ -355,18 +763,115 @@ static const char *longhelp[] = {
         "\nor a breakpoint has occurred (" hkw(continue) ")."
         "\nAll other keywords of the shell will also remain fully valid at that state and"
         "\ntogether will constitute a powerful and robust debugging solution for the system."
-        "\nIf you add more than one breakpoints at the same address, only the first will"
-        "\nremain available.",
+        "\nThere is no limit on the number of breakpoints, and adding one more than once"
+        "\nat the same address has no effect.",
     "To remove a previously attached breakpoint by its address, use 'break remove'."
         "\n" husage(break) "remove <address>"
         "\nIf <address> was not previously attached as a breakpoint, an error message"
         "\nwill be shown.",
     "The host machine that The8085 is being executed on is way more powerful and fast"
         "\nthan an original 8085 chip. To manually slow down the execution of the virtual"
-        "\nmachine, you can use 'calibrate', which will try to bound the execution to"
-        "\n~3MHz. It is not perfect yet, and the only way to reset back to the original"
-        "\nspeed of the host machine is by exit and reenter for now, so use with caution."
-        "\n" husage(calibrate),
+        "\nmachine, you can use 'calibrate', which will bound the execution to ~3MHz, or"
+        "\nto the frequency in MHz given to it. The machine keeps measuring the wall time"
+        "\nit takes as it runs, and shows the frequency it has achieved after each run."
+        "\nUse 'calibrate off' to reset back to the original speed of the host machine."
+        "\n" husage(calibrate) "[<frequency in MHz> | off]",
+    "The8085 can execute the instructions using different engines. Use 'engine'"
+        "\nwithout any arguments to see the engine presently in use, or specify the"
+        "\nname of an engine to switch to it."
+        "\n1. switch   : Dispatches each opcode using a switch. It is portable, and"
+        "\n              always available."
+        "\n2. threaded : Jumps directly from one opcode handler to the next, and is"
+        "\n              considerably faster. It needs a compiler with computed goto"
+        "\n              support."
+        "\n3. block    : Decodes each basic block of the program only once, and runs"
+        "\n              it from the decoded form afterwards. It is the fastest, and"
+        "\n              the default when computed goto is available."
+        "\n4. jit      : Runs like the block engine, but compiles the blocks which"
+        "\n              are executed often to x86-64 code. Breakpoints, stepping"
+        "\n              and calibration still work, as the compiled blocks are"
+        "\n              not used while any of them is in effect. Only available"
+        "\n              on x86-64."
+        "\n" husage(engine) "threaded",
+    "'snapshot' saves the registers of the machine and the contents of the memory,"
+        "\nto bring them back later, such as to run a program again from the point it"
+        "\nwas saved at. Use the subcommands shown below. For more information on a"
+        "\nparticular subcommand, type : "
+        "\n" hcode(help) "snapshot <subcommand>",
+    "Use 'snapshot save' to save the machine and the memory as they are, replacing"
+        "\nthe snapshot saved before, if any. Breakpoints, the engine and the frequency"
+        "\nare not saved."
+        "\n" husage(snapshot) "save",
+    "Use 'snapshot restore' to bring the machine and the memory back to the last"
+        "\nsnapshot saved. If the machine was paused on a breakpoint when it was saved,"
+        "\nit can be continued or stepped again from there. Only the parts of the memory"
+        "\nwritten since are copied back, so this is instant."
+        "\n" husage(snapshot) "restore",
+    "While the machine keeps a journal, it records the registers before each instruction"
+        "\nit executes and the bytes the instruction overwrites, so that the instructions"
+        "\ncan be undone later with " hkw(step) " back and " hkw(continue) " back. The journal"
+        "\nhas a fixed size, given in KiB, and only keeps the latest instructions which fit"
+        "\nin it, at about 20 bytes each. The machine runs slower while it keeps a journal,"
+        "\nlike it does with breakpoints, and the8085_bench shows by how much."
+        "\nUse 'journal' without any arguments to see how far the machine can be stepped"
+        "\nback, and 'journal off' to stop keeping one."
+        "\n" husage(journal) "[<size in KiB> | off]",
+    "Use 'step back' to undo the last instruction executed, or the given number of"
+        "\nthem, and pause the machine before it, to " hkw(step) " or " hkw(continue) " again from"
+        "\nthere. It needs a " hkw(journal) "."
+        "\n" husage(step) "back [<number of instructions>]",
+    "Use 'continue back' to undo the instructions executed until the machine is on a"
+        "\nbreakpoint again, or the journal runs out. It needs a " hkw(journal) "."
+        "\n" husage(continue) "back",
+    "While the machine is traced, every instruction it executes is written to the given"
+        "\nfile, with the registers and the memory it changed and the T-states it took, in a"
+        "\ncompact binary form which the8085_tracedump prints back. The trace starts with the"
+        "\nmemory as it is now, so the changes made to the memory with the commands are not in"
+        "\nit. The machine runs slower while it is traced, like it does with breakpoints."
+        "\nUse 'trace' without any arguments to see how many instructions have been written,"
+        "\nand 'trace off' to stop tracing and finish writing the file."
+        "\n" husage(trace) "[<file> | off]",
+    "While the machine is profiled, it counts how many times the instruction at each"
+        "\naddress is executed, and the T-states it takes. Use 'profile on' to start, and"
+        "\n'profile' to see the hottest addresses, 10 of them or the given number, with"
+        "\ntheir disassembly, the share of all the T-states each took and the share taken"
+        "\nby it and the ones above it. The profile sums up all the runs since it was"
+        "\nstarted or cleared with 'profile clear'. The machine runs slower while it is"
+        "\nprofiled, like it does with breakpoints."
+        "\n" husage(profile) "[on | off | clear | <number of addresses>]",
+    "While the call graph of the machine is kept, the T-states of each instruction"
+        "\nare charged to the subroutine it is executed in, known by the address it was"
+        "\ncalled at. Use 'calls on' to start, and 'calls' to see the 10 subroutines which"
+        "\ntook the most T-states with the ones they called, and how many they took"
+        "\nwithout them. 'calls <file>' writes the T-states taken by each chain of calls"
+        "\nas collapsed stacks, for the flame graph tools. A subroutine is left once the"
+        "\nstack pointer moves above its return address, so returning by popping it or"
+        "\nby changing the stack pointer works as well as a return. The machine runs"
+        "\nslower while its call graph is kept, like it does with breakpoints."
+        "\n" husage(calls) "[on | off | clear | <file>]",
+    "'watch' is The8085 watchpoint manager. A watchpoint stops the machine after an"
+        "\ninstruction reads or writes a watched address, like a breakpoint does before"
+        "\nan instruction. You can add, remove or view watchpoints using the subcommands"
+        "\nshown below. The machine runs slower while any address is watched, like it"
+        "\ndoes with breakpoints, but mostly by the accesses to the watched 256 byte pages."
+        "\nFor more information on a particular subcommand, type : "
+        "\n" hcode(help) "watch <subcommand>",
+    "To watch the addresses from <from> to <to>, or only <from>, for the reads (r),"
+        "\nthe writes (w) or both (rw, the default), use 'watch add' like the following :"
+        "\n" hcode(watch) "add <from> [<to>] [r | w | rw]"
+        "\nThe instructions themselves are not reads, but the stack is, so returning"
+        "\nfrom or pushing to a watched address stops the machine too.",
+    "To stop watching the addresses from <from> to <to>, or only <from>, for the"
+        "\nreads (r), the writes (w) or both (rw, the default), use 'watch remove'."
+        "\n" husage(watch) "remove <from> [<to>] [r | w | rw]",
+    "Use 'watch view' to show all the watched addresses, sorted by their addresses."
+        "\n" husage(watch) "view",
+    "'interrupt' raises the TRAP, RST 7.5, RST 6.5 or RST 5.5 line of the machine,"
+        "\nwhich takes the interrupt before the next instruction it executes, unless it"
+        "\nis masked by 'sim' or disabled by 'di', in which case it stays pending. Use"
+        "\n'interrupt' without any arguments to see whether the interrupts are enabled,"
+        "\nand which of them are masked and pending."
+        "\n" husage(interrupt) "[trap | 7.5 | 6.5 | 5.5]",
 };
 
 // clang-format on
@@ -375,6 +880,13 @@ int main(int argc, char *argv[]) {
 #ifndef __AFL_COMPILER
 	dump_init();
 #endif
+	// The batch mode writes nothing but its results
+	if(argc > 1 && strcmp(argv[1], "batch") == 0) {
+		if(argc == 3)
+			return manifest_run(argv[2], stdout) ? 0 : 1;
+		phgrn("\n[Usage] ", "%s batch <manifest.json>\n", argv[0]);
+		return 1;
+	}
 	machine_init(&machine);
 #ifdef ENABLE_TESTS
 	test_all();
@@ -477,10 +989,68 @@ int main(int argc, char *argv[]) {
 	    "calibrate",
 	    "Calibrate the virtual machine to better sync with the host",
 	    calb_action);
-	calb.longhelp = longhelp[13];
+	calb.longhelp     = longhelp[13];
+	CellKeyword engn = cell_create_keyword(
+	    "engine", "Show or change the execution engine of the machine",
+	    engine_action);
+	engn.longhelp    = longhelp[14];
+	CellKeyword snap = cell_create_keyword(
+	    "snapshot", "Save and restore the machine", snap_action);
+	snap.longhelp        = longhelp[15];
+	CellKeyword snapsave = cell_create_keyword(
+	    "save", "Save the machine and the memory", snapsave_action);
+	snapsave.longhelp       = longhelp[16];
+	CellKeyword snaprestore = cell_create_keyword(
+	    "restore", "Restore the last saved machine and memory",
+	    snaprestore_action);
+	snaprestore.longhelp = longhelp[17];
+	CellKeyword jrnl     = cell_create_keyword(
+	    "journal", "Keep a journal of the instructions to step back over",
+	    journal_action);
+	jrnl.longhelp        = longhelp[18];
+	CellKeyword stepback = cell_create_keyword(
+	    "back", "Undo the last instruction", stepback_action);
+	stepback.longhelp    = longhelp[19];
+	CellKeyword contback = cell_create_keyword(
+	    "back", "Undo the instructions till the previous breakpoint",
+	    contback_action);
+	contback.longhelp = longhelp[20];
+	CellKeyword trace = cell_create_keyword(
+	    "trace", "Write the instructions executed to a file", trace_action);
+	trace.longhelp    = longhelp[21];
+	CellKeyword prof = cell_create_keyword(
+	    "profile", "Show where the cycles are spent", profile_action);
+	prof.longhelp     = longhelp[22];
+	CellKeyword calls = cell_create_keyword(
+	    "calls", "Show the subroutines the cycles are spent in", calls_action);
+	calls.longhelp    = longhelp[23];
+	CellKeyword watch = cell_create_keyword(
+	    "watch", "Manage watchpoints", watch_action);
+	watch.longhelp       = longhelp[24];
+	CellKeyword watchadd = cell_create_keyword(
+	    "add", "Watch the given addresses for the reads and the writes",
+	    watchadd_action);
+	watchadd.longhelp   = longhelp[25];
+	CellKeyword watchrm = cell_create_keyword(
+	    "remove", "Stop watching the given addresses", watchrm_action);
+	watchrm.longhelp      = longhelp[26];
+	CellKeyword watchview = cell_create_keyword(
+	    "view", "View all the watched addresses", watchview_action);
+	watchview.longhelp = longhelp[27];
+	CellKeyword intr   = cell_create_keyword(
+	    "interrupt", "Raise an interrupt, or show the interrupts",
+	    interrupt_action);
+	intr.longhelp = longhelp[28];
 	cell_add_subkeyword(&brk, brkview);
 	cell_add_subkeyword(&brk, brkadd);
 	cell_add_subkeyword(&brk, brkrem);
+	cell_add_subkeyword(&watch, watchview);
+	cell_add_subkeyword(&watch, watchadd);
+	cell_add_subkeyword(&watch, watchrm);
+	cell_add_subkeyword(&snap, snapsave);
+	cell_add_subkeyword(&snap, snaprestore);
+	cell_add_subkeyword(&step, stepback);
+	cell_add_subkeyword(&cont, contback);
 	cell_insert_keyword(&cell, exec);
 	cell_insert_keyword(&cell, show);
 	cell_insert_keyword(&cell, set);
@@ -489,13 +1059,22 @@ int main(int argc, char *argv[]) {
 	cell_insert_keyword(&cell, help);
 	cell_insert_keyword(&cell, dis);
 	cell_insert_keyword(&cell, brk);
+	cell_insert_keyword(&cell, watch);
 	cell_insert_keyword(&cell, cont);
 	cell_insert_keyword(&cell, step);
 	cell_insert_keyword(&cell, calb);
-	asm_init(&cell, &memory[0]);
+	cell_insert_keyword(&cell, engn);
+	cell_insert_keyword(&cell, snap);
+	cell_insert_keyword(&cell, jrnl);
+	cell_insert_keyword(&cell, trace);
+	cell_insert_keyword(&cell, prof);
+	cell_insert_keyword(&cell, calls);
+	cell_insert_keyword(&cell, intr);
+	asm_init(&cell, &machine, &memory[0]);
 	cell_repl(&cell);
 	cell_destroy(&cell);
 	compiler_reset();
+	trace_stop(&machine);
 	printf("\n");
 	return 0;
 }
@@ -0,0 +1,695 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "compiler.h"
+#include "display.h"
+#include "manifest.h"
+#include "util.h"
+#include "vm.h"
+
+// The deepest the values of a manifest may be nested
+#define JSON_DEPTH 64
+
+typedef enum {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+} JsonType;
+
+typedef struct Json {
+	JsonType     type;
+	bool         boolean;
+	double       number;
+	char *       string;
+	char *       key;   // of a member of an object
+	struct Json *items; // the elements of an array, or the members of an
+	                    // object, in the order they were written in
+	u32 count;
+} Json;
+
+typedef struct {
+	const char *s;
+	u32         line;
+	const char *error;
+} JsonParser;
+
+static bool json_fail(JsonParser *p, const char *error) {
+	if(p->error == NULL)
+		p->error = error;
+	return false;
+}
+
+static void json_skip(JsonParser *p) {
+	while(*p->s == ' ' || *p->s == '\t' || *p->s == '\r' || *p->s == '\n') {
+		if(*p->s == '\n')
+			p->line++;
+		p->s++;
+	}
+}
+
+static int hex_digit(char c) {
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+// Reads the string at the opening quote into 'out'. The escapes are
+// never longer than what they stand for, and so the string is never
+// longer than it is in the manifest.
+static bool json_string(JsonParser *p, char **out) {
+	const char *end = ++p->s;
+	while(*end != '"') {
+		if(*end == '\0' || *end == '\n')
+			return json_fail(p, "unterminated string");
+		if(*end == '\\' && end[1] != '\0')
+			end++;
+		end++;
+	}
+	char *s = (char *)malloc(end - p->s + 1);
+	u32   n = 0;
+	while(p->s < end) {
+		char c = *p->s++;
+		if(c != '\\') {
+			s[n++] = c;
+			continue;
+		}
+		switch(c = *p->s++) {
+			case 'b': s[n++] = '\b'; break;
+			case 'f': s[n++] = '\f'; break;
+			case 'n': s[n++] = '\n'; break;
+			case 'r': s[n++] = '\r'; break;
+			case 't': s[n++] = '\t'; break;
+			case 'u': {
+				u32 code = 0;
+				for(u8 i = 0; i < 4; i++) {
+					int digit = p->s < end ? hex_digit(*p->s++) : -1;
+					if(digit < 0) {
+						free(s);
+						return json_fail(p, "bad \\u escape");
+					}
+					code = code << 4 | digit;
+				}
+				// As UTF-8, leaving the surrogates unpaired
+				if(code < 0x80)
+					s[n++] = code;
+				else if(code < 0x800) {
+					s[n++] = 0xc0 | code >> 6;
+					s[n++] = 0x80 | (code & 0x3f);
+				} else {
+					s[n++] = 0xe0 | code >> 12;
+					s[n++] = 0x80 | (code >> 6 & 0x3f);
+					s[n++] = 0x80 | (code & 0x3f);
+				}
+				break;
+			}
+			case '"':
+			case '\\':
+			case '/': s[n++] = c; break;
+			default: free(s); return json_fail(p, "bad escape");
+		}
+	}
+	s[n] = '\0';
+	p->s++;
+	*out = s;
+	return true;
+}
+
+static bool json_value(JsonParser *p, Json *v, u32 depth);
+
+// Reads the elements of an array, or the members of an object, up to
+// 'close'
+static bool json_items(JsonParser *p, Json *v, char close, u32 depth) {
+	u32 capacity = 0;
+	p->s++;
+	json_skip(p);
+	if(*p->s == close) {
+		p->s++;
+		return true;
+	}
+	while(true) {
+		if(v->count == capacity) {
+			capacity = capacity ? capacity * 2 : 8;
+			v->items = (Json *)realloc(v->items, sizeof(Json) * capacity);
+		}
+		Json *item = &v->items[v->count];
+		memset(item, 0, sizeof(Json));
+		v->count++;
+		if(close == '}') {
+			if(*p->s != '"')
+				return json_fail(p, "expected the name of a member");
+			if(!json_string(p, &item->key))
+				return false;
+			json_skip(p);
+			if(*p->s++ != ':')
+				return json_fail(p, "expected ':' after the name");
+			json_skip(p);
+		}
+		if(!json_value(p, item, depth + 1))
+			return false;
+		json_skip(p);
+		if(*p->s == close) {
+			p->s++;
+			return true;
+		}
+		if(*p->s++ != ',')
+			return json_fail(p, close == '}' ? "expected ',' or '}'"
+			                                 : "expected ',' or ']'");
+		json_skip(p);
+	}
+}
+
+static bool json_value(JsonParser *p, Json *v, u32 depth) {
+	if(depth == JSON_DEPTH)
+		return json_fail(p, "nested too deep");
+	switch(*p->s) {
+		case '{': v->type = JSON_OBJECT; return json_items(p, v, '}', depth);
+		case '[': v->type = JSON_ARRAY; return json_items(p, v, ']', depth);
+		case '"': v->type = JSON_STRING; return json_string(p, &v->string);
+	}
+	if(strncmp(p->s, "true", 4) == 0 || strncmp(p->s, "false", 5) == 0) {
+		v->type    = JSON_BOOL;
+		v->boolean = *p->s == 't';
+		p->s += v->boolean ? 4 : 5;
+		return true;
+	}
+	if(strncmp(p->s, "null", 4) == 0) {
+		p->s += 4;
+		return true;
+	}
+	char *end;
+	v->type   = JSON_NUMBER;
+	v->number = strtod(p->s, &end);
+	if(end == p->s)
+		return json_fail(p, "unexpected character");
+	p->s = end;
+	return true;
+}
+
+static void json_free(Json *v) {
+	for(u32 i = 0; i < v->count; i++) json_free(&v->items[i]);
+	free(v->items);
+	free(v->string);
+	free(v->key);
+}
+
+// The member named 'key' of 'object', if it is one and has it
+static const Json *json_get(const Json *object, const char *key) {
+	if(object->type != JSON_OBJECT)
+		return NULL;
+	for(u32 i = 0; i < object->count; i++)
+		if(strcmp(object->items[i].key, key) == 0)
+			return &object->items[i];
+	return NULL;
+}
+
+// Reads a whole number up to 'max', either as a number or as a string
+// in C notation, which lets the addresses be written in hexadecimal
+static bool json_uint(const Json *v, u64 max, u64 *out) {
+	if(v->type == JSON_NUMBER) {
+		if(v->number < 0 || v->number >= 0x1p64 || v->number > max ||
+		   v->number != (u64)v->number)
+			return false;
+		*out = (u64)v->number;
+		return true;
+	}
+	if(v->type != JSON_STRING || v->string[0] == '-' || v->string[0] == '\0')
+		return false;
+	char *end;
+	*out = strtoull(v->string, &end, 0);
+	return *end == '\0' && *out <= max;
+}
+
+// A string which grows as the line of a job is written
+typedef struct {
+	char *s;
+	siz   length;
+	siz   capacity;
+} Text;
+
+static void text_add(Text *t, const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if(t->length + length + 1 > t->capacity) {
+		while(t->length + length + 1 > t->capacity)
+			t->capacity = t->capacity ? t->capacity * 2 : 256;
+		t->s = (char *)realloc(t->s, t->capacity);
+	}
+	va_start(args, format);
+	vsnprintf(t->s + t->length, length + 1, format, args);
+	va_end(args);
+	t->length += length;
+}
+
+static void text_string(Text *t, const char *s) {
+	text_add(t, "\"");
+	for(; *s; s++) {
+		if(*s == '"' || *s == '\\')
+			text_add(t, "\\%c", *s);
+		else if((u8)*s < 0x20)
+			text_add(t, "\\u%04x", (u8)*s);
+		else
+			text_add(t, "%c", *s);
+	}
+	text_add(t, "\"");
+}
+
+// A range of the memory shown after each run
+typedef struct {
+	u16 from;
+	u32 length;
+} Range;
+
+typedef struct {
+	const char *id; // held by the manifest
+	char *      path;
+	u16         load;
+	u16         start;
+	u64         budget;
+	u32         range_count;
+	Range *     ranges;
+	u32         run_count;
+	BatchInput *runs;
+	char        error[128]; // found in the manifest, if any
+	char *      lines;      // once the job is done
+	bool        done;
+} Job;
+
+// The registers by their REG_* index
+static const char register_names[] = "abcdehlf";
+
+// Reads the state a run starts from out of 'v', into 'run'
+static bool parse_run(const Json *v, BatchInput *run, char *error) {
+	run->sp          = 0xffff;
+	const Json *regs = json_get(v, "registers");
+	for(u32 i = 0; regs && i < regs->count; i++) {
+		const Json *r = &regs->items[i];
+		u64         value;
+		if(strcmp(r->key, "sp") == 0 && json_uint(r, 0xffff, &value)) {
+			run->sp = value;
+			continue;
+		}
+		const char *name = strchr(register_names, r->key[0]);
+		if(r->key[0] == '\0' || r->key[1] != '\0' || name == NULL ||
+		   !json_uint(r, 0xff, &value)) {
+			snprintf(error, 96, "bad register '%s'", r->key);
+			return false;
+		}
+		run->registers[name - register_names] = value;
+	}
+	if(regs && regs->type != JSON_OBJECT) {
+		snprintf(error, 96, "the registers must be an object");
+		return false;
+	}
+
+	// Each member is the address of a byte or of an array of them
+	const Json *mem   = json_get(v, "memory");
+	u32         count = 0;
+	for(u32 i = 0; mem && i < mem->count; i++)
+		count += mem->items[i].type == JSON_ARRAY ? mem->items[i].count : 1;
+	BatchByte *patches = (BatchByte *)malloc(sizeof(BatchByte) * (count + 1));
+	run->patches       = patches;
+	for(u32 i = 0; mem && i < mem->count; i++) {
+		const Json *m = &mem->items[i];
+		Json        key = {JSON_STRING, false, 0, m->key, NULL, NULL, 0};
+		u64         addr, value;
+		bool        many = m->type == JSON_ARRAY;
+		if(!json_uint(&key, 0xffff, &addr) ||
+		   addr + (many ? m->count : 1) > 0x10000) {
+			snprintf(error, 96, "bad address '%s' in the memory", m->key);
+			return false;
+		}
+		for(u32 k = 0; k < (many ? m->count : 1); k++) {
+			if(!json_uint(many ? &m->items[k] : m, 0xff, &value)) {
+				snprintf(error, 96, "bad byte at 0x%x in the memory",
+				         (u32)(addr + k));
+				return false;
+			}
+			patches[run->patch_count++] = (BatchByte){addr + k, value};
+		}
+	}
+	if(mem && mem->type != JSON_OBJECT) {
+		snprintf(error, 96, "the memory must be an object");
+		return false;
+	}
+
+	// Each member is a port, and the bytes its 'in's read
+	const Json * in      = json_get(v, "inputs");
+	BatchStream *streams = (BatchStream *)calloc(in ? in->count + 1 : 1,
+	                                             sizeof(BatchStream));
+	run->streams         = streams;
+	for(u32 i = 0; in && i < in->count; i++) {
+		const Json *s = &in->items[i];
+		Json        key = {JSON_STRING, false, 0, s->key, NULL, NULL, 0};
+		u64         port, value;
+		if(!json_uint(&key, 0xff, &port) || s->type != JSON_ARRAY) {
+			snprintf(error, 96, "bad input port '%s'", s->key);
+			return false;
+		}
+		u8 *bytes = (u8 *)malloc(s->count + 1);
+		streams[run->stream_count++] = (BatchStream){port, s->count, bytes};
+		for(u32 k = 0; k < s->count; k++) {
+			if(!json_uint(&s->items[k], 0xff, &value)) {
+				snprintf(error, 96, "bad byte in the input of port 0x%x",
+				         (u32)port);
+				return false;
+			}
+			bytes[k] = value;
+		}
+	}
+	if(in && in->type != JSON_OBJECT) {
+		snprintf(error, 96, "the inputs must be an object");
+		return false;
+	}
+	return true;
+}
+
+// Reads the job out of 'v', leaving the reason in its 'error' if it
+// cannot be run
+static void parse_job(const Json *v, Job *job, const char *dir,
+                      u64 budget) {
+	const Json *program = json_get(v, "program");
+	u64         value;
+	job->load   = MANIFEST_LOAD;
+	job->budget = budget;
+	if(program == NULL || program->type != JSON_STRING) {
+		snprintf(job->error, 128, "no program");
+		return;
+	}
+	const Json *id = json_get(v, "id");
+	job->id = id && id->type == JSON_STRING ? id->string : program->string;
+	if(program->string[0] == '/' || dir == NULL)
+		job->path = strdup(program->string);
+	else {
+		job->path = (char *)malloc(strlen(dir) + strlen(program->string) + 2);
+		sprintf(job->path, "%s/%s", dir, program->string);
+	}
+
+	const Json *load = json_get(v, "load");
+	if(load && !json_uint(load, 0xffff, &value)) {
+		snprintf(job->error, 128, "bad load address");
+		return;
+	} else if(load)
+		job->load = value;
+	job->start        = job->load;
+	const Json *start = json_get(v, "start");
+	if(start && !json_uint(start, 0xffff, &value)) {
+		snprintf(job->error, 128, "bad start address");
+		return;
+	} else if(start)
+		job->start = value;
+	const Json *cycles = json_get(v, "budget");
+	if(cycles && !json_uint(cycles, u64_MAX, &job->budget)) {
+		snprintf(job->error, 128, "bad budget");
+		return;
+	}
+
+	const Json *dump = json_get(v, "dump");
+	if(dump && dump->type != JSON_ARRAY) {
+		snprintf(job->error, 128, "the dump must be an array");
+		return;
+	}
+	job->ranges = (Range *)malloc(sizeof(Range) * (dump ? dump->count + 1 : 1));
+	for(u32 i = 0; dump && i < dump->count; i++) {
+		const Json *from   = json_get(&dump->items[i], "from");
+		const Json *length = json_get(&dump->items[i], "length");
+		u64         addr, bytes = 1;
+		if(from == NULL || !json_uint(from, 0xffff, &addr) ||
+		   (length && !json_uint(length, 0x10000, &bytes)) ||
+		   addr + bytes > 0x10000) {
+			snprintf(job->error, 128, "bad range %u of the dump", i);
+			return;
+		}
+		job->ranges[job->range_count++] = (Range){addr, bytes};
+	}
+
+	const Json *runs = json_get(v, "runs");
+	if(runs && (runs->type != JSON_ARRAY || runs->count == 0)) {
+		snprintf(job->error, 128, "the runs must be an array of them");
+		return;
+	}
+	job->run_count = runs ? runs->count : 1;
+	job->runs = (BatchInput *)calloc(job->run_count, sizeof(BatchInput));
+	for(u32 i = 0; i < job->run_count; i++) {
+		char error[96];
+		if(!parse_run(runs ? &runs->items[i] : v, &job->runs[i], error)) {
+			snprintf(job->error, 128, "run %u : %s", i, error);
+			return;
+		}
+	}
+}
+
+static void free_job(Job *job) {
+	for(u32 i = 0; job->runs && i < job->run_count; i++) {
+		BatchInput *run = &job->runs[i];
+		for(u32 k = 0; k < run->stream_count; k++)
+			free((void *)run->streams[k].bytes);
+		free((void *)run->streams);
+		free((void *)run->patches);
+	}
+	free(job->runs);
+	free(job->ranges);
+	free(job->path);
+	free(job->lines);
+}
+
+static const char *compile_errors[] = {
+    "parse error",   "memory full",  "too many labels",
+    "labels pending", "empty program", "no hlt",
+};
+
+static void write_failure(Text *t, const Job *job, const char *status,
+                          const char *error) {
+	text_add(t, "{\"id\":");
+	text_string(t, job->id ? job->id : "");
+	text_add(t, ",\"run\":null,\"status\":\"%s\",\"error\":", status);
+	text_string(t, error);
+	text_add(t, "}\n");
+}
+
+static void write_result(Text *t, const Job *job, u32 run,
+                         const BatchResult *r, const u8 *image) {
+	text_add(t, "{\"id\":");
+	text_string(t, job->id);
+	text_add(t,
+	         ",\"run\":%u,\"status\":\"%s\",\"cycles\":%" Pu64
+	         ",\"instructions\":%" Pu64 ",\"registers\":{",
+	         run, r->status == RUN_HALTED ? "halted" : "budget", r->cycles,
+	         r->instructions);
+	for(u8 reg = 0; reg < 8; reg++)
+		text_add(t, "\"%c\":%u,", register_names[reg], r->registers[reg]);
+	text_add(t, "\"pc\":%u,\"sp\":%u},\"memory\":{", r->pc, r->sp);
+	for(u32 i = 0; i < job->range_count; i++) {
+		const Range *range = &job->ranges[i];
+		// The diffs are by address, the first one in the range first
+		u32 lo = 0, hi = r->diff_count;
+		while(lo < hi) {
+			u32 mid = (lo + hi) / 2;
+			if(r->diffs[mid].addr < range->from)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		text_add(t, "%s\"0x%04x\":[", i ? "," : "", range->from);
+		for(u32 addr = range->from; addr < range->from + range->length;
+		    addr++) {
+			u8 value = image[addr];
+			if(lo < r->diff_count && r->diffs[lo].addr == addr)
+				value = r->diffs[lo++].value;
+			text_add(t, "%s%u", addr > range->from ? "," : "", value);
+		}
+		text_add(t, "]");
+	}
+	text_add(t, "},\"outputs\":[");
+	for(u32 i = 0; i < r->output_count; i++)
+		text_add(t, "%s[%u,%u]", i ? "," : "", r->outputs[i].port,
+		         r->outputs[i].value);
+	text_add(t, "]}\n");
+}
+
+// Assembles the program of 'job' in 'image', and runs it on each of its
+// runs, into its lines
+static void run_job(Job *job, u8 engine, u8 *image) {
+	Text t = {NULL, 0, 0};
+	if(job->error[0]) {
+		write_failure(&t, job, "manifest_error", job->error);
+		job->lines = t.s;
+		return;
+	}
+	char *source = readFile(job->path);
+	if(source == NULL) {
+		char error[160];
+		snprintf(error, sizeof(error), "cannot read %s", job->path);
+		write_failure(&t, job, "read_error", error);
+		job->lines = t.s;
+		return;
+	}
+	memset(image, 0, 0x10000);
+	u16 pointer = job->load;
+	compiler_reset();
+	CompilationStatus status = compile(source, image, 0xffff, &pointer);
+	compiler_reset();
+	free(source);
+	if(status != COMPILE_OK) {
+		write_failure(&t, job, "compile_error", compile_errors[status]);
+		job->lines = t.s;
+		return;
+	}
+	BatchOptions options = {job->start, job->budget, engine};
+	BatchResult *results =
+	    (BatchResult *)calloc(job->run_count, sizeof(BatchResult));
+	batch_run(image, pointer, &options, job->runs, results, job->run_count);
+	for(u32 i = 0; i < job->run_count; i++)
+		write_result(&t, job, i, &results[i], image);
+	batch_free(results, job->run_count);
+	free(results);
+	job->lines = t.s;
+}
+
+typedef struct {
+	Job *           jobs;
+	u32             count;
+	u32             next;    // the job the next worker to be free takes
+	u32             written; // the jobs whose lines were written out
+	u8              engine;
+	FILE *          out;
+	pthread_mutex_t lock;
+} Pool;
+
+static void *work(void *arg) {
+	Pool *pool  = (Pool *)arg;
+	u8 *  image = (u8 *)malloc(0x10000);
+	display_mute(true);
+	pthread_mutex_lock(&pool->lock);
+	while(pool->next < pool->count) {
+		Job *job = &pool->jobs[pool->next++];
+		pthread_mutex_unlock(&pool->lock);
+		run_job(job, pool->engine, image);
+		pthread_mutex_lock(&pool->lock);
+		job->done = true;
+		// The lines are written in the order of the manifest, as soon as
+		// the jobs before are done too
+		bool wrote = false;
+		while(pool->written < pool->count &&
+		      pool->jobs[pool->written].done) {
+			Job *first = &pool->jobs[pool->written++];
+			fputs(first->lines, pool->out);
+			free(first->lines);
+			first->lines = NULL;
+			wrote        = true;
+		}
+		if(wrote)
+			fflush(pool->out);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	free(image);
+	return NULL;
+}
+
+static bool parse_engine(const char *name, u8 *engine) {
+	static const struct {
+		const char *name;
+		u8          engine;
+	} engines[] = {{"switch", ENGINE_SWITCH},
+	               {"threaded", ENGINE_THREADED},
+	               {"block", ENGINE_BLOCK},
+	               {"jit", ENGINE_JIT}};
+	for(u32 i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+		if(strcmp(name, engines[i].name) == 0) {
+			*engine = engines[i].engine;
+			return true;
+		}
+	return false;
+}
+
+// Runs the 'jobs' on 'threads' workers, or one for each core if 0
+static void run_jobs(Pool *pool, const Json *jobs, const char *path,
+                     u64 budget, u64 threads) {
+	// The programs are found from the directory of the manifest
+	char *      dir   = strdup(path);
+	char *      slash = strrchr(dir, '/');
+	const char *from  = NULL;
+	if(slash) {
+		*slash = '\0';
+		from   = slash == dir ? "/" : dir;
+	}
+	pool->count = jobs->count;
+	pool->jobs  = (Job *)calloc(pool->count + 1, sizeof(Job));
+	for(u32 i = 0; i < pool->count; i++)
+		parse_job(&jobs->items[i], &pool->jobs[i], from, budget);
+	free(dir);
+
+	if(threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads > pool->count)
+		threads = pool->count;
+	if(threads == 0)
+		threads = 1;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_t *workers = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+	for(u32 i = 0; i < threads; i++)
+		pthread_create(&workers[i], NULL, work, pool);
+	for(u32 i = 0; i < threads; i++) pthread_join(workers[i], NULL);
+	pthread_mutex_destroy(&pool->lock);
+	free(workers);
+
+	for(u32 i = 0; i < pool->count; i++) free_job(&pool->jobs[i]);
+	free(pool->jobs);
+}
+
+bool manifest_run(const char *path, FILE *out) {
+	char *text = readFile(path);
+	if(text == NULL)
+		return false;
+	JsonParser p    = {text, 1, NULL};
+	Json       root = {JSON_NULL, false, 0, NULL, NULL, NULL, 0};
+	json_skip(&p);
+	if(json_value(&p, &root, 0)) {
+		json_skip(&p);
+		if(*p.s != '\0')
+			json_fail(&p, "unexpected character after the manifest");
+	}
+	free(text);
+	if(p.error) {
+		perr("Bad manifest '%s' at line %u : %s!", path, p.line, p.error);
+		json_free(&root);
+		return false;
+	}
+	const Json *jobs    = json_get(&root, "jobs");
+	const Json *workers = json_get(&root, "workers");
+	const Json *budget  = json_get(&root, "budget");
+	const Json *engine  = json_get(&root, "engine");
+	u64         threads = 0, cycles = MANIFEST_BUDGET;
+	u8          core    = ENGINE_DEFAULT;
+	bool        ok      = false;
+	if(jobs == NULL || jobs->type != JSON_ARRAY)
+		perr("The manifest '%s' has no array of jobs!", path);
+	else if(workers && !json_uint(workers, 1024, &threads))
+		perr("Bad number of workers in '%s'!", path);
+	else if(budget && !json_uint(budget, u64_MAX, &cycles))
+		perr("Bad budget in '%s'!", path);
+	else if(engine && (engine->type != JSON_STRING ||
+	                   !parse_engine(engine->string, &core)))
+		perr("Bad engine in '%s'!", path);
+	else {
+		Pool pool;
+		memset(&pool, 0, sizeof(Pool));
+		pool.engine = core;
+		pool.out    = out;
+		run_jobs(&pool, jobs, path, cycles, threads);
+		ok = true;
+	}
+	json_free(&root);
+	return ok;
+}
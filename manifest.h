@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "common.h"
+
+// The batch mode assembles and runs the jobs listed in a JSON manifest,
+// with no console, on a pool of worker threads. A job names a program,
+// which is assembled once and run by the batch engine on each of its
+// runs, and writes a JSON line for each run. The manifest is an object
+// whose "jobs" are objects like
+//
+// {"id": "alice", "program": "alice.8085", "load": "0x0100",
+//  "start": "0x0100", "budget": 1000000,
+//  "dump": [{"from": "0x8000", "length": 4}],
+//  "runs": [{"registers": {"a": 1, "sp": "0xfffe"},
+//            "memory": {"0x8000": [10, "0x39"]},
+//            "inputs": {"0x10": [1, 2, 3]}}]}
+//
+// of which only "program" is needed. A program is found from the
+// directory of the manifest unless its path is absolute, loaded and
+// started at 0x0100 by default, as in the file mode, and run for at
+// most the "budget" of the job, or of the manifest, in cycles, 0
+// being any. A job with no "runs" is run once on the "registers",
+// "memory" and "inputs" of its own. The "memory" is written over the
+// program before each run, and the "inputs" are the bytes the 'in's of
+// each port read one after the other. The manifest may also choose the
+// "workers", one for each core by default, and the "engine" the
+// machines which leave the rest of the batch are run on.
+//
+// A line holds the "id" of the job, or its program, the index of the
+// "run", and its "status", which is "halted", "budget", or a failure
+// of the job as a whole, "read_error", "compile_error" or
+// "manifest_error", along with an "error" telling what it was. A run
+// which is done also holds its "cycles", "instructions", "registers",
+// the bytes of each range of the "dump" by their address, and the
+// "outputs" of its 'out's as [port, value]. The lines are written in
+// the order of the manifest.
+
+// Where the programs are loaded and started unless the job says
+// otherwise, as in the file mode
+#define MANIFEST_LOAD 0x0100
+// The cycles each run may take unless the manifest says otherwise, for
+// the programs which never halt
+#define MANIFEST_BUDGET 100000000
+
+// Runs the manifest at 'path', writing the lines to 'out'. Returns false,
+// after showing why, if the manifest cannot be read.
+bool manifest_run(const char *path, FILE *out);
@@ -9,7 +9,7 @@ const char *bytecode_get_string(Bytecode code) {
 	return instruction_keywords[code].str;
 }
 
-static u16 intrpointer = 0;
+static THREAD_LOCAL u16 intrpointer = 0;
 
 void bytecode_disassemble_in_context(u8 *memory, u16 pointer, Machine *m) {
 	(void)m;
@@ -1,17 +1,70 @@
+#include "callgraph.h"
 #include "common.h"
 #include "display.h"
+#include "event.h"
+#include "interrupt.h"
+#include "io.h"
+#include "jit.h"
+#include "journal.h"
+#include "profile.h"
+#include "trace.h"
+#include "util.h"
 #include "vm.h"
+#include "watch.h"
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 static inline u8 next_byte(Machine *m, u8 *memory) {
 	return memory[m->pc++];
 }
 
-#define GET_FLAG(x) ((m->registers[REG_FL] >> x) & 1)
+// The low byte is read first, which the order the operands of an
+// expression are evaluated in would leave to the compiler
+static inline u16 next_dword(Machine *m, u8 *memory) {
+	u16 low = next_byte(m, memory);
+	return low | (u16)next_byte(m, memory) << 8;
+}
 
 #define NEXT_BYTE() next_byte(m, memory)
-#define NEXT_DWORD() ((u16)NEXT_BYTE() | ((u16)NEXT_BYTE() << 8))
+#define NEXT_DWORD() next_dword(m, memory)
+
+// The debug cores journal the byte each write overwrites, for the
+// machine to step back over it, trace the byte written, and check the
+// write against the watched pages
+#define RECORD_WRITE(at, byte)                            \
+	if(RUN_MODE == MODE_DEBUG) {                          \
+		if(m->hooks & HOOK_JOURNAL)                       \
+			journal_write(m, at, memory[at]);             \
+		if(m->hooks & HOOK_TRACE)                         \
+			trace_write(m, at, byte);                     \
+		if(m->watch_pages[at >> PAGE_BITS] & WATCH_WRITE) \
+			watch_access(m, at, WATCH_WRITE, byte);       \
+	}
+
+static inline u8 read_watched(Machine *m, const u8 *memory, u16 addr) {
+	if(m->watch_pages[addr >> PAGE_BITS] & WATCH_READ)
+		watch_access(m, addr, WATCH_READ, memory[addr]);
+	return memory[addr];
+}
+
+// All the reads of the memory by the instructions, other than of the
+// instructions themselves, go through this, for the debug cores to
+// check them against the watched pages
+#define READ_BYTE(addr)                                     \
+	(RUN_MODE == MODE_DEBUG ? read_watched(m, memory, addr) \
+	                        : memory[(u16)(addr)])
+
+// All the writes to the memory by the instructions go through this, and
+// mark the page they write to for the snapshots
+#define WRITE_BYTE(addr, value)             \
+	{                                       \
+		u16 at   = (addr);                  \
+		u8  byte = (value);                 \
+		RECORD_WRITE(at, byte);             \
+		memory[at]                  = byte; \
+		m->written[at >> PAGE_BITS] = 1;    \
+	}
 
 #define FROM_PAIR(x, y) (((u16)m->registers[x] << 8) | m->registers[y])
 #define FROM_HL() FROM_PAIR(REG_H, REG_L)
@@ -37,22 +90,50 @@ static inline u8 next_byte(Machine *m, u8 *memory) {
 	       (temp >> 5) - (temp >> 6) - (temp >> 7);                          \
 	CHANGE_FLAG(FLG_P, !(temp & 1));
 
-#define INIT_FLAGS(res) \
-	INIT_FLG_C(res)     \
-	INIT_FLG_Z(res)     \
-	INIT_FLG_S(res)     \
-	INIT_FLG_P(res)
+// The sign, zero, parity and auxiliary carry flags are only computed
+// when they are read. The instructions which set them record the result
+// and the two bytes whose sum sets the auxiliary carry, and the flag
+// register is brought up to date from that before anything reads it.
+// The carry is cheap and read by many more instructions, so it is always
+// kept up to date.
+#define LAZY_FLAGS(res, x, y) \
+	m->lazy.result  = (res);  \
+	m->lazy.lhs     = (x);    \
+	m->lazy.rhs     = (y);    \
+	m->lazy.pending = 1;
+
+static inline void sync_flags(Machine *m) {
+	if(!m->lazy.pending)
+		return;
+	m->lazy.pending = 0;
+	INIT_FLG_S(m->lazy.result);
+	INIT_FLG_Z(m->lazy.result);
+	INIT_FLG_P(m->lazy.result);
+	INIT_FLG_A(m->lazy.lhs, m->lazy.rhs);
+}
 
-#define ADD()                              \
-	u16 res = with + m->registers[REG_A];  \
-	INIT_FLAGS(res);                       \
-	INIT_FLG_A(with, m->registers[REG_A]); \
+void machine_sync_flags(Machine *m) {
+	sync_flags(m);
+}
+
+static inline u8 get_flag(Machine *m, u8 flag) {
+	if(flag != FLG_C)
+		sync_flags(m);
+	return (m->registers[REG_FL] >> flag) & 1;
+}
+
+#define GET_FLAG(x) get_flag(m, x)
+
+#define ADD()                                   \
+	u16 res = with + m->registers[REG_A];       \
+	INIT_FLG_C(res);                            \
+	LAZY_FLAGS(res, with, m->registers[REG_A]); \
 	m->registers[REG_A] = res & 0xff;
 
-#define ADD2()                                      \
-	u16 res = with1 + with2 + m->registers[REG_A];  \
-	INIT_FLAGS(res);                                \
-	INIT_FLG_A(with1 + with2, m->registers[REG_A]); \
+#define ADD2()                                           \
+	u16 res = with1 + with2 + m->registers[REG_A];       \
+	INIT_FLG_C(res);                                     \
+	LAZY_FLAGS(res, with1 + with2, m->registers[REG_A]); \
 	m->registers[REG_A] = res & 0xff;
 
 #define SUB()          \
@@ -62,13 +143,12 @@ static inline u8 next_byte(Machine *m, u8 *memory) {
 
 #define LOGICAL(op) m->registers[REG_A] = m->registers[REG_A] op with;
 
-#define LOGICAL_NOT_CMA(op)         \
-	LOGICAL(op)                     \
-	RESET_FLAG(FLG_C);              \
-	RESET_FLAG(FLG_A);              \
-	INIT_FLG_S(m->registers[REG_A]) \
-	INIT_FLG_Z(m->registers[REG_A]) \
-	INIT_FLG_P(m->registers[REG_A])
+// 'aux' is added to itself for the auxiliary carry, so it is set by
+// 0xff and reset by 0
+#define LOGICAL_NOT_CMA(op, aux) \
+	LOGICAL(op)                  \
+	RESET_FLAG(FLG_C);           \
+	LAZY_FLAGS(m->registers[REG_A], (aux), (aux))
 
 #define JMP_ON(cond)         \
 	u16 addr = NEXT_DWORD(); \
@@ -76,30 +156,27 @@ static inline u8 next_byte(Machine *m, u8 *memory) {
 	if(cond) {               \
 		m->pc   = addr;      \
 		tstates = 10;        \
-	}                        \
-	break;
-
-#define CALL_ON(cond)                              \
-	u16 addr = NEXT_DWORD();                       \
-	tstates  = 9;                                  \
-	if(cond) {                                     \
-		memory[m->sp - 1] = (m->pc & 0xff00) >> 8; \
-		memory[m->sp - 2] = m->pc & 0x00ff;        \
-		m->sp -= 2;                                \
-		m->pc   = addr;                            \
-		tstates = 18;                              \
-	}                                              \
-	break;
-
-#define RET_ON(cond)                       \
-	tstates = 6;                           \
-	if(cond) {                             \
-		m->pc = memory[m->sp];             \
-		m->pc |= (memory[m->sp + 1] << 8); \
-		m->sp += 2;                        \
-		tstates = 12;                      \
-	}                                      \
-	break;
+	}
+
+#define CALL_ON(cond)                                 \
+	u16 addr = NEXT_DWORD();                          \
+	tstates  = 9;                                     \
+	if(cond) {                                        \
+		WRITE_BYTE(m->sp - 1, (m->pc & 0xff00) >> 8); \
+		WRITE_BYTE(m->sp - 2, m->pc & 0x00ff);        \
+		m->sp -= 2;                                   \
+		m->pc   = addr;                               \
+		tstates = 18;                                 \
+	}
+
+#define RET_ON(cond)                          \
+	tstates = 6;                              \
+	if(cond) {                                \
+		m->pc = READ_BYTE(m->sp);             \
+		m->pc |= (READ_BYTE(m->sp + 1) << 8); \
+		m->sp += 2;                           \
+		tstates = 12;                         \
+	}
 
 #define DAD()                                  \
 	u32 res = FROM_PAIR(REG_H, REG_L) + with;  \
@@ -121,46 +198,37 @@ static inline u8 next_byte(Machine *m, u8 *memory) {
 
 #define ANA(reg)                 \
 	u8 with = m->registers[reg]; \
-	LOGICAL_NOT_CMA(&);          \
-	SET_FLAG(FLG_A);             \
+	LOGICAL_NOT_CMA(&, 0xff);    \
 	tstates = 4;
 
-#define CMP(reg)                   \
-	u8 bak = m->registers[REG_A];  \
-	u8 by  = m->registers[reg];    \
-	SUB();                         \
-	CHANGE_FLAG(FLG_C, bak < by);  \
-	CHANGE_FLAG(FLG_Z, by == bak); \
-	m->registers[REG_A] = bak;     \
+#define CMP(reg)                  \
+	u8 bak = m->registers[REG_A]; \
+	u8 by  = m->registers[reg];   \
+	SUB();                        \
+	CHANGE_FLAG(FLG_C, bak < by); \
+	m->registers[REG_A] = bak;    \
 	tstates             = 4;
 
 #define DAD_R(reg)                      \
 	u16 with = FROM_PAIR(reg, reg + 1); \
 	DAD();
 
-#define DCR(reg)                       \
-	u16 res = m->registers[reg] - 1;   \
-	INIT_FLG_S(res);                   \
-	INIT_FLG_Z(res);                   \
-	INIT_FLG_P(res);                   \
-	INIT_FLG_A(m->registers[reg], -1); \
-	m->registers[reg] = res & 0xff;    \
+#define DCR(reg)                              \
+	u16 res = m->registers[reg] - 1;          \
+	LAZY_FLAGS(res, m->registers[reg], 0xff); \
+	m->registers[reg] = res & 0xff;           \
 	tstates           = 4;
 
 #define DCX(first)                                             \
 	u16 res                 = FROM_PAIR(first, first + 1) - 1; \
 	m->registers[first]     = (res & 0xff00) >> 8;             \
 	m->registers[first + 1] = res & 0x00ff;                    \
-	tstates                 = 6;                               \
-	break;
-
-#define INR(reg)                      \
-	u16 res = m->registers[reg] + 1;  \
-	INIT_FLG_S(res);                  \
-	INIT_FLG_Z(res);                  \
-	INIT_FLG_P(res);                  \
-	INIT_FLG_A(m->registers[reg], 1); \
-	m->registers[reg] = res & 0xff;   \
+	tstates                 = 6;
+
+#define INR(reg)                           \
+	u16 res = m->registers[reg] + 1;       \
+	LAZY_FLAGS(res, m->registers[reg], 1); \
+	m->registers[reg] = res & 0xff;        \
 	tstates           = 4;
 
 #define INX(first)                                             \
@@ -171,26 +239,27 @@ static inline u8 next_byte(Machine *m, u8 *memory) {
 
 #define LDAX(first)                                    \
 	u16 from            = FROM_PAIR(first, first + 1); \
-	m->registers[REG_A] = memory[from];                \
+	m->registers[REG_A] = READ_BYTE(from);             \
 	tstates             = 7;
 
-#define LXI(first)                         \
-	m->registers[first + 1] = NEXT_BYTE(); \
-	m->registers[first]     = NEXT_BYTE(); \
+#define LXI(first)                           \
+	u16 data                = NEXT_DWORD();  \
+	m->registers[first + 1] = data & 0x00ff; \
+	m->registers[first]     = data >> 8;     \
 	tstates                 = 10;
 
 #define MOV(to, from)                      \
 	m->registers[to] = m->registers[from]; \
 	tstates          = 4;
 
-#define MOV_r_m(to)                  \
-	u16 from         = FROM_HL();    \
-	m->registers[to] = memory[from]; \
+#define MOV_r_m(to)                     \
+	u16 from         = FROM_HL();       \
+	m->registers[to] = READ_BYTE(from); \
 	tstates          = 7;
 
-#define MOV_m_r(from)                \
-	u16 to     = FROM_HL();          \
-	memory[to] = m->registers[from]; \
+#define MOV_m_r(from)                   \
+	u16 to     = FROM_HL();             \
+	WRITE_BYTE(to, m->registers[from]); \
 	tstates    = 7;
 
 #define MVI(to)                     \
@@ -200,27 +269,27 @@ static inline u8 next_byte(Machine *m, u8 *memory) {
 
 #define ORA(reg)                 \
 	u8 with = m->registers[reg]; \
-	LOGICAL_NOT_CMA(|);          \
+	LOGICAL_NOT_CMA(|, 0);       \
 	tstates = 4;
 
-#define POP(reg)                           \
-	m->registers[reg + 1] = memory[m->sp]; \
-	m->sp++;                               \
-	m->registers[reg] = memory[m->sp];     \
-	m->sp++;                               \
+#define POP(reg)                              \
+	m->registers[reg + 1] = READ_BYTE(m->sp); \
+	m->sp++;                                  \
+	m->registers[reg] = READ_BYTE(m->sp);     \
+	m->sp++;                                  \
 	tstates = 10;
 
-#define PUSH(reg)                              \
-	memory[m->sp - 1] = m->registers[reg];     \
-	memory[m->sp - 2] = m->registers[reg + 1]; \
-	m->sp -= 2;                                \
+#define PUSH(reg)                                 \
+	WRITE_BYTE(m->sp - 1, m->registers[reg]);     \
+	WRITE_BYTE(m->sp - 2, m->registers[reg + 1]); \
+	m->sp -= 2;                                   \
 	tstates = 12;
 
-#define RST(addr)                              \
-	memory[m->sp - 1] = (m->pc & 0xff00) >> 8; \
-	memory[m->sp - 2] = m->pc & 0x00ff;        \
-	m->sp -= 2;                                \
-	m->pc   = addr;                            \
+#define RST(addr)                                 \
+	WRITE_BYTE(m->sp - 1, (m->pc & 0xff00) >> 8); \
+	WRITE_BYTE(m->sp - 2, m->pc & 0x00ff);        \
+	m->sp -= 2;                                   \
+	m->pc   = addr;                               \
 	tstates = 12;
 
 #define SBB(reg)                                 \
@@ -230,7 +299,7 @@ static inline u8 next_byte(Machine *m, u8 *memory) {
 
 #define STAX(first)                           \
 	u16 to     = FROM_PAIR(first, first + 1); \
-	memory[to] = m->registers[REG_A];         \
+	WRITE_BYTE(to, m->registers[REG_A]);      \
 	tstates    = 7;
 
 #define SUB_r(reg)             \
@@ -240,1384 +309,469 @@ static inline u8 next_byte(Machine *m, u8 *memory) {
 
 #define XRA(reg)                 \
 	u8 with = m->registers[reg]; \
-	LOGICAL_NOT_CMA(^);          \
+	LOGICAL_NOT_CMA(^, 0);       \
 	tstates = 4;
 
-#define WARN_NOT_IMPLEMENTED(ins) pwarn("Instruction not implemented : " #ins);
-
-void run(Machine *m, u8 *memory, u8 step) {
-	u8 opcode;
-	u8 tstates = 0;
-	while((opcode = NEXT_BYTE()) != 0x76) {
-		switch(opcode) {
-			case 0xCE: // ACI Data
-			{
-				u8 with1 = NEXT_BYTE(), with2 = GET_FLAG(FLG_C);
-				ADD2();
-				tstates = 7;
-				break;
-			}
-			case 0x8F: // ADC A
-			{
-				ADC(REG_A);
-				break;
-			}
-			case 0x88: // ADC B
-			{
-				ADC(REG_B);
-				break;
-			}
-			case 0x89: // ADC C
-			{
-				ADC(REG_C);
-				break;
-			}
-			case 0x8A: // ADC D
-			{
-				ADC(REG_D);
-				break;
-			}
-			case 0x8B: // ADC E
-			{
-				ADC(REG_E);
-				break;
-			}
-			case 0x8C: // ADC H
-			{
-				ADC(REG_H);
-				break;
-			}
-			case 0x8D: // ADC L
-			{
-				ADC(REG_L);
-				break;
-			}
-			case 0x8E: // ADC M
-			{
-				u8 with1 = memory[FROM_HL()], with2 = GET_FLAG(FLG_C);
-				ADD2();
-				tstates = 7;
-				break;
-			}
-			case 0x87: // ADD A
-			{
-				ADD_R(REG_A);
-				break;
-			}
-			case 0x80: // ADD B
-			{
-				ADD_R(REG_B);
-				break;
-			}
-			case 0x81: // ADD C
-			{
-				ADD_R(REG_C);
-				break;
-			}
-			case 0x82: // ADD D
-			{
-				ADD_R(REG_D);
-				break;
-			}
-			case 0x83: // ADD E
-			{
-				ADD_R(REG_E);
-				break;
-			}
-			case 0x84: // ADD H
-			{
-				ADD_R(REG_H);
-				break;
-			}
-			case 0x85: // ADD L
-			{
-				ADD_R(REG_L);
-				break;
-			}
-			case 0x86: // ADD M
-			{
-				u8 with = memory[FROM_HL()];
-				ADD();
-				tstates = 7;
-				break;
-			}
-			case 0xC6: // ADI Data
-			{
-				u8 with = NEXT_BYTE();
-				ADD();
-				tstates = 7;
-				break;
-			}
-			case 0xA7: // ANA A
-			{
-				ANA(REG_A);
-				break;
-			}
-			case 0xA0: // ANA B
-			{
-				ANA(REG_B);
-				break;
-			}
-			case 0xA1: // ANA C
-			{
-				ANA(REG_C);
-				break;
-			}
-			case 0xA2: // ANA D
-			{
-				ANA(REG_D);
-				break;
-			}
-			case 0xA3: // ANA E
-			{
-				ANA(REG_E);
-				break;
-			}
-			case 0xA4: // ANA H
-			{
-				ANA(REG_H);
-				break;
-			}
-			case 0xA5: // ANA L
-			{
-				ANA(REG_L);
-				break;
-			}
-			case 0xA6: // ANA M
-			{
-				u8 with = memory[FROM_HL()];
-				LOGICAL_NOT_CMA(&);
-				SET_FLAG(FLG_A);
-				tstates = 7;
-				break;
-			}
-			case 0xE6: // ANI Data
-			{
-				u8 with = NEXT_BYTE();
-				LOGICAL_NOT_CMA(&);
-				SET_FLAG(FLG_A);
-				tstates = 7;
-				break;
-			}
-			case 0xCD: // CALL Label
-			{
-				CALL_ON(1);
-				break;
-			}
-			case 0xDC: // CC Label
-			{
-				CALL_ON(GET_FLAG(FLG_C));
-				break;
-			}
-			case 0xFC: // CM Label
-			{
-				CALL_ON(GET_FLAG(FLG_S));
-				break;
-			}
-			case 0x2F: // CMA
-			{
-				m->registers[REG_A] = ~m->registers[REG_A];
-				tstates             = 4;
-				break;
-			}
-			case 0x3F: // CMC
-			{
-				CHANGE_FLAG(FLG_C, !(GET_FLAG(FLG_C)));
-				tstates = 4;
-				break;
-			}
-			case 0xBF: // CMP A
-			{
-				CMP(REG_A);
-				break;
-			}
-			case 0xB8: // CMP B
-			{
-				CMP(REG_B);
-				break;
-			}
-			case 0xB9: // CMP C
-			{
-				CMP(REG_C);
-				break;
-			}
-			case 0xBA: // CMP D
-			{
-				CMP(REG_D);
-				break;
-			}
-			case 0xBB: // CMP E
-			{
-				CMP(REG_E);
-				break;
-			}
-			case 0xBC: // CMP H
-			{
-				CMP(REG_H);
-				break;
-			}
-			case 0xBD: // CMP L
-			{
-				CMP(REG_L);
-				break;
-			}
-			case 0xBE: // CMP M
-			{
-				u8 bak = m->registers[REG_A];
-				u8 by  = memory[FROM_HL()] + 1;
-				SUB();
-				m->registers[REG_A] = bak;
-				tstates             = 7;
-				break;
-			}
-			case 0xD4: // CNC Label
-			{
-				CALL_ON(!GET_FLAG(FLG_C));
-				break;
-			}
-			case 0xC4: // CNZ Label
-			{
-				CALL_ON(!GET_FLAG(FLG_Z));
-				break;
-			}
-			case 0xF4: // CP Label
-			{
-				CALL_ON(!GET_FLAG(FLG_S));
-				break;
-			}
-			case 0xEC: // CPE Label
-			{
-				CALL_ON(GET_FLAG(FLG_P));
-				break;
-			}
-			case 0xFE: // CPI Data
-			{
-				u8 bak = m->registers[REG_A];
-				u8 by  = NEXT_BYTE();
-				SUB();
-				CHANGE_FLAG(FLG_C, bak < by);
-				CHANGE_FLAG(FLG_Z, by == bak);
-				m->registers[REG_A] = bak;
-				tstates             = 7;
-				break;
-			}
-			case 0xE4: // CPO Label
-			{
-				CALL_ON(!GET_FLAG(FLG_P));
-				break;
-			}
-			case 0xCC: // CZ Label
-			{
-				CALL_ON(GET_FLAG(FLG_Z));
-				break;
-			}
-			case 0x27: // DAA
-			{
-				u8 low  = m->registers[REG_A] & 0x0f,
-				   high = m->registers[REG_A] & 0xf0;
-				u8 with = 0;
-				if(low > 9 || GET_FLAG(FLG_A))
-					with |= 0x06;
-				if(high > 9 || GET_FLAG(FLG_C))
-					with |= 0x60;
-				ADD();
-				tstates = 4;
-				break;
-			}
-			case 0x09: // DAD B
-			{
-				DAD_R(REG_B);
-				break;
-			}
-			case 0x19: // DAD D
-			{
-				DAD_R(REG_D);
-				break;
-			}
-			case 0x29: // DAD H
-			{
-				DAD_R(REG_H);
-				break;
-			}
-			case 0x39: // DAD SP
-			{
-				u16 with = m->sp;
-				DAD();
-				break;
-			}
-			case 0x3D: // DCR A
-			{
-				DCR(REG_A);
-				break;
-			}
-			case 0x05: // DCR B
-			{
-				DCR(REG_B);
-				break;
-			}
-			case 0x0D: // DCR C
-			{
-				DCR(REG_C);
-				break;
-			}
-			case 0x15: // DCR D
-			{
-				DCR(REG_D);
-				break;
-			}
-			case 0x1D: // DCR E
-			{
-				DCR(REG_E);
-				break;
-			}
-			case 0x25: // DCR H
-			{
-				DCR(REG_H);
-				break;
-			}
-			case 0x2D: // DCR L
-			{
-				DCR(REG_L);
-				break;
-			}
-			case 0x35: // DCR M
-			{
-				u16 res = memory[FROM_HL()] - 1;
-				INIT_FLG_S(res);
-				INIT_FLG_Z(res);
-				INIT_FLG_P(res);
-				INIT_FLG_A(memory[FROM_HL()], -1);
-				memory[FROM_HL()] = res & 0xff;
-				tstates           = 10;
-				break;
-			}
-			case 0x0B: // DCX B
-			{
-				DCX(REG_B);
-				break;
-			}
-			case 0x1B: // DCX D
-			{
-				DCX(REG_D);
-				break;
-			}
-			case 0x2B: // DCX H
-			{
-				DCX(REG_H);
-				break;
-			}
-			case 0x3B: // DCX SP
-			{
-				m->sp--;
-				tstates = 6;
-				break;
-			}
-			case 0xF3: // DI
-			{
-				WARN_NOT_IMPLEMENTED(DI);
-				break;
-			}
-			case 0xFB: // EI
-			{
-				WARN_NOT_IMPLEMENTED(EI);
-				break;
-			}
-			case 0x76: // HLT
-			{
-				m->isbroken = 0;
-				tstates     = 5;
-				return;
-			}
-			case 0xDB: // IN Port-Address
-			{
-				u8  addr = NEXT_BYTE();
-				u32 val;
-				pblue("\n[in:0x%x] ", addr);
-				scanf("%x", &val);
-				m->registers[REG_A] = (u8)val;
-				tstates             = 10;
-				break;
-			}
-			case 0x3C: // INR A
-			{
-				INR(REG_A);
-				break;
-			}
-			case 0x04: // INR B
-			{
-				INR(REG_B);
-				break;
-			}
-			case 0x0C: // INR C
-			{
-				INR(REG_C);
-				break;
-			}
-			case 0x14: // INR D
-			{
-				INR(REG_D);
-				break;
-			}
-			case 0x1C: // INR E
-			{
-				INR(REG_E);
-				break;
-			}
-			case 0x24: // INR H
-			{
-				INR(REG_H);
-				break;
-			}
-			case 0x2C: // INR L
-			{
-				INR(REG_L);
-				break;
-			}
-			case 0x34: // INR M
-			{
-				u16 res = memory[FROM_HL()] + 1;
-				INIT_FLG_S(res);
-				INIT_FLG_Z(res);
-				INIT_FLG_P(res);
-				INIT_FLG_A(memory[FROM_HL()], 1);
-				memory[FROM_HL()] = res & 0xff;
-				tstates           = 10;
-				break;
-			}
-			case 0x03: // INX B
-			{
-				INX(REG_B);
-				break;
-			}
-			case 0x13: // INX D
-			{
-				INX(REG_D);
-				break;
-			}
-			case 0x23: // INX H
-			{
-				INX(REG_H);
-				break;
-			}
-			case 0x33: // INX SP
-			{
-				m->sp++;
-				tstates = 6;
-				break;
-			}
-			case 0xDA: // JC Label
-			{
-				JMP_ON(GET_FLAG(FLG_C));
-				break;
-			}
-			case 0xFA: // JM Label
-			{
-				JMP_ON(GET_FLAG(FLG_S));
-				break;
-			}
-			case 0xC3: // JMP Label
-			{
-				JMP_ON(1);
-				break;
-			}
-			case 0xD2: // JNC Label
-			{
-				JMP_ON(!GET_FLAG(FLG_C));
-				break;
-			}
-			case 0xC2: // JNZ Label
-			{
-				JMP_ON(!GET_FLAG(FLG_Z));
-				break;
-			}
-			case 0xF2: // JP Label
-			{
-				JMP_ON(!GET_FLAG(FLG_S));
-				break;
-			}
-			case 0xEA: // JPE Label
-			{
-				JMP_ON(GET_FLAG(FLG_P));
-				break;
-			}
-			case 0xE2: // JPO Label
-			{
-				JMP_ON(!GET_FLAG(FLG_P));
-				break;
-			}
-			case 0xCA: // JZ Label
-			{
-				JMP_ON(GET_FLAG(FLG_Z));
-				break;
-			}
-			case 0x3A: // LDA Address
-			{
-				m->registers[REG_A] = memory[NEXT_DWORD()];
-				tstates             = 13;
-				break;
-			}
-			case 0x0A: // LDAX B
-			{
-				LDAX(REG_B);
-				break;
-			}
-			case 0x1A: // LDAX D
-			{
-				LDAX(REG_D);
-				break;
-			}
-			case 0x2A: // LHLD Address
-			{
-				u16 addr            = NEXT_DWORD();
-				m->registers[REG_L] = memory[addr];
-				m->registers[REG_H] = memory[addr + 1];
-				tstates             = 16;
-				break;
-			}
-			case 0x01: // LXI B
-			{
-				LXI(REG_B);
-				break;
-			}
-			case 0x11: // LXI D
-			{
-				LXI(REG_D);
-				break;
-			}
-			case 0x21: // LXI H
-			{
-				LXI(REG_H);
-				break;
-			}
-			case 0x31: // LXI SP
-			{
-				m->sp   = NEXT_DWORD();
-				tstates = 10;
-				break;
-			}
-			case 0x7F: // MOV A, A
-			{
-				MOV(REG_A, REG_A);
-				break;
-			}
-			case 0x78: // MOV A, B
-			{
-				MOV(REG_A, REG_B);
-				break;
-			}
-			case 0x79: // MOV A, C
-			{
-				MOV(REG_A, REG_C);
-				break;
-			}
-			case 0x7A: // MOV A, D
-			{
-				MOV(REG_A, REG_D);
-				break;
-			}
-			case 0x7B: // MOV A, E
-			{
-				MOV(REG_A, REG_E);
-				break;
-			}
-			case 0x7C: // MOV A, H
-			{
-				MOV(REG_A, REG_H);
-				break;
-			}
-			case 0x7D: // MOV A, L
-			{
-				MOV(REG_A, REG_L);
-				break;
-			}
-			case 0x7E: // MOV A, M
-			{
-				MOV_r_m(REG_A);
-				break;
-			}
-			case 0x47: // MOV B, A
-			{
-				MOV(REG_B, REG_A);
-				break;
-			}
-			case 0x40: // MOV B, B
-			{
-				MOV(REG_B, REG_B);
-				break;
-			}
-			case 0x41: // MOV B, C
-			{
-				MOV(REG_B, REG_C);
-				break;
-			}
-			case 0x42: // MOV B, D
-			{
-				MOV(REG_B, REG_D);
-				break;
-			}
-			case 0x43: // MOV B, E
-			{
-				MOV(REG_B, REG_E);
-				break;
-			}
-			case 0x44: // MOV B, H
-			{
-				MOV(REG_B, REG_H);
-				break;
-			}
-			case 0x45: // MOV B, L
-			{
-				MOV(REG_B, REG_L);
-				break;
-			}
-			case 0x46: // MOV B, M
-			{
-				MOV_r_m(REG_B);
-				break;
-			}
-			case 0x4F: // MOV C, A
-			{
-				MOV(REG_C, REG_A);
-				break;
-			}
-			case 0x48: // MOV C, B
-			{
-				MOV(REG_C, REG_B);
-				break;
-			}
-			case 0x49: // MOV C, C
-			{
-				MOV(REG_C, REG_C);
-				break;
-			}
-			case 0x4A: // MOV C, D
-			{
-				MOV(REG_C, REG_D);
-				break;
-			}
-			case 0x4B: // MOV C, E
-			{
-				MOV(REG_C, REG_E);
-				break;
-			}
-			case 0x4C: // MOV C, H
-			{
-				MOV(REG_C, REG_H);
-				break;
-			}
-			case 0x4D: // MOV C, L
-			{
-				MOV(REG_C, REG_L);
-				break;
-			}
-			case 0x4E: // MOV C, M
-			{
-				MOV_r_m(REG_C);
-				break;
-			}
-			case 0x57: // MOV D, A
-			{
-				MOV(REG_D, REG_A);
-				break;
-			}
-			case 0x50: // MOV D, B
-			{
-				MOV(REG_D, REG_B);
-				break;
-			}
-			case 0x51: // MOV D, C
-			{
-				MOV(REG_D, REG_C);
-				break;
-			}
-			case 0x52: // MOV D, D
-			{
-				MOV(REG_D, REG_D);
-				break;
-			}
-			case 0x53: // MOV D, E
-			{
-				MOV(REG_D, REG_E);
-				break;
-			}
-			case 0x54: // MOV D, H
-			{
-				MOV(REG_D, REG_H);
-				break;
-			}
-			case 0x55: // MOV D, L
-			{
-				MOV(REG_D, REG_L);
-				break;
-			}
-			case 0x56: // MOV D, M
-			{
-				MOV_r_m(REG_D);
-				break;
-			}
-			case 0x5F: // MOV E, A
-			{
-				MOV(REG_E, REG_A);
-				break;
-			}
-			case 0x58: // MOV E, B
-			{
-				MOV(REG_E, REG_B);
-				break;
-			}
-			case 0x59: // MOV E, C
-			{
-				MOV(REG_E, REG_C);
-				break;
-			}
-			case 0x5A: // MOV E, D
-			{
-				MOV(REG_E, REG_D);
-				break;
-			}
-			case 0x5B: // MOV E, E
-			{
-				MOV(REG_E, REG_E);
-				break;
-			}
-			case 0x5C: // MOV E, H
-			{
-				MOV(REG_E, REG_H);
-				break;
-			}
-			case 0x5D: // MOV E, L
-			{
-				MOV(REG_E, REG_L);
-				break;
-			}
-			case 0x5E: // MOV E, M
-			{
-				MOV_r_m(REG_E);
-				break;
-			}
-			case 0x67: // MOV H, A
-			{
-				MOV(REG_H, REG_A);
-				break;
-			}
-			case 0x60: // MOV H, B
-			{
-				MOV(REG_H, REG_B);
-				break;
-			}
-			case 0x61: // MOV H, C
-			{
-				MOV(REG_H, REG_C);
-				break;
-			}
-			case 0x62: // MOV H, D
-			{
-				MOV(REG_H, REG_D);
-				break;
-			}
-			case 0x63: // MOV H, E
-			{
-				MOV(REG_H, REG_E);
-				break;
-			}
-			case 0x64: // MOV H, H
-			{
-				MOV(REG_H, REG_H);
-				break;
-			}
-			case 0x65: // MOV H, L
-			{
-				MOV(REG_H, REG_L);
-				break;
-			}
-			case 0x66: // MOV H, M
-			{
-				MOV_r_m(REG_H);
-				break;
-			}
-			case 0x6F: // MOV L, A
-			{
-				MOV(REG_L, REG_A);
-				break;
-			}
-			case 0x68: // MOV L, B
-			{
-				MOV(REG_L, REG_B);
-				break;
-			}
-			case 0x69: // MOV L, C
-			{
-				MOV(REG_L, REG_C);
-				break;
-			}
-			case 0x6A: // MOV L, D
-			{
-				MOV(REG_L, REG_D);
-				break;
-			}
-			case 0x6B: // MOV L, E
-			{
-				MOV(REG_L, REG_E);
-				break;
-			}
-			case 0x6C: // MOV L, H
-			{
-				MOV(REG_L, REG_H);
-				break;
-			}
-			case 0x6D: // MOV L, L
-			{
-				MOV(REG_L, REG_L);
-				break;
-			}
-			case 0x6E: // MOV L, M
-			{
-				MOV_r_m(REG_L);
-				break;
-			}
-			case 0x77: // MOV M, A
-			{
-				MOV_m_r(REG_A);
-				break;
-			}
-			case 0x70: // MOV M, B
-			{
-				MOV_m_r(REG_B);
-				break;
-			}
-			case 0x71: // MOV M, C
-			{
-				MOV_m_r(REG_C);
-				break;
-			}
-			case 0x72: // MOV M, D
-			{
-				MOV_m_r(REG_D);
-				break;
-			}
-			case 0x73: // MOV M, E
-			{
-				MOV_m_r(REG_E);
-				break;
-			}
-			case 0x74: // MOV M, H
-			{
-				MOV_m_r(REG_H);
-				break;
-			}
-			case 0x75: // MOV M, L
-			{
-				MOV_m_r(REG_L);
-				break;
-			}
-			case 0x3E: // MVI A, Data
-			{
-				MVI(REG_A);
-				break;
-			}
-			case 0x06: // MVI B, Data
-			{
-				MVI(REG_B);
-				break;
-			}
-			case 0x0E: // MVI C, Data
-			{
-				MVI(REG_C);
-				break;
-			}
-			case 0x16: // MVI D, Data
-			{
-				MVI(REG_D);
-				break;
-			}
-			case 0x1E: // MVI E, Data
-			{
-				MVI(REG_E);
-				break;
-			}
-			case 0x26: // MVI H, Data
-			{
-				MVI(REG_H);
-				break;
-			}
-			case 0x2E: // MVI L, Data
-			{
-				MVI(REG_L);
-				break;
-			}
-			case 0x36: // MVI M, Data
-			{
-				u16 to     = FROM_HL();
-				memory[to] = NEXT_BYTE();
-				tstates    = 10;
-				break;
-			}
-			case 0x00: // NOP
-			{
-				tstates = 4;
-				break;
-			}
-			case 0xB7: // ORA A
-			{
-				ORA(REG_A);
-				break;
-			}
-			case 0xB0: // ORA B
-			{
-				ORA(REG_B);
-				break;
-			}
-			case 0xB1: // ORA C
-			{
-				ORA(REG_C);
-				break;
-			}
-			case 0xB2: // ORA D
-			{
-				ORA(REG_D);
-				break;
-			}
-			case 0xB3: // ORA E
-			{
-				ORA(REG_E);
-				break;
-			}
-			case 0xB4: // ORA H
-			{
-				ORA(REG_H);
-				break;
-			}
-			case 0xB5: // ORA L
-			{
-				ORA(REG_L);
-				break;
-			}
-			case 0xB6: // ORA M
-			{
-				u8 with = memory[FROM_HL()];
-				LOGICAL_NOT_CMA(|);
-				tstates = 7;
-				break;
-			}
-			case 0xF6: // ORI Data
-			{
-				u8 with = NEXT_BYTE();
-				LOGICAL_NOT_CMA(|);
-				tstates = 7;
-				break;
-			}
-			case 0xD3: // OUT Port-Address
-			{
-				u8 addr = NEXT_BYTE();
-				tstates = 7;
-				if(!m->issilent) {
-					pylw("\n[out:0x%x]", addr);
-					printf(" 0x%x", m->registers[REG_A]);
-					fflush(stdout);
-					tstates = 10;
-				}
-				break;
-			}
-			case 0xE9: // PCHL
-			{
-				m->pc = m->registers[REG_L];
-				m->pc |= (m->registers[REG_H] << 8);
-				tstates = 6;
-				break;
-			}
-			case 0xC1: // POP B
-			{
-				POP(REG_B);
-				break;
-			}
-			case 0xD1: // POP D
-			{
-				POP(REG_D);
-				break;
-			}
-			case 0xE1: // POP H
-			{
-				POP(REG_H);
-				break;
-			}
-			case 0xF1: // POP PSW
-			{
-				m->registers[REG_FL] = memory[m->sp];
-				m->sp++;
-				m->registers[REG_A] = memory[m->sp];
-				m->sp++;
-				tstates = 10;
-				break;
-			}
-			case 0xC5: // PUSH B
-			{
-				PUSH(REG_B);
-				break;
-			}
-			case 0xD5: // PUSH D
-			{
-				PUSH(REG_D);
-				break;
-			}
-			case 0xE5: // PUSH H
-			{
-				PUSH(REG_H);
-				break;
-			}
-			case 0xF5: // PUSH PSW
-			{
-				memory[m->sp - 1] = m->registers[REG_A];
-				memory[m->sp - 2] = m->registers[REG_FL];
-				m->sp -= 2;
-				tstates = 12;
-				break;
-			}
-			case 0x17: // RAL
-			{
-				u8 d7 = m->registers[REG_A] >> 7;
-				u8 d0 = GET_FLAG(FLG_C);
-				CHANGE_FLAG(FLG_C, d7); // Set/reset the carry
-				m->registers[REG_A] <<= 1;
-				m->registers[REG_A] |= d0;
-				tstates = 4;
-				break;
-			}
-			case 0x1F: // RAR
-			{
-				u8 d0 = m->registers[REG_A] & 1;
-				u8 d7 = GET_FLAG(FLG_C);
-				CHANGE_FLAG(FLG_C, d0); // Set/reset the carry
-				m->registers[REG_A] >>= 1;
-				m->registers[REG_A] |= (d7 << 7);
-				tstates = 4;
-				break;
-			}
-			case 0xD8: // RC
-			{
-				RET_ON(GET_FLAG(FLG_C));
-				break;
-			}
-			case 0xC9: // RET
-			{
-				RET_ON(1);
-				break;
-			}
-			case 0x20: // RIM
-			{
-				WARN_NOT_IMPLEMENTED(RIM);
-				break;
-			}
-			case 0x07: // RLC
-			{
-				u8 d7 = m->registers[REG_A] >> 7;
-				CHANGE_FLAG(FLG_C, d7); // Set/reset the carry
-				m->registers[REG_A] <<= 1;
-				m->registers[REG_A] |= d7;
-				tstates = 4;
-				break;
-			}
-			case 0xF8: // RM
-			{
-				RET_ON(GET_FLAG(FLG_S));
-				break;
-			}
-			case 0xD0: // RNC
-			{
-				RET_ON(!GET_FLAG(FLG_C));
-				break;
-			}
-			case 0xC0: // RNZ
-			{
-				RET_ON(!GET_FLAG(FLG_Z));
-				break;
-			}
-			case 0xF0: // RP
-			{
-				RET_ON(!GET_FLAG(FLG_S));
-				break;
-			}
-			case 0xE8: // RPE
-			{
-				RET_ON(GET_FLAG(FLG_P));
-				break;
-			}
-			case 0xE0: // RPO
-			{
-				RET_ON(!GET_FLAG(FLG_P));
-				break;
-			}
-			case 0x0F: // RRC
-			{
-				u8 d0 = m->registers[REG_A] & 1;
-				CHANGE_FLAG(FLG_C, d0); // Set/reset the carry
-				m->registers[REG_A] >>= 1;
-				m->registers[REG_A] |= (d0 << 7);
-				tstates = 4;
-				break;
-			}
-			case 0xC7: // RST 0
-			{
-				RST(0x0000);
-				break;
-			}
-			case 0xCF: // RST 1
-			{
-				RST(0x0008);
-				break;
-			}
-			case 0xD7: // RST 2
-			{
-				RST(0x0010);
-				break;
-			}
-			case 0xDF: // RST 3
-			{
-				RST(0x0018);
-				break;
-			}
-			case 0xE7: // RST 4
-			{
-				RST(0x0020);
-				break;
-			}
-			case 0xEF: // RST 5
-			{
-				RST(0x0028);
-				break;
-			}
-			case 0xF7: // RST 6
-			{
-				RST(0x0030);
-				break;
-			}
-			case 0xFF: // RST 7
-			{
-				RST(0x0038);
-				break;
-			}
-			case 0xC8: // RZ
-			{
-				RET_ON(GET_FLAG(FLG_Z));
-				break;
-			}
-			case 0x9F: // SBB A
-			{
-				SBB(REG_A);
-				break;
-			}
-			case 0x98: // SBB B
-			{
-				SBB(REG_B);
-				break;
-			}
-			case 0x99: // SBB C
-			{
-				SBB(REG_C);
-				break;
-			}
-			case 0x9A: // SBB D
-			{
-				SBB(REG_D);
-				break;
-			}
-			case 0x9B: // SBB E
-			{
-				SBB(REG_E);
-				break;
-			}
-			case 0x9C: // SBB H
-			{
-				SBB(REG_H);
-				break;
-			}
-			case 0x9D: // SBB L
-			{
-				SBB(REG_L);
-				break;
-			}
-			case 0x9E: // SBB M
-			{
-				u8 by = memory[FROM_HL()] + GET_FLAG(FLG_C);
-				SUB();
-				tstates = 7;
-				break;
-			}
-			case 0xDE: // SBI Data
-			{
-				u8 by = NEXT_BYTE() + GET_FLAG(FLG_C);
-				SUB();
-				tstates = 7;
-				break;
-			}
-			case 0x22: // SHLD Address
-			{
-				u16 addr         = NEXT_DWORD();
-				memory[addr]     = m->registers[REG_L];
-				memory[addr + 1] = m->registers[REG_H];
-				tstates          = 16;
-				break;
-			}
-			case 0x30: // SIM
-			{
-				WARN_NOT_IMPLEMENTED(SIM);
-				break;
-			}
-			case 0xF9: // SPHL
-			{
-				m->sp   = FROM_HL();
-				tstates = 6;
-				break;
-			}
-			case 0x32: // STA Address
-			{
-				u16 to     = NEXT_DWORD();
-				memory[to] = m->registers[REG_A];
-				tstates    = 13;
-				break;
-			}
-			case 0x02: // STAX B
-			{
-				STAX(REG_B);
-				break;
-			}
-			case 0x12: // STAX D
-			{
-				STAX(REG_D);
-				break;
-			}
-			case 0x37: // STC
-			{
-				SET_FLAG(FLG_C);
-				break;
-			}
-			case 0x97: // SUB A
-			{
-				SUB_r(REG_A);
-				break;
-			}
-			case 0x90: // SUB B
-			{
-				SUB_r(REG_B);
-				break;
-			}
-			case 0x91: // SUB C
-			{
-				SUB_r(REG_C);
-				break;
-			}
-			case 0x92: // SUB D
-			{
-				SUB_r(REG_D);
-				break;
-			}
-			case 0x93: // SUB E
-			{
-				SUB_r(REG_E);
-				break;
-			}
-			case 0x94: // SUB H
-			{
-				SUB_r(REG_H);
-				break;
-			}
-			case 0x95: // SUB L
-			{
-				SUB_r(REG_L);
-				break;
-			}
-			case 0x96: // SUB M
-			{
-				u8 by = memory[FROM_HL()];
-				SUB();
-				tstates = 7;
-				break;
-			}
-			case 0xD6: // SUI Data
-			{
-				u8 by = NEXT_BYTE();
-				SUB();
-				tstates = 7;
-				break;
-			}
-			case 0xEB: // XCHG
-			{
-				u8 td               = m->registers[REG_D];
-				u8 te               = m->registers[REG_E];
-				m->registers[REG_D] = m->registers[REG_H];
-				m->registers[REG_E] = m->registers[REG_L];
-				m->registers[REG_H] = td;
-				m->registers[REG_L] = te;
-				tstates             = 4;
-				break;
-			}
-			case 0xAF: // XRA A
-			{
-				XRA(REG_A);
-				break;
-			}
-			case 0xA8: // XRA B
-			{
-				XRA(REG_B);
-				break;
-			}
-			case 0xA9: // XRA C
-			{
-				XRA(REG_C);
-				break;
-			}
-			case 0xAA: // XRA D
-			{
-				XRA(REG_D);
-				break;
-			}
-			case 0xAB: // XRA E
-			{
-				XRA(REG_E);
-				break;
-			}
-			case 0xAC: // XRA H
-			{
-				XRA(REG_H);
-				break;
-			}
-			case 0xAD: // XRA L
-			{
-				XRA(REG_L);
-				break;
-			}
-			case 0xAE: // XRA M
-			{
-				u8 with = memory[FROM_HL()];
-				LOGICAL_NOT_CMA(^);
-				tstates = 7;
-				break;
-			}
-			case 0xEE: // XRI Data
-			{
-				u8 with = NEXT_BYTE();
-				LOGICAL_NOT_CMA(^);
-				tstates = 7;
-				break;
-			}
-			case 0xE3: // XTHL
-			{
-				u8 td               = memory[m->sp + 1];
-				u8 te               = memory[m->sp];
-				memory[m->sp + 1]   = m->registers[REG_H];
-				memory[m->sp]       = m->registers[REG_L];
-				m->registers[REG_H] = td;
-				m->registers[REG_L] = te;
-				tstates             = 16;
-				break;
-			}
-		}
-		if(m->sleepfor.tv_nsec > 0) {
-			struct timespec timetosleep = m->sleepfor;
-			timetosleep.tv_nsec *= tstates;
-			nanosleep(&timetosleep, NULL);
+// How far, in ns, a throttled machine may fall behind before it stops
+// trying to catch up
+#define THROTTLE_MAX_LAG 100000000
+
+// Sleeps until the wall clock reaches the time at which a machine
+// running at its frequency would have executed 'cycles'. The deadlines
+// are absolute, so sleeping too long once is made up by the next
+// slices, but a machine which has fallen far behind, as when the host
+// is too slow or was suspended, starts counting afresh rather than
+// racing to catch up. How late the host wakes the machine up is
+// measured on every sleep, and the machine asks to be woken up that
+// much earlier, so that the last sleep of a run ends on time too.
+static void throttle(Machine *m, u64 cycles) {
+	u64 deadline = m->throttle.origin + (cycles - m->throttle.cycles) *
+	                                        1000000000.0 / m->throttle.hz;
+	u64 now  = monotonic_ns();
+	u64 wake = deadline - m->throttle.lead;
+	if(now > deadline + THROTTLE_MAX_LAG) {
+		m->throttle.origin = now;
+		m->throttle.cycles = cycles;
+	} else if(now < wake) {
+		// What a throttled machine writes out is shown as it runs
+		io_flush(m);
+		sleep_until_ns(wake);
+		u64 late         = monotonic_ns() - wake;
+		m->throttle.lead = (m->throttle.lead * 7 + late) / 8;
+	}
+}
+
+// The cycles at which the core has to stop next, either to return at
+// the end of the budget, to throttle the machine at the end of the
+// present slice, or to fire the next event, or right after the present
+// instruction to take an interrupt
+static inline u64 next_stop(Machine *m, u64 cycles) {
+	if(m->interrupts.ready)
+		return cycles;
+	u64 stop = m->cycle_limit;
+	if(m->throttle.hz > 0 && stop - cycles > m->throttle.slice)
+		stop = cycles + m->throttle.slice;
+	return m->next_event < stop ? m->next_event : stop;
+}
+
+// The cores keep the counters of the machine in locals, which the host
+// can hold in registers, and store them back whenever they return
+#define COUNTERS()                      \
+	u64 cycles       = m->cycles;       \
+	u64 instructions = m->instructions; \
+	u64 stop_at      = next_stop(m, m->cycles);
+#define SAVE_COUNTERS()       \
+	m->cycles       = cycles; \
+	m->instructions = instructions;
+#define LEAVE(status)    \
+	{                    \
+		SAVE_COUNTERS(); \
+		return status;   \
+	}
+
+// The debug cores journal, trace and profile each instruction once it
+// is done
+#define RECORD(tstates)                       \
+	if(m->hooks & HOOK_JOURNAL)               \
+		journal_record(m);                    \
+	if(m->hooks & HOOK_TRACE)                 \
+		trace_record(m, memory, tstates);     \
+	if(m->hooks & HOOK_PROFILE)               \
+		profile_record(m, tstates);           \
+	if(m->hooks & HOOK_CALLGRAPH)             \
+		callgraph_record(m, memory, tstates);
+
+// And each interrupt they take, as a record of its own but in the
+// journal, which keeps it along with the instruction after it, and as
+// a call of its vector in the call graph
+#define RECORD_INTERRUPT()             \
+	if(m->hooks & HOOK_TRACE)          \
+		trace_interrupt(m, memory);    \
+	if(m->hooks & HOOK_PROFILE)        \
+		profile_interrupt(m);          \
+	if(m->hooks & HOOK_CALLGRAPH)      \
+		callgraph_interrupt(m, memory);
+
+// Brings 'stop_at' up to date once the present instruction may have
+// made an interrupt ready to be taken, or scheduled an event
+#define CHECK_STOP() stop_at = next_stop(m, cycles);
+
+// What the core does once it has taken an interrupt, which only the
+// block core needs to do anything for
+#define INTERRUPTED() {}
+
+// Fires the events which are due, returns at the end of the budget,
+// sleeps at the end of a slice to keep to the frequency, and takes an
+// interrupt which is ready, once the core reaches 'stop_at'
+#define STOP()                                                    \
+	{                                                             \
+		if(cycles >= m->next_event) {                             \
+			SAVE_COUNTERS();                                      \
+			event_fire(m);                                        \
+		}                                                         \
+		if(cycles >= m->cycle_limit)                              \
+			LEAVE(RUN_BUDGET);                                    \
+		if(RUN_MODE != MODE_FAST && m->throttle.hz > 0)           \
+			throttle(m, cycles);                                  \
+		u8 taken = CORE(take_interrupt)(m, memory, instructions); \
+		cycles += taken;                                          \
+		stop_at = next_stop(m, cycles);                           \
+		if(taken)                                                 \
+			INTERRUPTED();                                        \
+	}
+
+// Count the instruction, record it in the debug mode, and stop if the
+// machine has reached a breakpoint, after each instruction. The one test
+// of 'stop_at' covers the budget, the throttle, the events and the
+// interrupts.
+#define POST_EXECUTE()                             \
+	cycles += tstates;                             \
+	instructions++;                                \
+	if(RUN_MODE == MODE_DEBUG) {                   \
+		SAVE_COUNTERS();                           \
+		RECORD(tstates);                           \
+		if(machine_on_breakpoint(m, memory, step)) \
+			return RUN_BROKEN;                     \
+	}                                              \
+	if(cycles >= stop_at)                          \
+		STOP();
+
+// clang-format off
+const u8 opcode_length[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x00
+    1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, // 0x10
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, // 0x20
+    1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, // 0x30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x50
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x70
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x90
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xA0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xB0
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1, // 0xC0
+    1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 1, 2, 1, // 0xD0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // 0xE0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // 0xF0
+};
+// clang-format on
+
+#ifdef NEOVM_THREADED
+// Addresses of the handlers of all the opcodes, for the cores which
+// jump to them directly
+#define HANDLER_TABLE                                    \
+	{                                                    \
+	    &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03,      \
+	    &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,      \
+	    &&op_undefined, &&op_0x09, &&op_0x0A, &&op_0x0B, \
+	    &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,      \
+	    &&op_undefined, &&op_0x11, &&op_0x12, &&op_0x13, \
+	    &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,      \
+	    &&op_undefined, &&op_0x19, &&op_0x1A, &&op_0x1B, \
+	    &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,      \
+	    &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23,      \
+	    &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,      \
+	    &&op_undefined, &&op_0x29, &&op_0x2A, &&op_0x2B, \
+	    &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,      \
+	    &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33,      \
+	    &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,      \
+	    &&op_undefined, &&op_0x39, &&op_0x3A, &&op_0x3B, \
+	    &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,      \
+	    &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43,      \
+	    &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,      \
+	    &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B,      \
+	    &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,      \
+	    &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53,      \
+	    &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,      \
+	    &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B,      \
+	    &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,      \
+	    &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63,      \
+	    &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,      \
+	    &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B,      \
+	    &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,      \
+	    &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73,      \
+	    &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,      \
+	    &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B,      \
+	    &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,      \
+	    &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83,      \
+	    &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,      \
+	    &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B,      \
+	    &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,      \
+	    &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93,      \
+	    &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,      \
+	    &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B,      \
+	    &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,      \
+	    &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3,      \
+	    &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,      \
+	    &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB,      \
+	    &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,      \
+	    &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3,      \
+	    &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,      \
+	    &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB,      \
+	    &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,      \
+	    &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3,      \
+	    &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,      \
+	    &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_undefined, \
+	    &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,      \
+	    &&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3,      \
+	    &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,      \
+	    &&op_0xD8, &&op_undefined, &&op_0xDA, &&op_0xDB, \
+	    &&op_0xDC, &&op_undefined, &&op_0xDE, &&op_0xDF, \
+	    &&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_0xE3,      \
+	    &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_0xE7,      \
+	    &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_0xEB,      \
+	    &&op_0xEC, &&op_undefined, &&op_0xEE, &&op_0xEF, \
+	    &&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3,      \
+	    &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7,      \
+	    &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB,      \
+	    &&op_0xFC, &&op_undefined, &&op_0xFE, &&op_0xFF  \
+	}
+
+// The block core
+// ==============
+// The block core decodes a basic block only the first time it is
+// reached, to an array of handler addresses with their operands
+// already extracted, and executes it from the cache afterwards.
+// A block ends at the first instruction which may change the flow
+// of control, so all the instructions of a block always execute
+// in order, and each block remembers the blocks it exited to, so
+// that loops can go from one block to the next without a lookup.
+
+#define MAX_BLOCK_LENGTH 32
+// Number of times a block is entered before it is compiled by the JIT
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 16
+#endif
+
+typedef struct {
+	const void *handler; // address of the handler in run_block
+	u16         operand; // the byte or the word following the opcode
+	u16         next;    // address of the next instruction
+} Predecoded;
+
+typedef struct Block {
+	struct Block *link[2];   // the last two blocks this one exited to
+	struct Block *allocated; // the next block in the list of all blocks
+	u16           start;     // address of the first instruction
+	u16           length;    // number of bytes decoded
+	u16           count;     // number of instructions
+#ifdef NEOVM_JIT
+	u32      hits;   // number of times the block was entered
+	JitBlock native; // the compiled block, if any
+#endif
+	Predecoded code[]; // the instructions, followed by an exit
+} Block;
+
+struct BlockCache {
+	u8 *               memory;   // the memory the blocks were decoded from
+	const void *const *handlers; // the handlers of the core decoding them
+	u8                 stale;    // denotes a write to a decoded address
+	Block *            allocated;         // list of all the decoded blocks
+	Block *            blocks[0x10000];   // decoded blocks by their address
+	u8                 code[0x10000 / 8]; // addresses which are in some block
+#ifdef NEOVM_JIT
+	Jit *jit; // compiles the blocks for the jit engine
+#endif
+};
+
+#define IS_CODE(cache, addr) ((cache)->code[(addr) >> 3] & (1 << ((addr)&7)))
+
+// Returns true if the instruction may change the flow of control
+static bool ends_block(u8 opcode) {
+	switch(opcode) {
+		case 0x76: // HLT
+		case 0xE9: // PCHL
+			return true;
+	}
+	// All jumps, calls, returns and restarts are of the form 11xxxxxx,
+	// with one of the following as the last three bits
+	switch(opcode & 0xC7) {
+		case 0xC0: // Rcc
+		case 0xC2: // Jcc
+		case 0xC4: // Ccc
+		case 0xC7: // RST
+			return true;
+	}
+	return opcode == 0xC3 || opcode == 0xC9 || opcode == 0xCD; // JMP RET CALL
+}
+
+static Block *block_decode(struct BlockCache *cache, u16 start,
+                           const void *const *handlers, const void *exit) {
+	u8 *       memory = cache->memory;
+	Predecoded code[MAX_BLOCK_LENGTH];
+	u16        count = 0, pc = start;
+	while(count < MAX_BLOCK_LENGTH) {
+		u8 opcode            = memory[pc];
+		code[count].handler  = handlers[opcode];
+		code[count].operand  = memory[(u16)(pc + 1)];
+		if(opcode_length[opcode] == 3)
+			code[count].operand |= memory[(u16)(pc + 2)] << 8;
+		pc += opcode_length[opcode];
+		code[count++].next = pc;
+		if(ends_block(opcode))
+			break;
+	}
+
+	Block *block =
+	    (Block *)malloc(sizeof(Block) + sizeof(Predecoded) * (count + 1));
+	memcpy(block->code, code, sizeof(Predecoded) * count);
+	block->code[count].handler = exit;
+	block->link[0] = block->link[1] = NULL;
+	block->start                    = start;
+	block->length                   = pc - start;
+	block->count                    = count;
+#ifdef NEOVM_JIT
+	block->hits   = 0;
+	block->native = NULL;
+#endif
+	for(u16 i = 0; i < block->length; i++) {
+		u16 addr = start + i;
+		cache->code[addr >> 3] |= 1 << (addr & 7);
+	}
+
+	block->allocated     = cache->allocated;
+	cache->allocated     = block;
+	cache->blocks[start] = block;
+	return block;
+}
+
+static void cache_flush(struct BlockCache *cache) {
+	while(cache->allocated) {
+		Block *block     = cache->allocated;
+		cache->allocated = block->allocated;
+		for(u16 i = 0; i < block->length; i++) {
+			u16 addr = block->start + i;
+			cache->code[addr >> 3] &= ~(1 << (addr & 7));
 		}
-		if(machine_on_breakpoint(m, memory, step))
-			return;
+		cache->blocks[block->start] = NULL;
+		free(block);
+	}
+	cache->stale = 0;
+#ifdef NEOVM_JIT
+	if(cache->jit)
+		jit_reset(cache->jit);
+#endif
+}
+
+#define BLOCK_AT(pc)                       \
+	(cache->blocks[pc] ? cache->blocks[pc] \
+	                   : block_decode(cache, pc, handlers, &&block_exit))
+
+#endif
+
+// What the cores check after each instruction. Each core is compiled
+// once for each mode, and run() picks the one the state of the machine
+// needs, so that headless runs do not check for anything at all.
+#define MODE_FAST 0      // nothing
+#define MODE_THROTTLED 1 // sleeps to keep to the calibrated frequency
+#define MODE_DEBUG 2     // also stops at breakpoints and after a step
+
+#define RUN_MODE MODE_FAST
+#define CORE(name) name##_fast
+#include "neovm_core.h"
+#undef CORE
+#undef RUN_MODE
+
+#define RUN_MODE MODE_THROTTLED
+#define CORE(name) name##_throttled
+#include "neovm_core.h"
+#undef CORE
+#undef RUN_MODE
+
+#define RUN_MODE MODE_DEBUG
+#define CORE(name) name##_debug
+#include "neovm_core.h"
+#undef CORE
+#undef RUN_MODE
+
+typedef RunStatus (*Core)(Machine *m, u8 *memory, u8 step);
+
+// The cores by mode, and by engine under NEOVM_THREADED
+#ifdef NEOVM_THREADED
+static const Core cores[3][3] = {
+    {run_switch_fast, run_threaded_fast, run_block_fast},
+    {run_switch_throttled, run_threaded_throttled, run_block_throttled},
+    {run_switch_debug, run_threaded_debug, run_block_debug},
+};
+#else
+static const Core cores[3][1] = {
+    {run_switch_fast},
+    {run_switch_throttled},
+    {run_switch_debug},
+};
+#endif
+
+void machine_flush_cache(Machine *m) {
+#ifdef NEOVM_THREADED
+	if(m->cache)
+		cache_flush(m->cache);
+#else
+	(void)m;
+#endif
+}
+
+void machine_destroy(Machine *m) {
+	journal_set_size(m, 0);
+	trace_stop(m);
+	profile_set(m, false);
+	callgraph_set(m, false);
+	watch_reset(m);
+	event_clear(m);
+#ifdef NEOVM_THREADED
+	if(m->cache == NULL)
+		return;
+	cache_flush(m->cache);
+#ifdef NEOVM_JIT
+	if(m->cache->jit)
+		jit_free(m->cache->jit);
+#endif
+	free(m->cache);
+	m->cache = NULL;
+#else
+	(void)m;
+#endif
+}
+
+RunStatus run(Machine *m, u8 *memory, u8 step) {
+	if(m->cycles >= m->cycle_limit)
+		return RUN_BUDGET;
+	u8 mode = MODE_FAST;
+	if(step || m->hooks)
+		mode = MODE_DEBUG;
+	else if(m->throttle.hz > 0)
+		mode = MODE_THROTTLED;
+	// The time between two runs is not made up for
+	u64 start = 0, start_cycles = m->cycles;
+	if(m->throttle.hz > 0) {
+		m->throttle.origin = start = monotonic_ns();
+		m->throttle.cycles = start_cycles;
+	}
+	if(m->hooks & HOOK_JOURNAL)
+		journal_begin(m);
+	if(m->hooks & HOOK_TRACE)
+		trace_begin(m, memory);
+	if(m->hooks & HOOK_PROFILE)
+		profile_begin(m);
+	if(m->hooks & HOOK_CALLGRAPH)
+		callgraph_begin(m, memory);
+	if(m->cycles >= m->next_event)
+		event_fire(m);
+	RunStatus status;
+#ifdef NEOVM_THREADED
+	switch(m->engine) {
+		case ENGINE_SWITCH: status = cores[mode][0](m, memory, step); break;
+		case ENGINE_THREADED: status = cores[mode][1](m, memory, step); break;
+		default: status = cores[mode][2](m, memory, step); break;
+	}
+#else
+	status = cores[mode][0](m, memory, step);
+#endif
+	sync_flags(m);
+	io_flush(m);
+	if(m->throttle.hz > 0) {
+		m->throttle.run_cycles += m->cycles - start_cycles;
+		m->throttle.run_ns += monotonic_ns() - start;
 	}
-	m->isbroken = 0;
+	return status;
 }
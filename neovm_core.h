@@ -0,0 +1,213 @@
+// The cores, which neovm.c includes once for each mode, with RUN_MODE
+// set to the mode and CORE() giving the names of its functions
+
+// Takes the interrupt which is ready, if it can be taken after the
+// 'instructions'th instruction, as a restart to its vector. Returns the
+// T-states it took, or 0 if none was taken.
+static inline u8 CORE(take_interrupt)(Machine *m, u8 *memory,
+                                      u64 instructions) {
+	if(!m->interrupts.ready)
+		return 0;
+	u16 vector = interrupt_take(m, instructions);
+	if(vector == 0)
+		return 0;
+	WRITE_BYTE(m->sp - 1, m->pc >> 8);
+	WRITE_BYTE(m->sp - 2, m->pc & 0xff);
+	m->sp -= 2;
+	m->pc = vector;
+	if(RUN_MODE == MODE_DEBUG) {
+		RECORD_INTERRUPT();
+	}
+	return 12;
+}
+
+// The portable core, which dispatches all opcodes through a switch
+static RunStatus CORE(run_switch)(Machine *m, u8 *memory, u8 step) {
+	u8 tstates = 0;
+	COUNTERS();
+	(void)step;
+	cycles += CORE(take_interrupt)(m, memory, instructions);
+	while(true) {
+		switch(NEXT_BYTE()) {
+#define OP(x) case x:
+#define DISPATCH() break
+#include "neovm_ops.h"
+#undef DISPATCH
+#undef OP
+			default: tstates = 4; break;
+		}
+		POST_EXECUTE();
+	}
+}
+
+
+#ifdef NEOVM_THREADED
+// The threaded core. Each handler fetches the next opcode by itself and
+// jumps straight to its handler, so there is no shared dispatch branch
+// for the host to mispredict, and no separate check for hlt, which has
+// a handler of its own.
+static RunStatus CORE(run_threaded)(Machine *m, u8 *memory, u8 step) {
+	static const void *dispatch_table[256] = HANDLER_TABLE;
+	u8                 tstates             = 0;
+	COUNTERS();
+	(void)step;
+	cycles += CORE(take_interrupt)(m, memory, instructions);
+#define OP(x) op_##x:
+#define DISPATCH()                         \
+	{                                      \
+		POST_EXECUTE();                    \
+		goto *dispatch_table[NEXT_BYTE()]; \
+	}
+	goto *dispatch_table[NEXT_BYTE()];
+#include "neovm_ops.h"
+op_undefined:
+	tstates = 4;
+	DISPATCH();
+#undef DISPATCH
+#undef OP
+}
+static RunStatus CORE(run_block)(Machine *m, u8 *memory, u8 step) {
+	static const void *handlers[256] = HANDLER_TABLE;
+	struct BlockCache *cache         = m->cache;
+	u8                 tstates       = 0;
+	Block *            block;
+	Predecoded *       ins;
+	COUNTERS();
+	(void)step;
+
+	if(cache == NULL)
+		cache = m->cache =
+		    (struct BlockCache *)calloc(1, sizeof(struct BlockCache));
+	// The blocks decoded by the core of another mode point to its own
+	// handlers
+	if(cache->memory != memory || cache->handlers != handlers ||
+	   cache->stale) {
+		cache_flush(cache);
+		cache->memory   = memory;
+		cache->handlers = handlers;
+	}
+#ifdef NEOVM_JIT
+	// Compiled blocks neither stop at breakpoints nor sleep after each
+	// instruction, so they are only used in the fast mode
+	Jit *jit = NULL;
+	if(RUN_MODE == MODE_FAST && m->engine == ENGINE_JIT) {
+		if(cache->jit == NULL)
+			cache->jit = jit_new();
+		jit = cache->jit;
+	}
+#endif
+
+#pragma push_macro("NEXT_BYTE")
+#pragma push_macro("NEXT_DWORD")
+#pragma push_macro("WRITE_BYTE")
+#pragma push_macro("INTERRUPTED")
+#undef NEXT_BYTE
+#undef NEXT_DWORD
+#undef WRITE_BYTE
+#undef INTERRUPTED
+#define NEXT_BYTE() ((u8)ins->operand)
+#define NEXT_DWORD() (ins->operand)
+// A write to a decoded address invalidates the whole cache once the
+// present instruction finishes
+#define WRITE_BYTE(addr, value)             \
+	{                                       \
+		u16 at   = (addr);                  \
+		u8  byte = (value);                 \
+		RECORD_WRITE(at, byte);             \
+		memory[at]                  = byte; \
+		m->written[at >> PAGE_BITS] = 1;    \
+		if(IS_CODE(cache, at)) {            \
+			cache->stale   = 1;             \
+			ins[1].handler = &&block_flush; \
+		}                                   \
+	}
+// An interrupt leaves the block for the one at its vector, after the
+// pushed return address invalidates the cache if it was decoded
+#define INTERRUPTED()                        \
+	{                                        \
+		if(IS_CODE(cache, m->sp) ||          \
+		   IS_CODE(cache, (u16)(m->sp + 1))) \
+			cache->stale = 1;                \
+		goto block_interrupted;              \
+	}
+#define OP(x) op_##x: m->pc = ins->next;
+#define DISPATCH()          \
+	{                       \
+		POST_EXECUTE();     \
+		ins++;              \
+		goto *ins->handler; \
+	}
+
+	if(CORE(take_interrupt)(m, memory, instructions)) {
+		cycles += 12;
+		INTERRUPTED();
+	}
+	block = BLOCK_AT(m->pc);
+	goto block_enter;
+
+#include "neovm_ops.h"
+op_undefined:
+	m->pc   = ins->next;
+	tstates = 4;
+	DISPATCH();
+
+block_exit:
+	if(block->link[0] && block->link[0]->start == m->pc)
+		block = block->link[0];
+	else if(block->link[1] && block->link[1]->start == m->pc)
+		block = block->link[1];
+	else {
+		Block *next    = BLOCK_AT(m->pc);
+		block->link[1] = block->link[0];
+		block->link[0] = next;
+		block          = next;
+	}
+	goto block_enter;
+
+block_interrupted:
+	if(cache->stale)
+		goto block_flush;
+	block = BLOCK_AT(m->pc);
+	goto block_enter;
+
+block_flush:
+	cache_flush(cache);
+	block = BLOCK_AT(m->pc);
+	goto block_enter;
+
+block_enter:
+#ifdef NEOVM_JIT
+	if(jit) {
+		if(block->native == NULL && ++block->hits == JIT_THRESHOLD)
+			block->native =
+			    jit_compile(jit, memory, block->start, block->count);
+		// A block which starts where the core has to stop is
+		// interpreted, for the interrupt it may be waiting on to be
+		// taken after its first instruction
+		if(block->native && cycles < stop_at) {
+			sync_flags(m);
+			SAVE_COUNTERS();
+			m->stop_at = stop_at;
+			if(block->native(m, memory, cache->code) == JIT_FLUSH)
+				cache->stale = 1;
+			cycles       = m->cycles;
+			instructions = m->instructions;
+			if(cycles >= stop_at)
+				STOP();
+			if(cache->stale)
+				goto block_flush;
+			goto block_exit;
+		}
+	}
+#endif
+	ins = block->code;
+	goto *ins->handler;
+
+#undef DISPATCH
+#undef OP
+#pragma pop_macro("INTERRUPTED")
+#pragma pop_macro("WRITE_BYTE")
+#pragma pop_macro("NEXT_DWORD")
+#pragma pop_macro("NEXT_BYTE")
+}
+#endif
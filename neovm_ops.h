@@ -0,0 +1,1400 @@
+// Handlers for all the 8085 opcodes, shared between the dispatch cores
+// of neovm.c. This file is included once per core, and the including
+// core must define the following before including it :
+//
+// OP(opcode)   : Starts the handler of 'opcode'
+// DISPATCH()   : Finishes the present handler and proceeds to the next
+//                instruction
+//
+// Every handler must set 'tstates' to the number of t-states the
+// instruction took, read and write the memory other than its own bytes
+// through READ_BYTE() and WRITE_BYTE(), and use CHECK_STOP() once it
+// may have made an interrupt ready to be taken or scheduled an event.
+OP(0xCE) // ACI Data
+{
+	u8 with1 = NEXT_BYTE(), with2 = GET_FLAG(FLG_C);
+	ADD2();
+	tstates = 7;
+	DISPATCH();
+}
+OP(0x8F) // ADC A
+{
+	ADC(REG_A);
+	DISPATCH();
+}
+OP(0x88) // ADC B
+{
+	ADC(REG_B);
+	DISPATCH();
+}
+OP(0x89) // ADC C
+{
+	ADC(REG_C);
+	DISPATCH();
+}
+OP(0x8A) // ADC D
+{
+	ADC(REG_D);
+	DISPATCH();
+}
+OP(0x8B) // ADC E
+{
+	ADC(REG_E);
+	DISPATCH();
+}
+OP(0x8C) // ADC H
+{
+	ADC(REG_H);
+	DISPATCH();
+}
+OP(0x8D) // ADC L
+{
+	ADC(REG_L);
+	DISPATCH();
+}
+OP(0x8E) // ADC M
+{
+	u8 with1 = READ_BYTE(FROM_HL()), with2 = GET_FLAG(FLG_C);
+	ADD2();
+	tstates = 7;
+	DISPATCH();
+}
+OP(0x87) // ADD A
+{
+	ADD_R(REG_A);
+	DISPATCH();
+}
+OP(0x80) // ADD B
+{
+	ADD_R(REG_B);
+	DISPATCH();
+}
+OP(0x81) // ADD C
+{
+	ADD_R(REG_C);
+	DISPATCH();
+}
+OP(0x82) // ADD D
+{
+	ADD_R(REG_D);
+	DISPATCH();
+}
+OP(0x83) // ADD E
+{
+	ADD_R(REG_E);
+	DISPATCH();
+}
+OP(0x84) // ADD H
+{
+	ADD_R(REG_H);
+	DISPATCH();
+}
+OP(0x85) // ADD L
+{
+	ADD_R(REG_L);
+	DISPATCH();
+}
+OP(0x86) // ADD M
+{
+	u8 with = READ_BYTE(FROM_HL());
+	ADD();
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xC6) // ADI Data
+{
+	u8 with = NEXT_BYTE();
+	ADD();
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xA7) // ANA A
+{
+	ANA(REG_A);
+	DISPATCH();
+}
+OP(0xA0) // ANA B
+{
+	ANA(REG_B);
+	DISPATCH();
+}
+OP(0xA1) // ANA C
+{
+	ANA(REG_C);
+	DISPATCH();
+}
+OP(0xA2) // ANA D
+{
+	ANA(REG_D);
+	DISPATCH();
+}
+OP(0xA3) // ANA E
+{
+	ANA(REG_E);
+	DISPATCH();
+}
+OP(0xA4) // ANA H
+{
+	ANA(REG_H);
+	DISPATCH();
+}
+OP(0xA5) // ANA L
+{
+	ANA(REG_L);
+	DISPATCH();
+}
+OP(0xA6) // ANA M
+{
+	u8 with = READ_BYTE(FROM_HL());
+	LOGICAL_NOT_CMA(&, 0xff);
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xE6) // ANI Data
+{
+	u8 with = NEXT_BYTE();
+	LOGICAL_NOT_CMA(&, 0xff);
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xCD) // CALL Label
+{
+	CALL_ON(1);
+	DISPATCH();
+}
+OP(0xDC) // CC Label
+{
+	CALL_ON(GET_FLAG(FLG_C));
+	DISPATCH();
+}
+OP(0xFC) // CM Label
+{
+	CALL_ON(GET_FLAG(FLG_S));
+	DISPATCH();
+}
+OP(0x2F) // CMA
+{
+	m->registers[REG_A] = ~m->registers[REG_A];
+	tstates             = 4;
+	DISPATCH();
+}
+OP(0x3F) // CMC
+{
+	CHANGE_FLAG(FLG_C, !(GET_FLAG(FLG_C)));
+	tstates = 4;
+	DISPATCH();
+}
+OP(0xBF) // CMP A
+{
+	CMP(REG_A);
+	DISPATCH();
+}
+OP(0xB8) // CMP B
+{
+	CMP(REG_B);
+	DISPATCH();
+}
+OP(0xB9) // CMP C
+{
+	CMP(REG_C);
+	DISPATCH();
+}
+OP(0xBA) // CMP D
+{
+	CMP(REG_D);
+	DISPATCH();
+}
+OP(0xBB) // CMP E
+{
+	CMP(REG_E);
+	DISPATCH();
+}
+OP(0xBC) // CMP H
+{
+	CMP(REG_H);
+	DISPATCH();
+}
+OP(0xBD) // CMP L
+{
+	CMP(REG_L);
+	DISPATCH();
+}
+OP(0xBE) // CMP M
+{
+	u8 bak = m->registers[REG_A];
+	u8 by  = READ_BYTE(FROM_HL()) + 1;
+	SUB();
+	m->registers[REG_A] = bak;
+	tstates             = 7;
+	DISPATCH();
+}
+OP(0xD4) // CNC Label
+{
+	CALL_ON(!GET_FLAG(FLG_C));
+	DISPATCH();
+}
+OP(0xC4) // CNZ Label
+{
+	CALL_ON(!GET_FLAG(FLG_Z));
+	DISPATCH();
+}
+OP(0xF4) // CP Label
+{
+	CALL_ON(!GET_FLAG(FLG_S));
+	DISPATCH();
+}
+OP(0xEC) // CPE Label
+{
+	CALL_ON(GET_FLAG(FLG_P));
+	DISPATCH();
+}
+OP(0xFE) // CPI Data
+{
+	u8 bak = m->registers[REG_A];
+	u8 by  = NEXT_BYTE();
+	SUB();
+	CHANGE_FLAG(FLG_C, bak < by);
+	m->registers[REG_A] = bak;
+	tstates             = 7;
+	DISPATCH();
+}
+OP(0xE4) // CPO Label
+{
+	CALL_ON(!GET_FLAG(FLG_P));
+	DISPATCH();
+}
+OP(0xCC) // CZ Label
+{
+	CALL_ON(GET_FLAG(FLG_Z));
+	DISPATCH();
+}
+OP(0x27) // DAA
+{
+	u8 low  = m->registers[REG_A] & 0x0f,
+	   high = m->registers[REG_A] & 0xf0;
+	u8 with = 0;
+	if(low > 9 || GET_FLAG(FLG_A))
+		with |= 0x06;
+	if(high > 9 || GET_FLAG(FLG_C))
+		with |= 0x60;
+	ADD();
+	tstates = 4;
+	DISPATCH();
+}
+OP(0x09) // DAD B
+{
+	DAD_R(REG_B);
+	DISPATCH();
+}
+OP(0x19) // DAD D
+{
+	DAD_R(REG_D);
+	DISPATCH();
+}
+OP(0x29) // DAD H
+{
+	DAD_R(REG_H);
+	DISPATCH();
+}
+OP(0x39) // DAD SP
+{
+	u16 with = m->sp;
+	DAD();
+	DISPATCH();
+}
+OP(0x3D) // DCR A
+{
+	DCR(REG_A);
+	DISPATCH();
+}
+OP(0x05) // DCR B
+{
+	DCR(REG_B);
+	DISPATCH();
+}
+OP(0x0D) // DCR C
+{
+	DCR(REG_C);
+	DISPATCH();
+}
+OP(0x15) // DCR D
+{
+	DCR(REG_D);
+	DISPATCH();
+}
+OP(0x1D) // DCR E
+{
+	DCR(REG_E);
+	DISPATCH();
+}
+OP(0x25) // DCR H
+{
+	DCR(REG_H);
+	DISPATCH();
+}
+OP(0x2D) // DCR L
+{
+	DCR(REG_L);
+	DISPATCH();
+}
+OP(0x35) // DCR M
+{
+	u8  byte = READ_BYTE(FROM_HL());
+	u16 res  = byte - 1;
+	LAZY_FLAGS(res, byte, 0xff);
+	WRITE_BYTE(FROM_HL(), res & 0xff);
+	tstates = 10;
+	DISPATCH();
+}
+OP(0x0B) // DCX B
+{
+	DCX(REG_B);
+	DISPATCH();
+}
+OP(0x1B) // DCX D
+{
+	DCX(REG_D);
+	DISPATCH();
+}
+OP(0x2B) // DCX H
+{
+	DCX(REG_H);
+	DISPATCH();
+}
+OP(0x3B) // DCX SP
+{
+	m->sp--;
+	tstates = 6;
+	DISPATCH();
+}
+OP(0xF3) // DI
+{
+	interrupt_enable(m, false, instructions);
+	tstates = 4;
+	DISPATCH();
+}
+OP(0xFB) // EI
+{
+	interrupt_enable(m, true, instructions);
+	CHECK_STOP();
+	tstates = 4;
+	DISPATCH();
+}
+OP(0x76) // HLT
+{
+	// The machine waits through the events for one of them to raise an
+	// interrupt which can be taken, TRAP even while the interrupts are
+	// disabled, to the end of the budget, after which it waits on the
+	// hlt in the next run
+	while(!m->interrupts.ready && m->next_event != u64_MAX) {
+		if(m->next_event >= m->cycle_limit) {
+			m->pc--;
+			cycles = m->cycle_limit;
+			LEAVE(RUN_BUDGET);
+		}
+		if(m->next_event > cycles)
+			cycles = m->next_event;
+		if(RUN_MODE != MODE_FAST && m->throttle.hz > 0)
+			throttle(m, cycles);
+		SAVE_COUNTERS();
+		event_fire(m);
+	}
+	// An interrupt which is ready wakes the machine up right away
+	if(m->interrupts.ready) {
+		stop_at = 0;
+		tstates = 5;
+		DISPATCH();
+	}
+	m->isbroken = 0;
+	cycles += 5;
+	instructions++;
+	if(RUN_MODE == MODE_DEBUG) {
+		RECORD(5);
+	}
+	// Sleep through the last slice too, for the run to take as long as
+	// it would on the machine
+	if(RUN_MODE != MODE_FAST && m->throttle.hz > 0)
+		throttle(m, cycles);
+	LEAVE(RUN_HALTED);
+}
+OP(0xDB) // IN Port-Address
+{
+	u8 port             = NEXT_BYTE();
+	m->registers[REG_A] = m->in[port].read(m->in[port].device, m, port);
+	CHECK_STOP();
+	tstates = 10;
+	DISPATCH();
+}
+OP(0x3C) // INR A
+{
+	INR(REG_A);
+	DISPATCH();
+}
+OP(0x04) // INR B
+{
+	INR(REG_B);
+	DISPATCH();
+}
+OP(0x0C) // INR C
+{
+	INR(REG_C);
+	DISPATCH();
+}
+OP(0x14) // INR D
+{
+	INR(REG_D);
+	DISPATCH();
+}
+OP(0x1C) // INR E
+{
+	INR(REG_E);
+	DISPATCH();
+}
+OP(0x24) // INR H
+{
+	INR(REG_H);
+	DISPATCH();
+}
+OP(0x2C) // INR L
+{
+	INR(REG_L);
+	DISPATCH();
+}
+OP(0x34) // INR M
+{
+	u8  byte = READ_BYTE(FROM_HL());
+	u16 res  = byte + 1;
+	LAZY_FLAGS(res, byte, 1);
+	WRITE_BYTE(FROM_HL(), res & 0xff);
+	tstates = 10;
+	DISPATCH();
+}
+OP(0x03) // INX B
+{
+	INX(REG_B);
+	DISPATCH();
+}
+OP(0x13) // INX D
+{
+	INX(REG_D);
+	DISPATCH();
+}
+OP(0x23) // INX H
+{
+	INX(REG_H);
+	DISPATCH();
+}
+OP(0x33) // INX SP
+{
+	m->sp++;
+	tstates = 6;
+	DISPATCH();
+}
+OP(0xDA) // JC Label
+{
+	JMP_ON(GET_FLAG(FLG_C));
+	DISPATCH();
+}
+OP(0xFA) // JM Label
+{
+	JMP_ON(GET_FLAG(FLG_S));
+	DISPATCH();
+}
+OP(0xC3) // JMP Label
+{
+	JMP_ON(1);
+	DISPATCH();
+}
+OP(0xD2) // JNC Label
+{
+	JMP_ON(!GET_FLAG(FLG_C));
+	DISPATCH();
+}
+OP(0xC2) // JNZ Label
+{
+	JMP_ON(!GET_FLAG(FLG_Z));
+	DISPATCH();
+}
+OP(0xF2) // JP Label
+{
+	JMP_ON(!GET_FLAG(FLG_S));
+	DISPATCH();
+}
+OP(0xEA) // JPE Label
+{
+	JMP_ON(GET_FLAG(FLG_P));
+	DISPATCH();
+}
+OP(0xE2) // JPO Label
+{
+	JMP_ON(!GET_FLAG(FLG_P));
+	DISPATCH();
+}
+OP(0xCA) // JZ Label
+{
+	JMP_ON(GET_FLAG(FLG_Z));
+	DISPATCH();
+}
+OP(0x3A) // LDA Address
+{
+	m->registers[REG_A] = READ_BYTE(NEXT_DWORD());
+	tstates             = 13;
+	DISPATCH();
+}
+OP(0x0A) // LDAX B
+{
+	LDAX(REG_B);
+	DISPATCH();
+}
+OP(0x1A) // LDAX D
+{
+	LDAX(REG_D);
+	DISPATCH();
+}
+OP(0x2A) // LHLD Address
+{
+	u16 addr            = NEXT_DWORD();
+	m->registers[REG_L] = READ_BYTE(addr);
+	m->registers[REG_H] = READ_BYTE(addr + 1);
+	tstates             = 16;
+	DISPATCH();
+}
+OP(0x01) // LXI B
+{
+	LXI(REG_B);
+	DISPATCH();
+}
+OP(0x11) // LXI D
+{
+	LXI(REG_D);
+	DISPATCH();
+}
+OP(0x21) // LXI H
+{
+	LXI(REG_H);
+	DISPATCH();
+}
+OP(0x31) // LXI SP
+{
+	m->sp   = NEXT_DWORD();
+	tstates = 10;
+	DISPATCH();
+}
+OP(0x7F) // MOV A, A
+{
+	MOV(REG_A, REG_A);
+	DISPATCH();
+}
+OP(0x78) // MOV A, B
+{
+	MOV(REG_A, REG_B);
+	DISPATCH();
+}
+OP(0x79) // MOV A, C
+{
+	MOV(REG_A, REG_C);
+	DISPATCH();
+}
+OP(0x7A) // MOV A, D
+{
+	MOV(REG_A, REG_D);
+	DISPATCH();
+}
+OP(0x7B) // MOV A, E
+{
+	MOV(REG_A, REG_E);
+	DISPATCH();
+}
+OP(0x7C) // MOV A, H
+{
+	MOV(REG_A, REG_H);
+	DISPATCH();
+}
+OP(0x7D) // MOV A, L
+{
+	MOV(REG_A, REG_L);
+	DISPATCH();
+}
+OP(0x7E) // MOV A, M
+{
+	MOV_r_m(REG_A);
+	DISPATCH();
+}
+OP(0x47) // MOV B, A
+{
+	MOV(REG_B, REG_A);
+	DISPATCH();
+}
+OP(0x40) // MOV B, B
+{
+	MOV(REG_B, REG_B);
+	DISPATCH();
+}
+OP(0x41) // MOV B, C
+{
+	MOV(REG_B, REG_C);
+	DISPATCH();
+}
+OP(0x42) // MOV B, D
+{
+	MOV(REG_B, REG_D);
+	DISPATCH();
+}
+OP(0x43) // MOV B, E
+{
+	MOV(REG_B, REG_E);
+	DISPATCH();
+}
+OP(0x44) // MOV B, H
+{
+	MOV(REG_B, REG_H);
+	DISPATCH();
+}
+OP(0x45) // MOV B, L
+{
+	MOV(REG_B, REG_L);
+	DISPATCH();
+}
+OP(0x46) // MOV B, M
+{
+	MOV_r_m(REG_B);
+	DISPATCH();
+}
+OP(0x4F) // MOV C, A
+{
+	MOV(REG_C, REG_A);
+	DISPATCH();
+}
+OP(0x48) // MOV C, B
+{
+	MOV(REG_C, REG_B);
+	DISPATCH();
+}
+OP(0x49) // MOV C, C
+{
+	MOV(REG_C, REG_C);
+	DISPATCH();
+}
+OP(0x4A) // MOV C, D
+{
+	MOV(REG_C, REG_D);
+	DISPATCH();
+}
+OP(0x4B) // MOV C, E
+{
+	MOV(REG_C, REG_E);
+	DISPATCH();
+}
+OP(0x4C) // MOV C, H
+{
+	MOV(REG_C, REG_H);
+	DISPATCH();
+}
+OP(0x4D) // MOV C, L
+{
+	MOV(REG_C, REG_L);
+	DISPATCH();
+}
+OP(0x4E) // MOV C, M
+{
+	MOV_r_m(REG_C);
+	DISPATCH();
+}
+OP(0x57) // MOV D, A
+{
+	MOV(REG_D, REG_A);
+	DISPATCH();
+}
+OP(0x50) // MOV D, B
+{
+	MOV(REG_D, REG_B);
+	DISPATCH();
+}
+OP(0x51) // MOV D, C
+{
+	MOV(REG_D, REG_C);
+	DISPATCH();
+}
+OP(0x52) // MOV D, D
+{
+	MOV(REG_D, REG_D);
+	DISPATCH();
+}
+OP(0x53) // MOV D, E
+{
+	MOV(REG_D, REG_E);
+	DISPATCH();
+}
+OP(0x54) // MOV D, H
+{
+	MOV(REG_D, REG_H);
+	DISPATCH();
+}
+OP(0x55) // MOV D, L
+{
+	MOV(REG_D, REG_L);
+	DISPATCH();
+}
+OP(0x56) // MOV D, M
+{
+	MOV_r_m(REG_D);
+	DISPATCH();
+}
+OP(0x5F) // MOV E, A
+{
+	MOV(REG_E, REG_A);
+	DISPATCH();
+}
+OP(0x58) // MOV E, B
+{
+	MOV(REG_E, REG_B);
+	DISPATCH();
+}
+OP(0x59) // MOV E, C
+{
+	MOV(REG_E, REG_C);
+	DISPATCH();
+}
+OP(0x5A) // MOV E, D
+{
+	MOV(REG_E, REG_D);
+	DISPATCH();
+}
+OP(0x5B) // MOV E, E
+{
+	MOV(REG_E, REG_E);
+	DISPATCH();
+}
+OP(0x5C) // MOV E, H
+{
+	MOV(REG_E, REG_H);
+	DISPATCH();
+}
+OP(0x5D) // MOV E, L
+{
+	MOV(REG_E, REG_L);
+	DISPATCH();
+}
+OP(0x5E) // MOV E, M
+{
+	MOV_r_m(REG_E);
+	DISPATCH();
+}
+OP(0x67) // MOV H, A
+{
+	MOV(REG_H, REG_A);
+	DISPATCH();
+}
+OP(0x60) // MOV H, B
+{
+	MOV(REG_H, REG_B);
+	DISPATCH();
+}
+OP(0x61) // MOV H, C
+{
+	MOV(REG_H, REG_C);
+	DISPATCH();
+}
+OP(0x62) // MOV H, D
+{
+	MOV(REG_H, REG_D);
+	DISPATCH();
+}
+OP(0x63) // MOV H, E
+{
+	MOV(REG_H, REG_E);
+	DISPATCH();
+}
+OP(0x64) // MOV H, H
+{
+	MOV(REG_H, REG_H);
+	DISPATCH();
+}
+OP(0x65) // MOV H, L
+{
+	MOV(REG_H, REG_L);
+	DISPATCH();
+}
+OP(0x66) // MOV H, M
+{
+	MOV_r_m(REG_H);
+	DISPATCH();
+}
+OP(0x6F) // MOV L, A
+{
+	MOV(REG_L, REG_A);
+	DISPATCH();
+}
+OP(0x68) // MOV L, B
+{
+	MOV(REG_L, REG_B);
+	DISPATCH();
+}
+OP(0x69) // MOV L, C
+{
+	MOV(REG_L, REG_C);
+	DISPATCH();
+}
+OP(0x6A) // MOV L, D
+{
+	MOV(REG_L, REG_D);
+	DISPATCH();
+}
+OP(0x6B) // MOV L, E
+{
+	MOV(REG_L, REG_E);
+	DISPATCH();
+}
+OP(0x6C) // MOV L, H
+{
+	MOV(REG_L, REG_H);
+	DISPATCH();
+}
+OP(0x6D) // MOV L, L
+{
+	MOV(REG_L, REG_L);
+	DISPATCH();
+}
+OP(0x6E) // MOV L, M
+{
+	MOV_r_m(REG_L);
+	DISPATCH();
+}
+OP(0x77) // MOV M, A
+{
+	MOV_m_r(REG_A);
+	DISPATCH();
+}
+OP(0x70) // MOV M, B
+{
+	MOV_m_r(REG_B);
+	DISPATCH();
+}
+OP(0x71) // MOV M, C
+{
+	MOV_m_r(REG_C);
+	DISPATCH();
+}
+OP(0x72) // MOV M, D
+{
+	MOV_m_r(REG_D);
+	DISPATCH();
+}
+OP(0x73) // MOV M, E
+{
+	MOV_m_r(REG_E);
+	DISPATCH();
+}
+OP(0x74) // MOV M, H
+{
+	MOV_m_r(REG_H);
+	DISPATCH();
+}
+OP(0x75) // MOV M, L
+{
+	MOV_m_r(REG_L);
+	DISPATCH();
+}
+OP(0x3E) // MVI A, Data
+{
+	MVI(REG_A);
+	DISPATCH();
+}
+OP(0x06) // MVI B, Data
+{
+	MVI(REG_B);
+	DISPATCH();
+}
+OP(0x0E) // MVI C, Data
+{
+	MVI(REG_C);
+	DISPATCH();
+}
+OP(0x16) // MVI D, Data
+{
+	MVI(REG_D);
+	DISPATCH();
+}
+OP(0x1E) // MVI E, Data
+{
+	MVI(REG_E);
+	DISPATCH();
+}
+OP(0x26) // MVI H, Data
+{
+	MVI(REG_H);
+	DISPATCH();
+}
+OP(0x2E) // MVI L, Data
+{
+	MVI(REG_L);
+	DISPATCH();
+}
+OP(0x36) // MVI M, Data
+{
+	u16 to     = FROM_HL();
+	WRITE_BYTE(to, NEXT_BYTE());
+	tstates    = 10;
+	DISPATCH();
+}
+OP(0x00) // NOP
+{
+	tstates = 4;
+	DISPATCH();
+}
+OP(0xB7) // ORA A
+{
+	ORA(REG_A);
+	DISPATCH();
+}
+OP(0xB0) // ORA B
+{
+	ORA(REG_B);
+	DISPATCH();
+}
+OP(0xB1) // ORA C
+{
+	ORA(REG_C);
+	DISPATCH();
+}
+OP(0xB2) // ORA D
+{
+	ORA(REG_D);
+	DISPATCH();
+}
+OP(0xB3) // ORA E
+{
+	ORA(REG_E);
+	DISPATCH();
+}
+OP(0xB4) // ORA H
+{
+	ORA(REG_H);
+	DISPATCH();
+}
+OP(0xB5) // ORA L
+{
+	ORA(REG_L);
+	DISPATCH();
+}
+OP(0xB6) // ORA M
+{
+	u8 with = READ_BYTE(FROM_HL());
+	LOGICAL_NOT_CMA(|, 0);
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xF6) // ORI Data
+{
+	u8 with = NEXT_BYTE();
+	LOGICAL_NOT_CMA(|, 0);
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xD3) // OUT Port-Address
+{
+	u8 port = NEXT_BYTE();
+	m->out[port].write(m->out[port].device, m, port, m->registers[REG_A]);
+	CHECK_STOP();
+	tstates = 10;
+	DISPATCH();
+}
+OP(0xE9) // PCHL
+{
+	m->pc = m->registers[REG_L];
+	m->pc |= (m->registers[REG_H] << 8);
+	tstates = 6;
+	DISPATCH();
+}
+OP(0xC1) // POP B
+{
+	POP(REG_B);
+	DISPATCH();
+}
+OP(0xD1) // POP D
+{
+	POP(REG_D);
+	DISPATCH();
+}
+OP(0xE1) // POP H
+{
+	POP(REG_H);
+	DISPATCH();
+}
+OP(0xF1) // POP PSW
+{
+	m->registers[REG_FL] = READ_BYTE(m->sp);
+	m->lazy.pending      = 0;
+	m->sp++;
+	m->registers[REG_A] = READ_BYTE(m->sp);
+	m->sp++;
+	tstates = 10;
+	DISPATCH();
+}
+OP(0xC5) // PUSH B
+{
+	PUSH(REG_B);
+	DISPATCH();
+}
+OP(0xD5) // PUSH D
+{
+	PUSH(REG_D);
+	DISPATCH();
+}
+OP(0xE5) // PUSH H
+{
+	PUSH(REG_H);
+	DISPATCH();
+}
+OP(0xF5) // PUSH PSW
+{
+	sync_flags(m);
+	WRITE_BYTE(m->sp - 1, m->registers[REG_A]);
+	WRITE_BYTE(m->sp - 2, m->registers[REG_FL]);
+	m->sp -= 2;
+	tstates = 12;
+	DISPATCH();
+}
+OP(0x17) // RAL
+{
+	u8 d7 = m->registers[REG_A] >> 7;
+	u8 d0 = GET_FLAG(FLG_C);
+	CHANGE_FLAG(FLG_C, d7); // Set/reset the carry
+	m->registers[REG_A] <<= 1;
+	m->registers[REG_A] |= d0;
+	tstates = 4;
+	DISPATCH();
+}
+OP(0x1F) // RAR
+{
+	u8 d0 = m->registers[REG_A] & 1;
+	u8 d7 = GET_FLAG(FLG_C);
+	CHANGE_FLAG(FLG_C, d0); // Set/reset the carry
+	m->registers[REG_A] >>= 1;
+	m->registers[REG_A] |= (d7 << 7);
+	tstates = 4;
+	DISPATCH();
+}
+OP(0xD8) // RC
+{
+	RET_ON(GET_FLAG(FLG_C));
+	DISPATCH();
+}
+OP(0xC9) // RET
+{
+	RET_ON(1);
+	tstates = 10;
+	DISPATCH();
+}
+OP(0x20) // RIM
+{
+	m->registers[REG_A] = interrupt_rim(m);
+	tstates             = 4;
+	DISPATCH();
+}
+OP(0x07) // RLC
+{
+	u8 d7 = m->registers[REG_A] >> 7;
+	CHANGE_FLAG(FLG_C, d7); // Set/reset the carry
+	m->registers[REG_A] <<= 1;
+	m->registers[REG_A] |= d7;
+	tstates = 4;
+	DISPATCH();
+}
+OP(0xF8) // RM
+{
+	RET_ON(GET_FLAG(FLG_S));
+	DISPATCH();
+}
+OP(0xD0) // RNC
+{
+	RET_ON(!GET_FLAG(FLG_C));
+	DISPATCH();
+}
+OP(0xC0) // RNZ
+{
+	RET_ON(!GET_FLAG(FLG_Z));
+	DISPATCH();
+}
+OP(0xF0) // RP
+{
+	RET_ON(!GET_FLAG(FLG_S));
+	DISPATCH();
+}
+OP(0xE8) // RPE
+{
+	RET_ON(GET_FLAG(FLG_P));
+	DISPATCH();
+}
+OP(0xE0) // RPO
+{
+	RET_ON(!GET_FLAG(FLG_P));
+	DISPATCH();
+}
+OP(0x0F) // RRC
+{
+	u8 d0 = m->registers[REG_A] & 1;
+	CHANGE_FLAG(FLG_C, d0); // Set/reset the carry
+	m->registers[REG_A] >>= 1;
+	m->registers[REG_A] |= (d0 << 7);
+	tstates = 4;
+	DISPATCH();
+}
+OP(0xC7) // RST 0
+{
+	RST(0x0000);
+	DISPATCH();
+}
+OP(0xCF) // RST 1
+{
+	RST(0x0008);
+	DISPATCH();
+}
+OP(0xD7) // RST 2
+{
+	RST(0x0010);
+	DISPATCH();
+}
+OP(0xDF) // RST 3
+{
+	RST(0x0018);
+	DISPATCH();
+}
+OP(0xE7) // RST 4
+{
+	RST(0x0020);
+	DISPATCH();
+}
+OP(0xEF) // RST 5
+{
+	RST(0x0028);
+	DISPATCH();
+}
+OP(0xF7) // RST 6
+{
+	RST(0x0030);
+	DISPATCH();
+}
+OP(0xFF) // RST 7
+{
+	RST(0x0038);
+	DISPATCH();
+}
+OP(0xC8) // RZ
+{
+	RET_ON(GET_FLAG(FLG_Z));
+	DISPATCH();
+}
+OP(0x9F) // SBB A
+{
+	SBB(REG_A);
+	DISPATCH();
+}
+OP(0x98) // SBB B
+{
+	SBB(REG_B);
+	DISPATCH();
+}
+OP(0x99) // SBB C
+{
+	SBB(REG_C);
+	DISPATCH();
+}
+OP(0x9A) // SBB D
+{
+	SBB(REG_D);
+	DISPATCH();
+}
+OP(0x9B) // SBB E
+{
+	SBB(REG_E);
+	DISPATCH();
+}
+OP(0x9C) // SBB H
+{
+	SBB(REG_H);
+	DISPATCH();
+}
+OP(0x9D) // SBB L
+{
+	SBB(REG_L);
+	DISPATCH();
+}
+OP(0x9E) // SBB M
+{
+	u8 by = READ_BYTE(FROM_HL()) + GET_FLAG(FLG_C);
+	SUB();
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xDE) // SBI Data
+{
+	u8 by = NEXT_BYTE() + GET_FLAG(FLG_C);
+	SUB();
+	tstates = 7;
+	DISPATCH();
+}
+OP(0x22) // SHLD Address
+{
+	u16 addr         = NEXT_DWORD();
+	WRITE_BYTE(addr, m->registers[REG_L]);
+	WRITE_BYTE(addr + 1, m->registers[REG_H]);
+	tstates          = 16;
+	DISPATCH();
+}
+OP(0x30) // SIM
+{
+	interrupt_sim(m, m->registers[REG_A]);
+	CHECK_STOP();
+	tstates = 4;
+	DISPATCH();
+}
+OP(0xF9) // SPHL
+{
+	m->sp   = FROM_HL();
+	tstates = 6;
+	DISPATCH();
+}
+OP(0x32) // STA Address
+{
+	u16 to     = NEXT_DWORD();
+	WRITE_BYTE(to, m->registers[REG_A]);
+	tstates    = 13;
+	DISPATCH();
+}
+OP(0x02) // STAX B
+{
+	STAX(REG_B);
+	DISPATCH();
+}
+OP(0x12) // STAX D
+{
+	STAX(REG_D);
+	DISPATCH();
+}
+OP(0x37) // STC
+{
+	SET_FLAG(FLG_C);
+	tstates = 4;
+	DISPATCH();
+}
+OP(0x97) // SUB A
+{
+	SUB_r(REG_A);
+	DISPATCH();
+}
+OP(0x90) // SUB B
+{
+	SUB_r(REG_B);
+	DISPATCH();
+}
+OP(0x91) // SUB C
+{
+	SUB_r(REG_C);
+	DISPATCH();
+}
+OP(0x92) // SUB D
+{
+	SUB_r(REG_D);
+	DISPATCH();
+}
+OP(0x93) // SUB E
+{
+	SUB_r(REG_E);
+	DISPATCH();
+}
+OP(0x94) // SUB H
+{
+	SUB_r(REG_H);
+	DISPATCH();
+}
+OP(0x95) // SUB L
+{
+	SUB_r(REG_L);
+	DISPATCH();
+}
+OP(0x96) // SUB M
+{
+	u8 by = READ_BYTE(FROM_HL());
+	SUB();
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xD6) // SUI Data
+{
+	u8 by = NEXT_BYTE();
+	SUB();
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xEB) // XCHG
+{
+	u8 td               = m->registers[REG_D];
+	u8 te               = m->registers[REG_E];
+	m->registers[REG_D] = m->registers[REG_H];
+	m->registers[REG_E] = m->registers[REG_L];
+	m->registers[REG_H] = td;
+	m->registers[REG_L] = te;
+	tstates             = 4;
+	DISPATCH();
+}
+OP(0xAF) // XRA A
+{
+	XRA(REG_A);
+	DISPATCH();
+}
+OP(0xA8) // XRA B
+{
+	XRA(REG_B);
+	DISPATCH();
+}
+OP(0xA9) // XRA C
+{
+	XRA(REG_C);
+	DISPATCH();
+}
+OP(0xAA) // XRA D
+{
+	XRA(REG_D);
+	DISPATCH();
+}
+OP(0xAB) // XRA E
+{
+	XRA(REG_E);
+	DISPATCH();
+}
+OP(0xAC) // XRA H
+{
+	XRA(REG_H);
+	DISPATCH();
+}
+OP(0xAD) // XRA L
+{
+	XRA(REG_L);
+	DISPATCH();
+}
+OP(0xAE) // XRA M
+{
+	u8 with = READ_BYTE(FROM_HL());
+	LOGICAL_NOT_CMA(^, 0);
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xEE) // XRI Data
+{
+	u8 with = NEXT_BYTE();
+	LOGICAL_NOT_CMA(^, 0);
+	tstates = 7;
+	DISPATCH();
+}
+OP(0xE3) // XTHL
+{
+	u8 td               = READ_BYTE(m->sp + 1);
+	u8 te               = READ_BYTE(m->sp);
+	WRITE_BYTE(m->sp + 1, m->registers[REG_H]);
+	WRITE_BYTE(m->sp, m->registers[REG_L]);
+	m->registers[REG_H] = td;
+	m->registers[REG_L] = te;
+	tstates             = 16;
+	DISPATCH();
+}
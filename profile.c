@@ -0,0 +1,57 @@
+#include "profile.h"
+#include <stdlib.h>
+#include <string.h>
+
+void profile_set(Machine *m, bool on) {
+	if(on && m->profile == NULL) {
+		m->profile = (Profile *)calloc(1, sizeof(Profile));
+		m->hooks |= HOOK_PROFILE;
+	} else if(!on && m->profile) {
+		free(m->profile);
+		m->profile = NULL;
+		m->hooks &= ~HOOK_PROFILE;
+	}
+}
+
+void profile_clear(Machine *m) {
+	if(m->profile)
+		memset(m->profile, 0, sizeof(Profile));
+}
+
+u32 profile_hottest(const Machine *m, u16 *addresses, u32 count) {
+	const Profile *p = m->profile;
+	u32            n = 0;
+	if(p == NULL || count == 0)
+		return 0;
+	// Kept sorted as they are found, as only a few are asked for
+	for(u32 addr = 0; addr < 0x10000; addr++) {
+		u64 tstates = p->tstates[addr];
+		if(tstates == 0 ||
+		   (n == count && tstates <= p->tstates[addresses[n - 1]]))
+			continue;
+		u32 i = n < count ? n++ : n - 1;
+		for(; i > 0 && p->tstates[addresses[i - 1]] < tstates; i--)
+			addresses[i] = addresses[i - 1];
+		addresses[i] = addr;
+	}
+	return n;
+}
+
+void profile_begin(Machine *m) {
+	m->profile->at = m->pc;
+}
+
+void profile_record(Machine *m, u8 tstates) {
+	Profile *p = m->profile;
+	p->executions[p->at]++;
+	p->tstates[p->at] += tstates;
+	p->total += tstates;
+	p->at = m->pc;
+}
+
+void profile_interrupt(Machine *m) {
+	Profile *p = m->profile;
+	p->tstates[m->pc] += 12;
+	p->total += 12;
+	p->at = m->pc;
+}
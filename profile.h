@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// How many times the instruction at each address was executed, and the
+// T-states it took in all, since the profile was started or cleared.
+// The T-states of an interrupt taken are charged to its vector, without
+// counting as an execution of it.
+// The machine runs in the debug mode while it is profiled.
+typedef struct Profile {
+	u64 executions[0x10000];
+	u64 tstates[0x10000];
+	u64 total; // T-states of all of them
+
+	u16 at; // where the instruction being executed is
+} Profile;
+
+// Starts profiling 'm', or stops and drops its profile if not 'on'
+void profile_set(Machine *m, bool on);
+void profile_clear(Machine *m);
+// Puts the addresses which took the most T-states in 'addresses', most
+// first, and returns how many there are, at most 'count'
+u32 profile_hottest(const Machine *m, u16 *addresses, u32 count);
+
+// Used by the cores
+void profile_begin(Machine *m);
+void profile_record(Machine *m, u8 tstates);
+void profile_interrupt(Machine *m);
@@ -13,7 +13,7 @@ typedef struct {
 	int         line;
 } Scanner;
 
-Scanner scanner;
+static THREAD_LOCAL Scanner scanner;
 
 void initScanner(const char *source) {
 	scanner.start   = source;
@@ -65,6 +65,8 @@ static Token errorToken() {
 }
 
 void token_highlight_source(Token t) {
+	if(display_muted())
+		return;
 	int         line = 1;
 	const char *s    = scanner.source;
 	while(line < t.line) {
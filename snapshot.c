@@ -0,0 +1,67 @@
+#include "snapshot.h"
+#include "journal.h"
+#include <string.h>
+
+#define PAGE_SIZE (1u << PAGE_BITS)
+
+// Copies the pages 'm' has written from 'from' to 'to', or all of them
+// if 'all'
+static void copy_pages(Machine *m, u8 *to, const u8 *from, u32 size,
+                       bool all) {
+	if(all) {
+		memcpy(to, from, size);
+		return;
+	}
+	for(u32 page = 0; page < PAGE_COUNT; page++) {
+		if(!m->written[page])
+			continue;
+		u32 start = page * PAGE_SIZE;
+		if(start >= size)
+			break;
+		memcpy(&to[start], &from[start],
+		       size - start < PAGE_SIZE ? size - start : PAGE_SIZE);
+	}
+}
+
+void snapshot_save(Snapshot *s, Machine *m, const u8 *memory, u32 size) {
+	if(size > sizeof(s->memory))
+		size = sizeof(s->memory);
+	bool all = m->snapshot != s || s->source != memory || s->size != size;
+	copy_pages(m, s->memory, memory, size, all);
+	s->source = memory;
+	s->size   = size;
+
+	machine_sync_flags(m);
+	memcpy(s->registers, m->registers, sizeof(s->registers));
+	s->pc           = m->pc;
+	s->sp           = m->sp;
+	s->cycles       = m->cycles;
+	s->instructions = m->instructions;
+	s->cycle_limit  = m->cycle_limit;
+	s->isbroken     = m->isbroken;
+	s->interrupts   = m->interrupts;
+
+	m->snapshot = s;
+	memset(m->written, 0, sizeof(m->written));
+}
+
+void snapshot_restore(const Snapshot *s, Machine *m, u8 *memory) {
+	bool all = m->snapshot != s || s->source != memory;
+	copy_pages(m, memory, s->memory, s->size, all);
+
+	memcpy(m->registers, s->registers, sizeof(m->registers));
+	m->lazy.pending = 0;
+	m->pc           = s->pc;
+	m->sp           = s->sp;
+	m->cycles       = s->cycles;
+	m->instructions = s->instructions;
+	m->cycle_limit  = s->cycle_limit;
+	m->isbroken     = s->isbroken;
+	m->interrupts   = s->interrupts;
+
+	m->snapshot = s;
+	memset(m->written, 0, sizeof(m->written));
+	machine_flush_cache(m);
+	// What the journal would undo happened after another state
+	journal_clear(m);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// The state of a machine and its memory at one point, to be restored
+// later. The machine keeps track of the pages it writes, so that saving
+// or restoring the snapshot it was last saved to or restored from only
+// copies the pages written since. The configuration of the machine, its
+// engine, breakpoints and frequency, is not a part of it.
+typedef struct Snapshot {
+	u8  registers[8];
+	u16 pc;
+	u16 sp;
+	u64 cycles;
+	u64 instructions;
+	u64 cycle_limit;
+	u8  isbroken;
+
+	struct Interrupts interrupts;
+
+	const u8 *source; // the memory the pages were copied from
+	u32       size;   // the bytes of it which were copied
+	u8        memory[0x10000];
+} Snapshot;
+
+// Saves 'm' and the first 'size' bytes of 'memory' to 's'
+void snapshot_save(Snapshot *s, Machine *m, const u8 *memory, u32 size);
+// Puts 'm' and 'memory' back to the state saved in 's'. The blocks
+// decoded by the machine and its journal are dropped.
+void snapshot_restore(const Snapshot *s, Machine *m, u8 *memory);
@@ -1,27 +1,56 @@
 #include <memory.h>
+#include <pthread.h>
 #include <stdio.h>
 
+#include "batch.h"
+#include "callgraph.h"
 #include "common.h"
 #include "compiler.h"
 #include "display.h"
+#include "event.h"
+#include "interrupt.h"
+#include "io.h"
+#include "manifest.h"
+#include "journal.h"
+#include "profile.h"
+#include "snapshot.h"
 #include "test.h"
+#include "trace.h"
 #include "util.h"
 #include "vm.h"
+#include "watch.h"
 
-static void reset_machine(Machine *m, u8 *memory, u16 size) {
+// The machine and the memory every test starts from
+static Snapshot clean;
+// Saved by the snapshot test in the middle of its runs
+static Snapshot saved;
+// Reads back the trace written by the trace test
+static TraceReader replay;
+
+static void init_machine(Machine *m, u8 *memory, u16 size) {
 	memset(memory, 0, size);
-	m->pc = 0;
 	memset(m->registers, 0, 8);
-	m->pc                 = 0;
-	m->sp                 = 0xffff - 1;
-	m->breakpoint_pointer = 0;
+	m->pc           = 0;
+	m->sp           = 0xffff - 1;
+	m->cycles       = 0;
+	m->instructions = 0;
+	machine_set_budget(m, 0);
+	snapshot_save(&clean, m, memory, size);
+}
+
+static void reset_machine(Machine *m, u8 *memory) {
+	snapshot_restore(&clean, m, memory);
+	machine_reset_breakpoints(m);
 }
 
 static bool run_source(const char *source, Machine *m, u8 *memory, u16 size,
                        u16 pointer) {
 	CompilationStatus status;
+	u16               start = pointer;
 	compiler_reset();
-	if((status = compile(source, &memory[0], size, &pointer)) != COMPILE_OK) {
+	status = compile(source, &memory[0], size, &pointer);
+	machine_mark_written(m, start, (u16)(pointer - start));
+	if(status != COMPILE_OK) {
 		pred("\n[compilation aborted with code %d]", status);
 		return false;
 	}
@@ -29,13 +58,151 @@ static bool run_source(const char *source, Machine *m, u8 *memory, u16 size,
 	return true;
 }
 
+// Runs 'source' like run_source() while tracing it to 'path', and reads
+// the trace back, for it to end with the machine and the memory as they are
+static bool trace_source(const char *source, Machine *m, u8 *memory,
+                         u16 size, const char *path) {
+	u16 pointer = 0;
+	compiler_reset();
+	if(compile(source, &memory[0], size, &pointer) != COMPILE_OK)
+		return false;
+	machine_mark_written(m, 0, pointer);
+	if(!trace_start(m, memory, size, path))
+		return false;
+	run(m, &memory[0], 0);
+	if(!trace_stop(m) || !trace_open(&replay, path))
+		return false;
+	u64 count = 0;
+	while(trace_next(&replay)) count += !replay.interrupt;
+	trace_close(&replay);
+	remove(path);
+	return count == m->instructions && replay.cycles == m->cycles &&
+	       replay.pc == m->pc && replay.sp == m->sp &&
+	       memcmp(replay.registers, m->registers, 8) == 0 &&
+	       memcmp(replay.memory, memory, size) == 0;
+}
+
+// Number of inputs test/batch.8085 is run on, over more than one pack
+#define BATCH_INPUTS 40
+
+// A machine compiling and running a program on a thread of its own
+#define THREADS 4
+typedef struct {
+	pthread_t   thread;
+	const char *source;
+	Machine     m;
+	u8          memory[0xffff];
+} ThreadRun;
+
+static void *run_thread(void *arg) {
+	ThreadRun *t       = (ThreadRun *)arg;
+	u16        pointer = 0;
+	memset(t->memory, 0, sizeof(t->memory));
+	t->m.sp = 0xffff - 1;
+	compiler_reset();
+	if(compile(t->source, &t->memory[0], sizeof(t->memory), &pointer) ==
+	   COMPILE_OK)
+		run(&t->m, &t->memory[0], 0);
+	compiler_reset();
+	return NULL;
+}
+
+// Compiles and runs 'source' on THREADS machines at once
+static void run_threads(ThreadRun *runs, const char *source, u8 engine) {
+	for(u8 i = 0; i < THREADS; i++) {
+		machine_init(&runs[i].m);
+		runs[i].m.engine = engine;
+		runs[i].source   = source;
+		pthread_create(&runs[i].thread, NULL, run_thread, &runs[i]);
+	}
+	for(u8 i = 0; i < THREADS; i++) {
+		pthread_join(runs[i].thread, NULL);
+		machine_destroy(&runs[i].m);
+	}
+}
+
+// A device which answers each 'in' with the port plus one, and keeps
+// what the 'out's write
+typedef struct {
+	u8 ports[4];
+	u8 values[4];
+	u8 count;
+} Latch;
+
+static u8 latch_read(void *device, Machine *m, u8 port) {
+	(void)device;
+	(void)m;
+	return port + 1;
+}
+
+static void latch_write(void *device, Machine *m, u8 port, u8 value) {
+	Latch *l = (Latch *)device;
+	(void)m;
+	if(l->count < 4) {
+		l->ports[l->count]  = port;
+		l->values[l->count] = value;
+		l->count++;
+	}
+}
+
+// Raises the interrupts whose INTERRUPT_* are written to it
+static void raise_write(void *device, Machine *m, u8 port, u8 value) {
+	(void)device;
+	(void)port;
+	interrupt_raise(m, value);
+}
+
+// Raises RST 7.5 every 'period' cycles, 'count' times
+typedef struct {
+	u64 period;
+	u32 ticks;
+	u32 count;
+} Ticker;
+
+static void ticker_fire(void *context, Machine *m, u64 at) {
+	Ticker *t = (Ticker *)context;
+	t->ticks++;
+	interrupt_raise(m, INTERRUPT_RST75);
+	if(t->ticks < t->count)
+		event_schedule(m, at + t->period, ticker_fire, t);
+}
+
+// Appends the tag it was scheduled with to 'fired'
+static char fired[8];
+static void record_fire(void *context, Machine *m, u64 at) {
+	(void)m;
+	(void)at;
+	fired[strlen(fired)] = *(char *)context;
+}
+
+// Raises TRAP
+static void trap_fire(void *context, Machine *m, u64 at) {
+	(void)context;
+	(void)at;
+	interrupt_raise(m, INTERRUPT_TRAP);
+}
+
+// Runs the manifest at 'path', and reads back the first 'count' lines
+// it writes
+static bool manifest_lines(const char *path, char lines[][512], u32 count) {
+	FILE *f = tmpfile();
+	if(f == NULL || !manifest_run(path, f))
+		return false;
+	rewind(f);
+	for(u32 i = 0; i < count; i++)
+		if(fgets(lines[i], 512, f) == NULL)
+			lines[i][0] = '\0';
+	fclose(f);
+	return true;
+}
+
 #define TEST(name)                                                       \
 	total_count++;                                                       \
 	testname = strdup(#name);                                            \
 	printf("\r%*.s", 50, " ");                                           \
 	phylw("\r[Test] ", "%-4s", #name);                                   \
 	failed = false;                                                      \
-	reset_machine(&m, &memory[0], size);                                 \
+	reset_machine(&m, &memory[0]);                                       \
 	source = readFile("test/" #name ".8085");                            \
 	if(source == NULL || !run_source(source, &m, &memory[0], size, 0)) { \
 		pred(" [failed]");                                               \
@@ -90,9 +257,10 @@ static bool run_source(const char *source, Machine *m, u8 *memory, u16 size,
 #define flp flag(FLG_P)
 #define flc flag(FLG_C)
 
-void test_all() {
+static void test_engine(u8 engine) {
 	Machine m;
 	machine_init(&m);
+	m.engine = engine;
 	u8      memory[0xffff];
 	u16     size        = 0xffff;
 	char *  source      = NULL;
@@ -100,6 +268,9 @@ void test_all() {
 	char *  testname    = NULL;
 	u8      total_count = 0, pass_count = 0, fail_count = 0;
 
+	pinfo("Testing the %s engine\n", machine_engine_name(engine));
+	init_machine(&m, &memory[0], size);
+
 	// All tests are sorted in the order of dependency
 
 	TEST(lxi);
@@ -355,5 +526,447 @@ void test_all() {
 	EXPECT(sp, 0xfffe);
 	DECIDE();
 
+	TEST(cycles);
+	EXPECT((u32)m.cycles, 153);
+	EXPECT((u32)m.instructions, 17);
+	// Resuming in slices must end up where a single run does
+	pc             = 0;
+	sp             = 0xffff - 1;
+	reg(REG_FL)    = 0;
+	m.cycles       = 0;
+	m.instructions = 0;
+	machine_set_budget(&m, 16);
+	while(run(&m, &memory[0], 0) == RUN_BUDGET) machine_set_budget(&m, 16);
+	EXPECT(rb, 0x00);
+	EXPECT(sp, 0xffff - 1);
+	EXPECT((u32)m.cycles, 153);
+	EXPECT((u32)m.instructions, 17);
+	DECIDE();
+
+	TEST(threads);
+	EXPECT(ra, 0x8f);
+	static ThreadRun runs[THREADS];
+	run_threads(runs, source, engine);
+	for(u8 i = 0; i < THREADS; i++) {
+		EXPECT(runs[i].m.registers[REG_A], 0x8f);
+		EXPECT((u32)runs[i].m.cycles, (u32)m.cycles);
+	}
+	DECIDE();
+
+	TEST(batch);
+	EXPECT(ra, 0x00);
+	// Every machine must end like the one which runs by itself, and the
+	// ones which branch like the first of their pack stay with it
+	static BatchInput  inputs[BATCH_INPUTS];
+	static BatchResult results[BATCH_INPUTS];
+	BatchOptions       options = {0, 0, engine};
+	for(u8 i = 0; i < BATCH_INPUTS; i++) {
+		inputs[i] = (BatchInput){{0}, 0xffff - 1, 0, NULL, 0, NULL};
+		inputs[i].registers[REG_B] = i % 4;
+		inputs[i].registers[REG_C] = 0x23;
+	}
+	batch_run(memory, size, &options, inputs, results, BATCH_INPUTS);
+	for(u8 i = 0; i < BATCH_INPUTS; i++) {
+		memset(m.registers, 0, 8);
+		rb             = i % 4;
+		rc             = 0x23;
+		pc             = 0;
+		m.cycles       = 0;
+		m.instructions = 0;
+		run(&m, &memory[0], 0);
+		EXPECT(results[i].registers[REG_A], ra);
+		EXPECT(results[i].registers[REG_FL], reg(REG_FL));
+		EXPECT((u32)results[i].cycles, (u32)m.cycles);
+		EXPECT(results[i].status, RUN_HALTED);
+#ifdef NEOVM_BATCH
+		EXPECT(results[i].diverged, (i % 4 != 0));
+#endif
+		EXPECT(results[i].diff_count, (ra ? 1u : 0u));
+		if(results[i].diff_count == 1)
+			EXPECT(results[i].diffs[0].addr, 0x2000);
+	}
+	memory[0x2000] = 0;
+	batch_free(results, BATCH_INPUTS);
+	// The reads of the byte after 0xffff wrap around to 0, as in run().
+	// lhld 0ffffh loads hl with 2a76h, and the ret from sp = 0xffff
+	// returns to the hlt at 2a76h.
+	static u8 wrapping[0x10000];
+	memcpy(wrapping, "\x2a\xff\xff\xc9", 4);
+	wrapping[0xffff] = 0x76;
+	wrapping[0x2a76] = 0x76;
+	for(u8 i = 0; i < 2; i++)
+		inputs[i] = (BatchInput){{0}, 0xffff, 0, NULL, 0, NULL};
+	batch_run(wrapping, sizeof(wrapping), &options, inputs, results, 2);
+	for(u8 i = 0; i < 2; i++) {
+		EXPECT(results[i].registers[REG_H], 0x2a);
+		EXPECT(results[i].registers[REG_L], 0x76);
+		EXPECT((u32)results[i].instructions, 3);
+		EXPECT((u32)results[i].cycles, 16 + 10 + 5);
+		EXPECT(results[i].status, RUN_HALTED);
+	}
+	batch_free(results, 2);
+	DECIDE();
+
+	TEST(snapshot);
+	EXPECT(memory[0x2003], 0x01);
+	// Running again from a snapshot must give the same machine, after the
+	// memory written since is put back
+	snapshot_save(&saved, &m, &memory[0], size);
+	u16 halted_at = pc;
+	for(u8 i = 0; i < 2; i++) {
+		pc = 0;
+		run(&m, &memory[0], 0);
+		EXPECT(memory[0x2003], 0x02);
+		EXPECT((u32)m.cycles, (u32)saved.cycles * 2);
+		snapshot_restore(&saved, &m, &memory[0]);
+		EXPECT(memory[0x2000], 0x01);
+		EXPECT(memory[0x2003], 0x01);
+		EXPECT(pc, halted_at);
+		EXPECT((u32)m.cycles, (u32)saved.cycles);
+	}
+	DECIDE();
+
+	TEST(journal);
+	EXPECT(memory[0x2002], 0x01);
+	// Stepping back over all the instructions must give the machine and
+	// the memory the program started with, and running again the same end
+	u64 journal_cycles       = m.cycles;
+	u64 journal_instructions = m.instructions;
+	reset_machine(&m, &memory[0]);
+	journal_set_size(&m, 4096);
+	run_source(source, &m, &memory[0], size, 0);
+	u32 undone = 0;
+	while(journal_step_back(&m, &memory[0])) undone++;
+	EXPECT(undone, (u32)journal_instructions);
+	EXPECT(pc, 0x00);
+	EXPECT((u32)m.cycles, 0u);
+	EXPECT(memory[0x2000], 0x00);
+	EXPECT(memory[0xfffc], 0x00);
+	machine_flush_cache(&m);
+	run(&m, &memory[0], 0);
+	EXPECT(memory[0x2002], 0x01);
+	EXPECT((u32)m.cycles, (u32)journal_cycles);
+	// Back to before the last store
+	machine_add_breakpoint(&m, 0x0e);
+	journal_reverse_continue(&m, &memory[0]);
+	EXPECT(pc, 0x0e);
+	EXPECT(rb, 0x01);
+	EXPECT(memory[0x2002], 0x00);
+	journal_set_size(&m, 0);
+	DECIDE();
+
+	TEST(trace);
+	EXPECT(sp, 0x2ff8);
+	EXPECT(rh, 0x12);
+	EXPECT(rl, 0x37);
+	EXPECT(memory[0x2000], 0x37);
+	EXPECT(memory[0x2ff8], 0x38);
+	// Replaying the trace must give the same end
+	reset_machine(&m, &memory[0]);
+	EXPECT(trace_source(source, &m, &memory[0], size, "test/trace.trace"),
+	       true);
+	DECIDE();
+
+	TEST(profile);
+	EXPECT(rb, 0x00);
+	// The loop takes the most T-states, with jnz taken 9 times out of 10
+	reset_machine(&m, &memory[0]);
+	profile_set(&m, true);
+	run_source(source, &m, &memory[0], size, 0);
+	u16 hottest[3];
+	EXPECT(profile_hottest(&m, hottest, 3), 3u);
+	EXPECT(hottest[0], 0x03);
+	EXPECT(hottest[1], 0x02);
+	EXPECT(hottest[2], 0x00);
+	EXPECT((u32)m.profile->executions[0x03], 10u);
+	EXPECT((u32)m.profile->tstates[0x03], 97u);
+	EXPECT((u32)m.profile->tstates[0x02], 40u);
+	EXPECT((u32)m.profile->total, (u32)m.cycles);
+	profile_set(&m, false);
+	DECIDE();
+
+	TEST(calls);
+	EXPECT(ra, 0x06);
+	// The subroutine which pops its return address and the one which
+	// swaps it must both be left, for the machine to halt outside of all
+	reset_machine(&m, &memory[0]);
+	callgraph_set(&m, true);
+	run_source(source, &m, &memory[0], size, 0);
+	const CallGraph *g = m.callgraph;
+	EXPECT(g->depth, 0u);
+	EXPECT((u32)g->calls[0x0f], 1u);
+	EXPECT((u32)g->calls[0x16], 2u);
+	EXPECT((u32)g->calls[0x19], 1u);
+	EXPECT((u32)g->calls[0x1b], 1u);
+	EXPECT((u32)g->exclusive[0x0f], 46u);
+	EXPECT((u32)g->inclusive[0x0f], 80u);
+	EXPECT((u32)g->inclusive[0x16], 34u);
+	EXPECT((u32)g->inclusive[0x19], 10u);
+	EXPECT((u32)g->inclusive[0x1b], 36u);
+	EXPECT((u32)g->nodes[0].tstates, 79u);
+	EXPECT((u32)g->tstates, (u32)m.cycles);
+	u16 slowest[2];
+	EXPECT(callgraph_hottest(&m, slowest, 2), 2u);
+	EXPECT(slowest[0], 0x0f);
+	EXPECT(slowest[1], 0x1b);
+	callgraph_set(&m, false);
+	DECIDE();
+
+	TEST(watch);
+	EXPECT(memory[0x2010], 0x01);
+	// The machine must stop after the read of 0x2000 and the write to
+	// 0x2010, but not after the write to 0x2000, and run on once nothing
+	// is watched
+	reset_machine(&m, &memory[0]);
+	watch_add(&m, 0x2000, 0x2000, WATCH_READ);
+	watch_add(&m, 0x2010, 0x201f, WATCH_WRITE);
+	run_source(source, &m, &memory[0], size, 0);
+	EXPECT(pc, 0x06);
+	EXPECT(ra, 0x01);
+	EXPECT(m.isbroken, 1);
+	m.isbroken = 0;
+	EXPECT(run(&m, &memory[0], 0), RUN_BROKEN);
+	EXPECT(pc, 0x0a);
+	EXPECT(memory[0x2010], 0x01);
+	EXPECT(watch_remove(&m, 0x2000, 0x201f, WATCH_READ | WATCH_WRITE), 17u);
+	EXPECT(m.hooks, 0);
+	m.isbroken = 0;
+	EXPECT(run(&m, &memory[0], 0), RUN_HALTED);
+	DECIDE();
+
+	// Attached before the test, for its first run not to ask the console
+	Latch latch = {{0}, {0}, 0};
+	for(u16 port = 0x10; port < 0x22; port++) {
+		io_attach_in(&m, port, latch_read, NULL);
+		io_attach_out(&m, port, latch_write, NULL, &latch);
+	}
+	TEST(io);
+	EXPECT(rb, 0x21);
+	EXPECT(ra, 0x22);
+	EXPECT(latch.count, 2);
+	EXPECT(latch.ports[0], 0x10);
+	EXPECT(latch.values[0], 0x42);
+	EXPECT(latch.ports[1], 0x11);
+	EXPECT(latch.values[1], 0x22);
+	io_reset(&m);
+	DECIDE();
+
+	static const u8 summed[] = {1, 2, 3, 4};
+	IoStream        stream;
+	IoCapture       capture = {NULL, 0, 0};
+	io_stream_bytes(&stream, summed, 3);
+	io_attach_stream(&m, 0x30, &stream);
+	io_attach_capture(&m, 0x31, &capture);
+	io_attach_capture(&m, 0x32, &capture);
+	TEST(stream);
+	EXPECT(rb, 0x06);
+	EXPECT(capture.count, 4u);
+	EXPECT(capture.bytes[2].port, 0x31);
+	EXPECT(capture.bytes[2].value, 0x06);
+	EXPECT(capture.bytes[3].port, 0x32);
+	EXPECT((u32)stream.consumed, 4u);
+	io_capture_free(&capture);
+	io_reset(&m);
+	// Each machine of the batch must read its own stream, the ones past
+	// the end reading 0, and write out the running sums of it
+	BatchStream streams[BATCH_INPUTS];
+	for(u8 i = 0; i < BATCH_INPUTS; i++) {
+		streams[i] = (BatchStream){0x30, i % 5u, summed};
+		inputs[i]  = (BatchInput){{0}, 0xffff - 1, 0, NULL, 1, &streams[i]};
+	}
+	batch_run(memory, size, &options, inputs, results, BATCH_INPUTS);
+	for(u8 i = 0; i < BATCH_INPUTS; i++) {
+		u8 count = i % 5, sum = count * (count + 1) / 2;
+		EXPECT(results[i].status, RUN_HALTED);
+		EXPECT(results[i].registers[REG_B], sum);
+		EXPECT(results[i].output_count, count + 1u);
+		if(results[i].output_count == count + 1u) {
+			EXPECT(results[i].outputs[count].port, 0x32);
+			EXPECT(results[i].outputs[count].value, sum);
+		}
+	}
+	batch_free(results, BATCH_INPUTS);
+	DECIDE();
+
+	io_attach_out(&m, 0x40, raise_write, NULL, NULL);
+	TEST(interrupt);
+	// RST 7.5 is taken after the 'out' which raises it, RST 5.5 stays
+	// pending while masked, TRAP is taken while disabled, and RST 5.5
+	// once unmasked and enabled, after the instruction which follows ei
+	EXPECT(rc, 0x01);
+	EXPECT(rd, 0x1b);
+	EXPECT(re, 0x01);
+	EXPECT(rb, 0x13);
+	EXPECT(rh, 0x01);
+	EXPECT(pc, 0x5b);
+	EXPECT(sp, 0x3000);
+	EXPECT(m.interrupts.ready, 0);
+	// Raised between two runs, it is taken before the first instruction
+	interrupt_raise(&m, INTERRUPT_TRAP);
+	EXPECT(run(&m, &memory[0], 0), RUN_HALTED);
+	EXPECT(re, 0x02);
+	EXPECT(pc, 0x5c);
+	// Stepping back over all of it must undo the interrupts taken, and
+	// what ei, di and sim did
+	reset_machine(&m, &memory[0]);
+	journal_set_size(&m, 64 * 1024);
+	run_source(source, &m, &memory[0], size, 0);
+	while(journal_step_back(&m, &memory[0]))
+		;
+	EXPECT(pc, 0x00);
+	EXPECT((u32)m.cycles, 0u);
+	EXPECT(m.interrupts.enabled, 0);
+	EXPECT(m.interrupts.mask, 0x07);
+	EXPECT(m.interrupts.pending, 0);
+	journal_set_size(&m, 0);
+	io_reset(&m);
+	DECIDE();
+
+	io_attach_out(&m, 0x40, raise_write, NULL, NULL);
+	TEST(isr);
+	// RST 5.5 and then TRAP are taken after the 'out's, before the calls
+	EXPECT(rb, 0x01);
+	EXPECT(pc, 0x46);
+	EXPECT(sp, 0x3000);
+	// Stepping back over the push the handler of RST 5.5 starts with
+	// must undo it along with the return address the interrupt pushed
+	reset_machine(&m, &memory[0]);
+	memset(&memory[0x2ff8], 0xaa, 8);
+	journal_set_size(&m, 64 * 1024);
+	run_source(source, &m, &memory[0], size, 0);
+	while(journal_step_back(&m, &memory[0]))
+		;
+	EXPECT(pc, 0x00);
+	for(u32 addr = 0x2ff8; addr < 0x3000; addr++)
+		EXPECT(memory[addr], 0xaa);
+	journal_set_size(&m, 0);
+	// The trace and the profile count the T-states of the interrupts,
+	// apart from the instructions at their vectors
+	reset_machine(&m, &memory[0]);
+	EXPECT(trace_source(source, &m, &memory[0], size, "test/isr.trace"),
+	       true);
+	reset_machine(&m, &memory[0]);
+	profile_set(&m, true);
+	run_source(source, &m, &memory[0], size, 0);
+	EXPECT((u32)m.profile->total, (u32)m.cycles);
+	EXPECT((u32)m.profile->executions[0x2c], 1u);
+	EXPECT((u32)m.profile->tstates[0x2c], 12u + 12u);
+	EXPECT((u32)m.profile->executions[0x24], 1u);
+	EXPECT((u32)m.profile->tstates[0x24], 12u + 4u);
+	EXPECT((u32)m.profile->executions[0x3b], 1u);
+	EXPECT((u32)m.profile->tstates[0x3b], 18u);
+	profile_set(&m, false);
+	// Each handler is entered as a subroutine, and the call at the
+	// return address of TRAP is not taken for one by its first instruction
+	reset_machine(&m, &memory[0]);
+	callgraph_set(&m, true);
+	run_source(source, &m, &memory[0], size, 0);
+	EXPECT(m.callgraph->depth, 0u);
+	EXPECT((u32)m.callgraph->calls[0x2c], 1u);
+	EXPECT((u32)m.callgraph->calls[0x24], 1u);
+	EXPECT((u32)m.callgraph->calls[0x25], 0u);
+	EXPECT((u32)m.callgraph->calls[0x46], 2u);
+	EXPECT((u32)m.callgraph->inclusive[0x2c], 12u + 12u + 10u + 4u + 10u);
+	EXPECT((u32)m.callgraph->inclusive[0x24], 12u + 4u + 10u);
+	EXPECT((u32)m.callgraph->tstates, (u32)m.cycles);
+	callgraph_set(&m, false);
+	io_reset(&m);
+	DECIDE();
+
+	Ticker ticker = {1000, 0, 4};
+	event_schedule(&m, 1000, ticker_fire, &ticker);
+	TEST(event);
+	// The hlt waits for each tick, whose interrupt wakes it up, and the
+	// last one, with the interrupts disabled, through the last tick
+	EXPECT(rc, 0x03);
+	EXPECT(ticker.ticks, 4);
+	EXPECT((m.cycles == 4000 + 5), true);
+	EXPECT((m.next_event == u64_MAX), true);
+	// The events due are fired before the first instruction, the earliest
+	// first, and the ones of the same cycles in the order they were
+	// scheduled in, and the hlt waits for the one after them
+	u64  waited = m.cycles + 1000;
+	char tags[] = "abcdex";
+	memset(fired, 0, sizeof(fired));
+	event_schedule(&m, m.cycles, record_fire, &tags[2]);
+	event_schedule(&m, m.cycles - 2, record_fire, &tags[1]);
+	event_schedule(&m, m.cycles, record_fire, &tags[5]);
+	event_schedule(&m, m.cycles, record_fire, &tags[3]);
+	event_schedule(&m, m.cycles - 5, record_fire, &tags[0]);
+	event_schedule(&m, m.cycles + 1000, record_fire, &tags[4]);
+	EXPECT(event_cancel(&m, record_fire, &tags[5]), 1);
+	pc--; // back on the last hlt
+	EXPECT(run(&m, &memory[0], 0), RUN_HALTED);
+	EXPECT(strcmp(fired, "abcde"), 0);
+	EXPECT((m.cycles == waited + 5), true);
+	EXPECT((m.next_event == u64_MAX), true);
+	DECIDE();
+
+	// TRAP wakes up a hlt while the interrupts are disabled
+	event_schedule(&m, 1000, trap_fire, NULL);
+	TEST(trap);
+	EXPECT(rb, 0x01);
+	EXPECT(pc, 0x26);
+	// The hlt woken up, the interrupt, inr b and the hlt at the end
+	EXPECT((m.cycles == 1000 + 5 + 12 + 4 + 5), true);
+	DECIDE();
+
+	// The TRAP is taken when it is raised, in the middle of a busy loop
+	// whose blocks are compiled by the JIT
+	event_schedule(&m, 5000, trap_fire, NULL);
+	TEST(busy);
+	EXPECT(pc, 0x25);
+	EXPECT((m.cycles >= 5000 && m.cycles < 5040), true);
+	EXPECT((m.next_event == u64_MAX), true);
+	DECIDE();
+
+	io_attach_in(&m, 0x10, latch_read, NULL);
+	TEST(manifest);
+	EXPECT(memory[0x8001], 0x11);
+	io_reset(&m);
+	// Each run of a job gets a line, and so does each job which cannot
+	// be run, in the order of the manifest
+	char lines[5][512];
+	EXPECT(manifest_lines("test/manifest.json", lines, 5), true);
+	EXPECT((strstr(lines[0], "{\"id\":\"sum\",\"run\":0,\"status\":"
+	                         "\"halted\",\"cycles\":59,\"instructions\":7,"
+	                         "\"registers\":{\"a\":12,\"b\":5,") == lines[0]),
+	       true);
+	EXPECT((strstr(lines[0], "\"memory\":{\"0x8000\":[5,12]},"
+	                         "\"outputs\":[[32,12]]}\n") != NULL),
+	       true);
+	EXPECT((strstr(lines[1], "\"run\":1,") != NULL), true);
+	EXPECT((strstr(lines[1], "\"sp\":12288}") != NULL), true);
+	EXPECT((strstr(lines[1], "\"0x8000\":[250,10]") != NULL), true);
+	EXPECT((strstr(lines[2], "\"id\":\"missing\",\"run\":null,"
+	                         "\"status\":\"read_error\"") != NULL),
+	       true);
+	EXPECT((strstr(lines[3], "\"id\":\"manifest.8085\",\"run\":0,"
+	                         "\"status\":\"budget\"") != NULL),
+	       true);
+	EXPECT((strstr(lines[4], "\"status\":\"manifest_error\","
+	                         "\"error\":\"run 0 : bad register 'x'\"") != NULL),
+	       true);
+	DECIDE();
+
+	TEST(psw);
+	EXPECT(rb, 0x00);
+	EXPECT(rc, 0x55);
+	EXPECT(rd, 0x01);
+	EXPECT(re, 0x01);
+	DECIDE();
+
 	SHOW_STAT();
+	machine_destroy(&m);
+}
+
+void test_all() {
+	test_engine(ENGINE_SWITCH);
+#ifdef NEOVM_THREADED
+	test_engine(ENGINE_THREADED);
+	test_engine(ENGINE_BLOCK);
+#ifdef NEOVM_JIT
+	test_engine(ENGINE_JIT);
+#endif
+#endif
 }
@@ -0,0 +1,271 @@
+#include "trace.h"
+#include "display.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The bytes kept before they are written out at once
+#define TRACE_BUFFER (1024 * 1024)
+// The most bytes one instruction takes, with all that it can change
+#define MAX_RECORD (3 + 8 + 2 + 2 + 1 + 2 * 3)
+// And a frame
+#define FRAME_SIZE (1 + 8 + 2 + 2 + 8 + 8)
+#define MAX_WRITES 2
+
+// What the trace holds so far, against which the next instruction is
+// written, and the instruction being executed
+struct Trace {
+	FILE *file;
+	u8 *  buffer;
+	u32   used;
+	bool  failed;
+	u64   length;
+
+	u8  registers[8];
+	u16 sp;
+	u64 cycles;
+	u64 instructions;
+
+	u16 at; // where the instruction being executed is
+	u8  opcode;
+	u8  write_count;
+	u16 addr[MAX_WRITES];
+	u8  value[MAX_WRITES];
+};
+
+static u8 *put_word(u8 *p, u16 value) {
+	p[0] = value & 0xff;
+	p[1] = value >> 8;
+	return p + 2;
+}
+
+static u8 *put_long(u8 *p, u64 value) {
+	for(u8 i = 0; i < 8; i++) p[i] = (value >> (i * 8)) & 0xff;
+	return p + 8;
+}
+
+static void flush(struct Trace *t) {
+	if(t->used && fwrite(t->buffer, 1, t->used, t->file) != t->used)
+		t->failed = true;
+	t->used = 0;
+}
+
+bool trace_start(Machine *m, const u8 *memory, u32 size,
+                 const char *path) {
+	trace_stop(m);
+	FILE *f = fopen(path, "wb");
+	if(f == NULL)
+		return false;
+	if(size > 0x10000)
+		size = 0x10000;
+	struct Trace *t = (struct Trace *)calloc(1, sizeof(struct Trace));
+	t->file         = f;
+	t->buffer       = (u8 *)calloc(1, TRACE_BUFFER);
+	// The trace always starts with all of the memory, which is 0 past
+	// the end of the memory given
+	u32 rest = 0x10000 - size;
+	if(fwrite(TRACE_MAGIC, 1, 8, f) != 8 ||
+	   fwrite(memory, 1, size, f) != size ||
+	   fwrite(t->buffer, 1, rest, f) != rest)
+		t->failed = true;
+	// The first instruction always starts with a frame
+	t->cycles = ~m->cycles;
+	m->trace  = t;
+	m->hooks |= HOOK_TRACE;
+	return true;
+}
+
+bool trace_stop(Machine *m) {
+	struct Trace *t = m->trace;
+	if(t == NULL)
+		return true;
+	flush(t);
+	bool ok = !t->failed;
+	if(fclose(t->file) != 0)
+		ok = false;
+	free(t->buffer);
+	free(t);
+	m->trace = NULL;
+	m->hooks &= ~HOOK_TRACE;
+	return ok;
+}
+
+u64 trace_length(const Machine *m) {
+	return m->trace ? m->trace->length : 0;
+}
+
+void trace_begin(Machine *m, const u8 *memory) {
+	struct Trace *t = m->trace;
+	machine_sync_flags(m);
+	if(m->pc != t->at || m->sp != t->sp || m->cycles != t->cycles ||
+	   m->instructions != t->instructions ||
+	   memcmp(m->registers, t->registers, sizeof(t->registers))) {
+		u8 *p = &t->buffer[t->used];
+		*p++  = 0;
+		memcpy(p, m->registers, sizeof(m->registers));
+		p = put_word(p + sizeof(m->registers), m->pc);
+		p = put_word(p, m->sp);
+		p = put_long(p, m->cycles);
+		p = put_long(p, m->instructions);
+		memcpy(t->registers, m->registers, sizeof(t->registers));
+		t->sp           = m->sp;
+		t->cycles       = m->cycles;
+		t->instructions = m->instructions;
+		t->used         = p - t->buffer;
+		if(t->used > TRACE_BUFFER - MAX_RECORD)
+			flush(t);
+	}
+	t->at          = m->pc;
+	t->opcode      = memory[m->pc];
+	t->write_count = 0;
+}
+
+void trace_write(Machine *m, u16 addr, u8 value) {
+	struct Trace *t = m->trace;
+	// Each interrupt taken has a record of its own, so an instruction
+	// never writes more
+	if(t->write_count == MAX_WRITES) {
+		perr("[Internal error] The trace has no room for the write to "
+		     "0x%04x of the instruction at 0x%04x!\n",
+		     addr, t->at);
+		abort();
+	}
+	t->addr[t->write_count]  = addr;
+	t->value[t->write_count] = value;
+	t->write_count++;
+}
+
+// Writes what changed since the last record, 'control' holding the
+// T-states, and moves on to the instruction at the pc
+static void put_record(struct Trace *t, Machine *m, const u8 *memory,
+                       u8 control) {
+	machine_sync_flags(m);
+	u8 *record  = &t->buffer[t->used];
+	u8 *p       = record + 3;
+	u8  changed = 0;
+	for(u8 i = 0; i < 8; i++) {
+		if(m->registers[i] == t->registers[i])
+			continue;
+		changed |= 1 << i;
+		*p++ = t->registers[i] = m->registers[i];
+	}
+	if(m->pc != (u16)(t->at + opcode_length[t->opcode]) ||
+	   (control & TRACE_TSTATES) == 0) {
+		control |= TRACE_JUMP;
+		p = put_word(p, m->pc);
+	}
+	if(m->sp != t->sp) {
+		control |= TRACE_SP;
+		p     = put_word(p, m->sp);
+		t->sp = m->sp;
+	}
+	if(t->write_count) {
+		control |= TRACE_WRITES;
+		*p++ = t->write_count;
+		for(u8 i = 0; i < t->write_count; i++) {
+			p    = put_word(p, t->addr[i]);
+			*p++ = t->value[i];
+		}
+	}
+	record[0] = control;
+	record[1] = t->opcode;
+	record[2] = changed;
+	t->used   = p - t->buffer;
+	if(t->used > TRACE_BUFFER - FRAME_SIZE - MAX_RECORD)
+		flush(t);
+	t->at          = m->pc;
+	t->opcode      = memory[m->pc];
+	t->write_count = 0;
+}
+
+void trace_record(Machine *m, const u8 *memory, u8 tstates) {
+	struct Trace *t = m->trace;
+	put_record(t, m, memory, tstates);
+	t->length++;
+	t->cycles += tstates;
+	t->instructions++;
+}
+
+void trace_interrupt(Machine *m, const u8 *memory) {
+	struct Trace *t = m->trace;
+	// Always with the jump to the vector, for 0 T-states to tell it
+	put_record(t, m, memory, 0);
+	t->cycles += 12;
+}
+
+bool trace_open(TraceReader *r, const char *path) {
+	memset(r, 0, sizeof(TraceReader));
+	r->file = fopen(path, "rb");
+	if(r->file == NULL)
+		return false;
+	char magic[8];
+	if(fread(magic, 1, 8, r->file) != 8 || memcmp(magic, TRACE_MAGIC, 8) ||
+	   fread(r->memory, 1, 0x10000, r->file) != 0x10000) {
+		trace_close(r);
+		return false;
+	}
+	return true;
+}
+
+static u16 get_word(FILE *f) {
+	u16 low = getc(f);
+	return low | ((u16)getc(f) << 8);
+}
+
+static u64 get_long(FILE *f) {
+	u64 value = 0;
+	for(u8 i = 0; i < 8; i++) value |= (u64)getc(f) << (i * 8);
+	return value;
+}
+
+bool trace_next(TraceReader *r) {
+	FILE *f       = r->file;
+	int   control = getc(f);
+	r->resumed    = 0;
+	while(control == 0) {
+		if(fread(r->registers, 1, 8, f) != 8)
+			return false;
+		r->pc           = get_word(f);
+		r->sp           = get_word(f);
+		r->cycles       = get_long(f);
+		r->instructions = get_long(f);
+		r->resumed      = 1;
+		control         = getc(f);
+	}
+	if(control == EOF)
+		return false;
+	r->at        = r->pc;
+	r->opcode    = getc(f);
+	r->changed   = getc(f);
+	r->tstates   = control & TRACE_TSTATES;
+	r->interrupt = r->tstates == 0;
+	if(r->interrupt)
+		r->tstates = 12;
+	for(u8 i = 0; i < 8; i++)
+		if(r->changed & (1 << i))
+			r->registers[i] = getc(f);
+	r->pc = r->at + opcode_length[r->opcode];
+	if(control & TRACE_JUMP)
+		r->pc = get_word(f);
+	if(control & TRACE_SP)
+		r->sp = get_word(f);
+	r->write_count = 0;
+	if(control & TRACE_WRITES) {
+		r->write_count = getc(f);
+		if(r->write_count > 2)
+			return false;
+		for(u8 i = 0; i < r->write_count; i++) {
+			r->addr[i]             = get_word(f);
+			r->value[i]            = getc(f);
+			r->memory[r->addr[i]] = r->value[i];
+		}
+	}
+	r->cycles += r->tstates;
+	r->instructions += !r->interrupt;
+	return !feof(f);
+}
+
+void trace_close(TraceReader *r) {
+	if(r->file)
+		fclose(r->file);
+	r->file = NULL;
+}
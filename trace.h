@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+#include <stdio.h>
+
+// A trace is a file of every instruction a machine executes while it is
+// traced, written through a large buffer for the machine to keep running
+// at tens of millions of instructions a second. It starts with the
+// memory as it was when the tracing started, and each instruction is
+// then kept as what it changed from the one before it :
+//
+//   control       T-states in the low 5 bits, and TRACE_JUMP, TRACE_SP
+//                 and TRACE_WRITES
+//   opcode
+//   changed       one bit for each register, by its REG_* index
+//   registers     the new value of each one changed
+//   pc            if TRACE_JUMP, when it is not the next instruction
+//   sp            if TRACE_SP
+//   writes        if TRACE_WRITES, a count followed by the address and
+//                 the value of each byte written
+//
+// An interrupt taken is kept as a record of 0 T-states, which stands
+// for its 12, with the opcode of the instruction it was taken before,
+// the vector as the pc, and the return address it pushed as its writes.
+// It is not counted as an instruction.
+//
+// All the words are little endian. A control byte of 0 starts a frame
+// instead, holding all the registers, pc, sp, cycles and instructions,
+// written whenever the machine was changed from outside of run() since
+// the last instruction. The changes to the memory from outside of run()
+// are not in the trace. The machine runs in the debug mode while it is
+// traced.
+#define TRACE_MAGIC "8085TRC1"
+#define TRACE_TSTATES 0x1f
+#define TRACE_JUMP (1 << 5)
+#define TRACE_SP (1 << 6)
+#define TRACE_WRITES (1 << 7)
+
+// Starts writing the instructions 'm' executes to the file at 'path',
+// replacing it, and stopping the trace written before. The trace starts
+// with the 'size' bytes of 'memory', and 0 for the rest of the 64K.
+// Returns false if the file cannot be written.
+bool trace_start(Machine *m, const u8 *memory, u32 size, const char *path);
+// Writes out the rest of the trace and closes it. Returns false if any
+// of it could not be written.
+bool trace_stop(Machine *m);
+// Instructions written to the present trace
+u64 trace_length(const Machine *m);
+
+// Used by the cores
+void trace_begin(Machine *m, const u8 *memory);
+void trace_write(Machine *m, u16 addr, u8 value);
+void trace_record(Machine *m, const u8 *memory, u8 tstates);
+void trace_interrupt(Machine *m, const u8 *memory);
+
+// Reads a trace back one instruction at a time, keeping the state of the
+// machine and the memory as they were after it
+typedef struct {
+	FILE *file;
+	u8    memory[0x10000];
+	u8    registers[8];
+	u16   pc; // of the next instruction
+	u16   sp;
+	u64   cycles;
+	u64   instructions;
+
+	// The last instruction read
+	u16 at;
+	u8  opcode;
+	u8  tstates;
+	u8  changed; // the registers it changed, one bit for each
+	u8  write_count;
+	u16 addr[2];
+	u8  value[2];
+	u8  resumed;   // there was a frame before it
+	u8  interrupt; // it was an interrupt taken, not an instruction
+} TraceReader;
+
+// Returns false if 'path' cannot be read or is not a trace
+bool trace_open(TraceReader *r, const char *path);
+// Reads the next instruction, returning false at the end of the trace
+bool trace_next(TraceReader *r);
+void trace_close(TraceReader *r);
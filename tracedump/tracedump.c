@@ -0,0 +1,64 @@
+// Prints a trace written with the 'trace' command of the8085, one
+// instruction on each line, disassembled along with what it changed,
+// and each interrupt taken on a line of its own :
+//
+// ./the8085_tracedump <trace> [<first instruction> [<count>]]
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../bytecode.h"
+#include "../common.h"
+#include "../display.h"
+#include "../trace.h"
+#include "../vm.h"
+
+static const char *register_names[] = {"a", "b", "c", "d",
+                                       "e", "h", "l", "fl"};
+
+// Only the memory the instructions read from is needed, which the reader
+// keeps, so it is static for the stack to stay small
+static TraceReader reader;
+
+int main(int argc, char *argv[]) {
+	if(argc < 2 || argc > 4) {
+		perr("Usage : %s <trace> [<first instruction> [<count>]]\n",
+		     argv[0]);
+		return 1;
+	}
+	u64 first = argc > 2 ? strtoull(argv[2], NULL, 10) : 0;
+	u64 count = argc > 3 ? strtoull(argv[3], NULL, 10) : u64_MAX;
+	if(!trace_open(&reader, argv[1])) {
+		perr("Unable to read the trace %s!\n", argv[1]);
+		return 1;
+	}
+	u64 index = 0, shown = 0;
+	u16 sp    = reader.sp;
+	while(shown < count && trace_next(&reader)) {
+		if(index++ < first) {
+			sp = reader.sp;
+			continue;
+		}
+		shown++;
+		if(reader.resumed)
+			phgrn("\n[run]", " from cycle %" Pu64, reader.cycles - reader.tstates);
+		if(reader.interrupt)
+			phylw("\n[interrupt]", " before %04x", reader.at);
+		else
+			bytecode_disassemble(reader.memory, reader.at);
+		printf(" %2" Pu8 "T", reader.tstates);
+		for(u8 i = 0; i < 8; i++)
+			if(reader.changed & (1 << i))
+				printf(" %s=%02x", register_names[i], reader.registers[i]);
+		if(reader.pc != (u16)(reader.at + opcode_length[reader.opcode]))
+			printf(" pc=%04x", reader.pc);
+		if(reader.sp != sp)
+			printf(" sp=%04x", reader.sp);
+		sp = reader.sp;
+		for(u8 i = 0; i < reader.write_count; i++)
+			printf(" [%04x]=%02x", reader.addr[i], reader.value[i]);
+	}
+	printf("\n%" Pu64 " instructions, %" Pu64 " cycles\n",
+	       reader.instructions, reader.cycles);
+	trace_close(&reader);
+	return 0;
+}
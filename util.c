@@ -1,4 +1,6 @@
+#include <errno.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "common.h"
 #include "display.h"
@@ -127,3 +129,17 @@ i64 random_at_most(i64 max) {
 	// Truncated division is intentional
 	return x / bin_size;
 }
+
+u64 monotonic_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void sleep_until_ns(u64 ns) {
+	struct timespec until = {.tv_sec  = ns / 1000000000,
+	                         .tv_nsec = ns % 1000000000};
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) ==
+	      EINTR)
+		;
+}
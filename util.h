@@ -8,6 +8,11 @@ char *readFile(const char *path);
 bool  parse_hex_byte(const char *str, u8 *store);
 bool  parse_hex_16(const char *str, u16 *store);
 i64   random_at_most(i64 n);
+// Nanoseconds of CLOCK_MONOTONIC, which the time spent sleeping counts
+// towards, unlike clock()
+u64 monotonic_ns();
+// Sleeps until CLOCK_MONOTONIC reaches 'ns'
+void sleep_until_ns(u64 ns);
 
 // Since it is likely that the search function
 // will be called multiple times, it is efficient
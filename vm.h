@@ -3,7 +3,19 @@
 #include "common.h"
 #include <time.h>
 
-#define MAX_BREAKPOINT_COUNT 15
+// Computed goto is a GNU extension, so the threaded core is only
+// available on compilers which support it. Define NEOVM_NO_THREADED
+// to always use the portable switch core.
+#if defined(__GNUC__) && !defined(NEOVM_NO_THREADED)
+#define NEOVM_THREADED
+#endif
+
+// The JIT generates x86-64 code, and falls back to the block engine for
+// everything it does not compile. Define NEOVM_NO_JIT to leave it out.
+#if defined(NEOVM_THREADED) && defined(__x86_64__) && defined(__unix__) && \
+    !defined(NEOVM_NO_JIT)
+#define NEOVM_JIT
+#endif
 
 #define REG_A 0
 #define REG_B 1
@@ -20,7 +32,60 @@
 #define FLG_P 2
 #define FLG_C 0
 
-typedef struct {
+// The debug hooks which have to be checked after each instruction
+#define HOOK_BREAKPOINT (1 << 0)
+#define HOOK_JOURNAL (1 << 1)
+#define HOOK_TRACE (1 << 2)
+#define HOOK_PROFILE (1 << 3)
+#define HOOK_CALLGRAPH (1 << 4)
+#define HOOK_WATCH (1 << 5)
+
+#define BREAKPOINT_AT(m, addr) \
+	(((m)->breakpoints[(addr) >> 3] >> ((addr)&7)) & 1)
+
+// How often a throttled machine checks the wall clock, per second of
+// emulated time
+#define THROTTLE_SLICES_PER_SECOND 1000
+
+// The memory is tracked in pages of 1 << PAGE_BITS bytes for the
+// snapshots
+#define PAGE_BITS 8
+#define PAGE_COUNT (0x10000 >> PAGE_BITS)
+
+// Why run() returned
+typedef enum {
+	RUN_HALTED, // executed a hlt
+	RUN_BROKEN, // reached a breakpoint, or stepped
+	RUN_BUDGET, // used up the cycle budget, and may be resumed by run()
+} RunStatus;
+
+typedef enum {
+	ENGINE_DEFAULT,  // the fastest engine available in this build
+	ENGINE_SWITCH,   // portable switch dispatch
+	ENGINE_THREADED, // computed goto dispatch
+	ENGINE_BLOCK,    // computed goto dispatch over predecoded blocks
+	ENGINE_JIT,      // native code for the hot blocks, over ENGINE_BLOCK
+} Engine;
+
+struct BlockCache;
+struct Snapshot;
+struct Journal;
+struct Trace;
+struct Profile;
+struct CallGraph;
+struct Watch;
+struct Events;
+struct Machine;
+
+// The devices on the ports are called with the device they were attached
+// with, the machine executing the 'in' or the 'out', and the port
+typedef u8 (*PortRead)(void *device, struct Machine *m, u8 port);
+typedef void (*PortWrite)(void *device, struct Machine *m, u8 port,
+                          u8 value);
+// Writes out what the device has kept back
+typedef void (*PortFlush)(void *device);
+
+typedef struct Machine {
 	// 0 -> A
 	// 1 -> B
 	// 2 -> C
@@ -34,21 +99,129 @@ typedef struct {
 	u16 pc;
 	// The stack pointer
 	u16 sp;
+	// The result the sign, zero and parity flags are to be derived from,
+	// and the two bytes whose sum sets the auxiliary carry, when they
+	// have not been written to the flag register yet
+	struct LazyFlags {
+		u8 result, lhs, rhs;
+		u8 pending;
+	} lazy;
+	// T-states and instructions executed since the machine was initialized
+	u64 cycles;
+	u64 instructions;
+	// run() returns RUN_BUDGET once 'cycles' reaches this, after the
+	// present instruction, or the present block in compiled code
+	u64 cycle_limit;
+	// Where the core has to stop next, for the budget, an event or an
+	// interrupt, which it leaves here for the compiled blocks to check
+	// on entering each
+	u64 stop_at;
 
-	u16 breakpoints[MAX_BREAKPOINT_COUNT];
-	u16 breakpoint_pointer;
-	u8 isbroken; // denotes whether or not the machine is paused on a breakpoint
+	u8  breakpoints[0x10000 / 8]; // one bit for each address
+	u32 breakpoint_count;
+	// The WATCH_* watched anywhere on each page, which is all the debug
+	// cores test for most accesses, and the addresses watched, while
+	// HOOK_WATCH is armed
+	u8            watch_pages[PAGE_COUNT];
+	struct Watch *watch;
+	u8  hooks; // the HOOK_* which are armed, none in the fast path
+	u8  isbroken; // denotes whether or not the machine is paused on a breakpoint
 
 	// For Calibration
 	u8 issilent; // don't print 'out's
-	struct timespec
-	    sleepfor; // sleepfor this much time after each t-state to sync
+	// The devices 'in' and 'out' talk to, by port, which are all the
+	// console unless others are attached
+	struct {
+		PortRead read;
+		void *   device;
+	} in[256];
+	struct {
+		PortWrite write;
+		PortFlush flush;
+		void *    device;
+	} out[256];
+	// The interrupts raised and not taken yet, and the ones masked and
+	// enabled, as interrupt.h keeps them. 'ready' is set while one of
+	// them can be taken, which is all the cores test.
+	struct Interrupts {
+		u8  pending; // INTERRUPT_*
+		u8  mask;    // the INTERRUPT_RST* masked by sim
+		u8  enabled; // by ei
+		u8  ready;
+		u8  sid, sod; // the serial input and output lines
+		// 'instructions' once the last ei was done, none being taken
+		// until the next one is
+		u64 enabled_at;
+	} interrupts;
+	// The cycles of the earliest event scheduled, which is all the cores
+	// test, or u64_MAX while there is none, and the events
+	u64            next_event;
+	struct Events *events;
+	// A throttled machine keeps to 'hz' by sleeping until the wall clock
+	// catches up with its cycles, once every slice of cycles
+	struct {
+		u32 hz;     // 0 when the machine runs unthrottled
+		u32 slice;  // cycles between two checks of the clock
+		u64 cycles; // cycles at 'origin'
+		u64 origin; // monotonic_ns() the deadlines count from
+		// How much before each deadline to wake up, as the host wakes
+		// up a sleeper late by about this much
+		u64 lead;
+		// Cycles run and wall time taken by all the throttled runs since
+		// the frequency was set, for the frequency achieved
+		u64 run_cycles;
+		u64 run_ns;
+	} throttle;
+
+	u8                 engine; // the core used to execute the instructions
+	struct BlockCache *cache;  // the blocks decoded by the block engine
+
+	// The pages of the memory written since the machine was last saved
+	// to or restored from 'snapshot', which is all another save or
+	// restore of it has to copy
+	u8                     written[PAGE_COUNT];
+	const struct Snapshot *snapshot;
+	// What the latest instructions changed, while HOOK_JOURNAL is armed
+	struct Journal *journal;
+	// Where the instructions are written, while HOOK_TRACE is armed
+	struct Trace *trace;
+	// Where the cycles went, while HOOK_PROFILE is armed
+	struct Profile *profile;
+	// The subroutines the cycles went to, while HOOK_CALLGRAPH is armed
+	struct CallGraph *callgraph;
 } Machine;
 
-void run(Machine *m, u8 *memory, u8 step);
+// Number of bytes in each instruction, by its opcode
+extern const u8 opcode_length[256];
+
+// Touches nothing but the machine and the memory given to it, so that
+// each thread can run machines of its own at the same time
+RunStatus run(Machine *m, u8 *memory, u8 step);
 void machine_print(Machine *m);
-bool machine_add_breakpoint(Machine *m, u16 addr);
+// Bring the flag register up to date with the last instruction which set
+// the flags. run() always returns with the flags up to date.
+void machine_sync_flags(Machine *m);
+void machine_add_breakpoint(Machine *m, u16 addr);
 bool machine_on_breakpoint(Machine *m, u8 *memory, u8 step);
 bool machine_remove_breakpoint(Machine *m, u16 addr);
 void machine_reset_breakpoints(Machine *m);
 void machine_init(Machine *m);
+// Throttles the machine to 'hz', or lets it run as fast as the host can
+// when 'hz' is 0
+void machine_set_frequency(Machine *m, u32 hz);
+// The frequency, in Hz, the machine has actually run at since it was
+// throttled, or 0 if it has not run since
+double machine_frequency(Machine *m);
+// Lets run() execute 'cycles' more T-states before returning RUN_BUDGET,
+// or any number of them if 'cycles' is 0
+void machine_set_budget(Machine *m, u64 cycles);
+// Release the resources acquired by the machine during execution
+void machine_destroy(Machine *m);
+// Marks the 'size' bytes from 'addr' as written, for writes to the
+// memory from outside of run() to be undone by snapshot_restore()
+void machine_mark_written(Machine *m, u16 addr, u32 size);
+// Drop everything that was decoded from the memory. Must be called
+// after the memory is changed from outside of run(), before running
+// the machine again.
+void machine_flush_cache(Machine *m);
+const char *machine_engine_name(u8 engine);
@@ -0,0 +1,98 @@
+#include "watch.h"
+#include "display.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_SIZE (1u << PAGE_BITS)
+#define WATCHED(map, addr) (((map)[(addr) >> 3] >> ((addr)&7)) & 1)
+
+// Brings the kinds watched on each page from 'from' to 'to' up to date
+// with the addresses, and arms the hook while there are any
+static void update_pages(Machine *m, u16 from, u16 to) {
+	Watch *w = m->watch;
+	for(u32 page = from >> PAGE_BITS; page <= (u32)to >> PAGE_BITS; page++) {
+		u8 kinds = 0;
+		for(u32 i = page * PAGE_SIZE / 8; i < (page + 1) * PAGE_SIZE / 8;
+		    i++) {
+			if(w->read[i])
+				kinds |= WATCH_READ;
+			if(w->write[i])
+				kinds |= WATCH_WRITE;
+		}
+		m->watch_pages[page] = kinds;
+	}
+	for(u32 page = 0; page < PAGE_COUNT; page++)
+		if(m->watch_pages[page]) {
+			m->hooks |= HOOK_WATCH;
+			return;
+		}
+	watch_reset(m);
+}
+
+void watch_add(Machine *m, u16 from, u16 to, u8 kinds) {
+	if(m->watch == NULL)
+		m->watch = (Watch *)calloc(1, sizeof(Watch));
+	for(u32 addr = from; addr <= to; addr++) {
+		if(kinds & WATCH_READ)
+			m->watch->read[addr >> 3] |= 1 << (addr & 7);
+		if(kinds & WATCH_WRITE)
+			m->watch->write[addr >> 3] |= 1 << (addr & 7);
+	}
+	update_pages(m, from, to);
+}
+
+u32 watch_remove(Machine *m, u16 from, u16 to, u8 kinds) {
+	if(m->watch == NULL)
+		return 0;
+	u32 removed = 0;
+	for(u32 addr = from; addr <= to; addr++) {
+		if(watch_kinds(m, addr) & kinds)
+			removed++;
+		if(kinds & WATCH_READ)
+			m->watch->read[addr >> 3] &= ~(1 << (addr & 7));
+		if(kinds & WATCH_WRITE)
+			m->watch->write[addr >> 3] &= ~(1 << (addr & 7));
+	}
+	update_pages(m, from, to);
+	return removed;
+}
+
+void watch_reset(Machine *m) {
+	free(m->watch);
+	m->watch = NULL;
+	memset(m->watch_pages, 0, sizeof(m->watch_pages));
+	m->hooks &= ~HOOK_WATCH;
+}
+
+u8 watch_kinds(const Machine *m, u16 addr) {
+	if(m->watch == NULL)
+		return 0;
+	return (WATCHED(m->watch->read, addr) ? WATCH_READ : 0) |
+	       (WATCHED(m->watch->write, addr) ? WATCH_WRITE : 0);
+}
+
+void watch_access(Machine *m, u16 addr, u8 kind, u8 value) {
+	Watch *w = m->watch;
+	// The first access of an instruction is the one shown
+	if(w->caught ||
+	   !WATCHED(kind == WATCH_READ ? w->read : w->write, addr))
+		return;
+	w->caught = true;
+	w->kind   = kind;
+	w->addr   = addr;
+	w->value  = value;
+}
+
+bool watch_caught(Machine *m) {
+	Watch *w = m->watch;
+	if(w == NULL || !w->caught)
+		return false;
+	w->caught = false;
+	if(w->kind == WATCH_READ)
+		phgrn("\n[watch]", " Read of 0x%02x from 0x%x caught", w->value,
+		      w->addr);
+	else
+		phgrn("\n[watch]", " Write of 0x%02x to 0x%x caught", w->value,
+		      w->addr);
+	return true;
+}
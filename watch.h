@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// Watchpoints stop the machine after an instruction which reads or
+// writes a watched address. The machine keeps the kinds of accesses
+// watched anywhere on each page of the memory, so that the debug cores
+// tell most accesses apart by the page alone, and only the accesses to
+// a watched page are checked against the addresses. The machine runs in
+// the debug mode while any address is watched.
+#define WATCH_READ (1 << 0)
+#define WATCH_WRITE (1 << 1)
+
+typedef struct Watch {
+	u8 read[0x10000 / 8];  // one bit for each address
+	u8 write[0x10000 / 8]; // one bit for each address
+	// The access which is to stop the machine after the present
+	// instruction
+	bool caught;
+	u8   kind;
+	u16  addr;
+	u8   value; // read or written
+} Watch;
+
+// Watches the addresses from 'from' to 'to', both included, for the
+// WATCH_* in 'kinds'
+void watch_add(Machine *m, u16 from, u16 to, u8 kinds);
+// Stops watching the addresses from 'from' to 'to' for 'kinds', and
+// returns how many of them were watched for any of those
+u32  watch_remove(Machine *m, u16 from, u16 to, u8 kinds);
+void watch_reset(Machine *m);
+// The WATCH_* 'addr' is watched for
+u8 watch_kinds(const Machine *m, u16 addr);
+
+// Used by the cores
+void watch_access(Machine *m, u16 addr, u8 kind, u8 value);
+// Returns true, after showing the access, if one stopped the machine
+bool watch_caught(Machine *m);